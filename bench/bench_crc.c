@@ -0,0 +1,211 @@
+/* Throughput of the XModem CRC-16 on 128 byte and 1K blocks, with the old bit
+ * at a time loop and with crc16, and of the ZModem CRC-32.
+ *
+ * usage: bench_crc [MB] */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc16.h"
+#include "crc32.h"
+
+#define DEF_MB (256)
+
+static uint16_t crc_bitwise(const uint8_t *buf, size_t len);
+static uint32_t crc32_bitwise(const uint8_t *buf, size_t len);
+static double now(void);
+static int self_check(void);
+static void bench(const char *name, const uint8_t *buf, size_t total, size_t block, int impl);
+
+int
+main(int argc, char **argv)
+{
+    size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : DEF_MB) << 20;
+    uint8_t *buf;
+
+    if (self_check())
+        return 1;
+
+    buf = malloc(1024 * 1024);
+    srand(2);
+    for (size_t i = 0; i < 1024 * 1024; i++) {
+        buf[i] = rand();
+    }
+
+    for (size_t block = 128; block <= 1024; block *= 8) {
+        printf("%zu byte blocks\n", block);
+        bench("bitwise", buf, total / 8, block, 0);
+        bench("slice8", buf, total, block, 1);
+        bench("crc32", buf, total, block, 2);
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+/* the loop xmodem used before crc16 */
+static uint16_t
+crc_bitwise(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+
+    while ((len--) > 0) {
+        uint8_t i = 8;
+
+        crc = crc ^ (uint16_t) *data++ << 8;
+
+        do {
+            if (crc & 0x8000) {
+                crc = crc << 1 ^ 0x1021;
+            } else {
+                crc = crc << 1;
+            }
+        } while (--i);
+    }
+
+    return (crc);
+}
+
+static uint32_t
+crc32_bitwise(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+static void
+bench(const char *name, const uint8_t *buf, size_t total, size_t block, int impl)
+{
+    const size_t span = 1024 * 1024;
+    uint32_t sink = 0;
+    double start = now();
+    double secs;
+
+    /* a block at a time like a transfer does it */
+    for (size_t done = 0; done < total; done += block) {
+        const uint8_t *p = &buf[done % span];
+
+        if (impl == 0)
+            sink += crc_bitwise(p, block);
+        else if (impl == 1)
+            sink += crc16(p, block);
+        else
+            sink += crc32(p, block);
+    }
+
+    secs = now() - start;
+    printf(
+        "  %-10s %8.1f MB/s (%08x)\n",
+        name, total / secs / (1024 * 1024), sink
+    );
+}
+
+/* the check values of CRC-16/XMODEM, then agreeing with the plain loop on
+ * every length and alignment, in one go and in pieces */
+static int
+self_check()
+{
+    static const struct {
+        const char *s;
+        uint16_t crc;
+    } vectors[] = {
+        { "", 0x0000 },
+        { "A", 0x58E5 },
+        { "123456789", 0x31C3 },
+        { "The quick brown fox jumps over the lazy dog", 0xF0C8 }
+    };
+    static const struct {
+        const char *s;
+        uint32_t crc;
+    } vectors32[] = {
+        { "", 0x00000000 },
+        { "123456789", 0xCBF43926 },
+        { "The quick brown fox jumps over the lazy dog", 0x414FA339 }
+    };
+    uint8_t buf[2048 + 8];
+
+    for (size_t i = 0; i < sizeof(vectors32) / sizeof(vectors32[0]); i++) {
+        uint32_t got = crc32(vectors32[i].s, strlen(vectors32[i].s));
+
+        if (got != vectors32[i].crc) {
+            fprintf(
+                stderr, "\"%s\": got %08x expected %08x (crc32)\n",
+                vectors32[i].s, got, vectors32[i].crc
+            );
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        uint16_t got = crc16(vectors[i].s, strlen(vectors[i].s));
+
+        if (got != vectors[i].crc) {
+            fprintf(
+                stderr, "\"%s\": got %04x expected %04x\n",
+                vectors[i].s, got, vectors[i].crc
+            );
+            return -1;
+        }
+    }
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = rand();
+    }
+
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len <= 2048; len++) {
+            uint16_t expect = crc_bitwise(&buf[off], len);
+            size_t split = len ? rand() % len : 0;
+            uint16_t got = crc16(&buf[off], len);
+            uint16_t got_split = crc16_update(
+                crc16(&buf[off], split), &buf[off + split], len - split
+            );
+
+            uint32_t expect32 = crc32_bitwise(&buf[off], len);
+            uint32_t got32 = crc32(&buf[off], len);
+            uint32_t got32_split = crc32_update(
+                crc32(&buf[off], split), &buf[off + split], len - split
+            );
+
+            if (got != expect || got_split != expect) {
+                fprintf(
+                    stderr, "len %zu at %zu: got %04x/%04x expected %04x\n",
+                    len, off, got, got_split, expect
+                );
+                return -1;
+            }
+            if (got32 != expect32 || got32_split != expect32) {
+                fprintf(
+                    stderr, "len %zu at %zu: got %08x/%08x expected %08x (crc32)\n",
+                    len, off, got32, got32_split, expect32
+                );
+                return -1;
+            }
+        }
+    }
+
+    printf("self check ok\n");
+    return 0;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
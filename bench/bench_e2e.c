@@ -0,0 +1,601 @@
+/* End to end throughput of bytenuts. A generator writes synthetic traffic
+ * into a PTY pair that bytenuts uses as its serial port, while bytenuts draws
+ * either to another PTY that gets parsed for the lines it shows, or headless
+ * to /dev/null.
+ *
+ * usage: bench_e2e [OPTIONS] [-- bytenuts options]
+ *
+ * --bin=<path>      bytenuts binary (default build/bin/bytenuts)
+ * --bytes=<n>[KMG]  traffic to send (default 32M)
+ * --rate=<n>[KMG]   bytes per second to send, 0 for as fast as possible
+ * --line=<n>        average line length (default 80)
+ * --ansi=<pct>      percent of lines with color sequences (default 10)
+ * --cols=<n>        terminal width (default 120)
+ * --rows=<n>        terminal height (default 40)
+ * --headless        draw to /dev/null, no latency numbers
+ *
+ * Lines start with a <sequence number> token. Latency is the time from the
+ * token being written to the serial PTY until it shows up in the terminal
+ * output. Lines that scroll past between two frames never get drawn, and
+ * tokens ncurses only partly redraws are missed, so neither gets counted.
+ * Bytes that did not make it into the -l log count as dropped. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TOKEN_LEN (10) /* <12345678> */
+
+typedef struct gen_struct {
+    char *buf;
+    size_t len;
+    size_t *token_end; /* offset just past the token of each line */
+    double *sent_at; /* when each token was fully written */
+    double *seen_at; /* when each token showed up on screen */
+    size_t n_lines;
+} gen_t;
+
+static struct {
+    const char *bin;
+    long long bytes;
+    long long rate;
+    int line;
+    int ansi;
+    int cols;
+    int rows;
+    int headless;
+    char **extra;
+    int n_extra;
+} opts = {
+    .bin = "build/bin/bytenuts",
+    .bytes = 32 * 1024 * 1024,
+    .rate = 0,
+    .line = 80,
+    .ansi = 10,
+    .cols = 120,
+    .rows = 40,
+};
+
+static int parse_args(int argc, char **argv);
+static long long parse_size(const char *str);
+static void generate(gen_t *gen);
+static pid_t spawn(const char *home, const char *log, const char *ser, int *term_fd);
+static int gone(pid_t pid, int status, const char *home);
+static void scan_tokens(gen_t *gen, const char *buf, size_t len, double now);
+static int cmp_double(const void *a, const void *b);
+static double now(void);
+static off_t file_size(const char *path);
+static int rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw);
+
+int
+main(int argc, char **argv)
+{
+    gen_t gen = { 0 };
+    char home[] = "/tmp/bench_e2e.XXXXXX";
+    char log[64];
+    char ser[64];
+    int ser_fd, term_fd;
+    pid_t pid;
+    size_t sent = 0;
+    size_t stamped = 0;
+    double start, done, last_growth;
+    off_t logged = 0;
+    off_t log_base;
+    struct rusage ru;
+    double cpu;
+    double *lat;
+    size_t n_lat = 0;
+    int status = -1;
+
+    if (parse_args(argc, argv))
+        return 1;
+
+    /* a headless bytenuts that died closes the key pipe on us */
+    signal(SIGPIPE, SIG_IGN);
+
+    generate(&gen);
+
+    if (!mkdtemp(home)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(log, sizeof(log), "%s/bench.log", home);
+
+    /* the serial side, bytenuts gets the slave */
+    ser_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (ser_fd < 0 || grantpt(ser_fd) || unlockpt(ser_fd)) {
+        perror("posix_openpt");
+        return 1;
+    }
+    snprintf(ser, sizeof(ser), "%s", ptsname(ser_fd));
+
+    pid = spawn(home, log, ser, &term_fd);
+    if (pid < 0)
+        return 1;
+
+    /* give it time to open the port and draw the first screen */
+    for (double t = now() + 0.5; now() < t;) {
+        char buf[4096];
+        struct pollfd pfd = { .fd = term_fd, .events = POLLIN };
+
+        if (poll(&pfd, 1, 50) > 0 && read(term_fd, buf, sizeof(buf)) <= 0)
+            break;
+    }
+
+    /* the welcome text gets logged too */
+    log_base = file_size(log);
+    start = now();
+
+    while (sent < gen.len) {
+        struct pollfd fds[2] = {
+            { .fd = term_fd, .events = POLLIN },
+            { .fd = ser_fd, .events = POLLOUT },
+        };
+        size_t allowed = gen.len - sent;
+        int to_ms = 100;
+
+        if (opts.rate > 0) {
+            double budget = (now() - start) * opts.rate - sent;
+
+            allowed = budget > 0 ? (size_t)budget : 0;
+            if (allowed > gen.len - sent)
+                allowed = gen.len - sent;
+            if (allowed == 0)
+                to_ms = 1;
+        }
+
+        if (poll(fds, allowed ? 2 : 1, to_ms) < 0 && errno != EINTR)
+            break;
+
+        /* bytenuts died or let go of its terminal, it is not coming back */
+        if (
+            (fds[0].revents & (POLLHUP | POLLERR)) ||
+            waitpid(pid, &status, WNOHANG) == pid
+        ) {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[65536];
+            ssize_t n = read(term_fd, buf, sizeof(buf));
+
+            if (n > 0 && !opts.headless)
+                scan_tokens(&gen, buf, n, now());
+        }
+
+        if (allowed && (fds[1].revents & POLLOUT)) {
+            ssize_t n = write(ser_fd, &gen.buf[sent], allowed);
+
+            if (n > 0) {
+                double t = now();
+
+                sent += n;
+                while (stamped < gen.n_lines && gen.token_end[stamped] <= sent) {
+                    gen.sent_at[stamped] = t;
+                    stamped++;
+                }
+            }
+        }
+    }
+
+    if (sent < gen.len)
+        return gone(pid, status, home);
+
+    /* wait for everything to be logged, or for the log to stop growing */
+    done = last_growth = now();
+    while (now() - last_growth < 2.0) {
+        struct pollfd pfd = { .fd = term_fd, .events = POLLIN };
+        off_t sz;
+
+        if (poll(&pfd, 1, 10) > 0) {
+            char buf[65536];
+            ssize_t n = read(term_fd, buf, sizeof(buf));
+
+            if (n > 0 && !opts.headless)
+                scan_tokens(&gen, buf, n, now());
+        }
+
+        if (
+            (pfd.revents & (POLLHUP | POLLERR)) ||
+            waitpid(pid, &status, WNOHANG) == pid
+        ) {
+            return gone(pid, status, home);
+        }
+
+        sz = file_size(log) - log_base;
+        if (sz > logged) {
+            logged = sz;
+            done = last_growth = now();
+        }
+        if ((size_t)logged >= sent)
+            break;
+
+        /* drain the serial side in case anything gets echoed back */
+        char junk[4096];
+        while (read(ser_fd, junk, sizeof(junk)) > 0) {
+        }
+    }
+
+    /* ctrl-b q, then make sure it goes */
+    write(term_fd, "\x02q", 2);
+    for (int i = 0; i < 300 && waitpid(pid, NULL, WNOHANG) == 0; i++) {
+        char buf[65536];
+
+        while (read(term_fd, buf, sizeof(buf)) > 0) {
+        }
+        if (i == 200)
+            kill(pid, SIGINT);
+        nanosleep(&(struct timespec){ 0, 10000000 }, NULL);
+    }
+    if (waitpid(pid, NULL, WNOHANG) == 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    /* the log gets its last flush at exit */
+    logged = file_size(log) - log_base;
+
+    getrusage(RUSAGE_CHILDREN, &ru);
+    cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+    lat = malloc(sizeof(double) * (gen.n_lines + 1));
+    for (size_t i = 0; i < gen.n_lines; i++) {
+        if (gen.seen_at[i] > 0 && gen.sent_at[i] > 0)
+            lat[n_lat++] = gen.seen_at[i] - gen.sent_at[i];
+    }
+    qsort(lat, n_lat, sizeof(double), cmp_double);
+
+    printf("backend     %s, %dx%d\n", opts.headless ? "headless" : "pty", opts.cols, opts.rows);
+    printf("sent        %zu bytes, %zu lines in %.2fs\n", sent, gen.n_lines, done - start);
+    printf("throughput  %.2f MB/s\n", sent / (done - start) / (1024 * 1024));
+    printf("dropped     %lld bytes\n", (long long)sent - (long long)logged);
+    if (n_lat > 0) {
+        printf(
+            "latency     p50 %.2fms p99 %.2fms (%zu samples)\n",
+            lat[n_lat / 2] * 1000, lat[n_lat * 99 / 100] * 1000, n_lat
+        );
+    }
+    else {
+        printf("latency     n/a\n");
+    }
+    printf("cpu         %.2fs, %.2f ms/MB\n", cpu, cpu * 1000 / (sent / (1024.0 * 1024)));
+
+    nftw(home, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return 0;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--")) {
+            opts.extra = &argv[i + 1];
+            opts.n_extra = argc - i - 1;
+            break;
+        }
+        else if (!strncmp(argv[i], "--bin=", 6)) {
+            opts.bin = &argv[i][6];
+        }
+        else if (!strncmp(argv[i], "--bytes=", 8)) {
+            opts.bytes = parse_size(&argv[i][8]);
+        }
+        else if (!strncmp(argv[i], "--rate=", 7)) {
+            opts.rate = parse_size(&argv[i][7]);
+        }
+        else if (!strncmp(argv[i], "--line=", 7)) {
+            opts.line = atoi(&argv[i][7]);
+        }
+        else if (!strncmp(argv[i], "--ansi=", 7)) {
+            opts.ansi = atoi(&argv[i][7]);
+        }
+        else if (!strncmp(argv[i], "--cols=", 7)) {
+            opts.cols = atoi(&argv[i][7]);
+        }
+        else if (!strncmp(argv[i], "--rows=", 7)) {
+            opts.rows = atoi(&argv[i][7]);
+        }
+        else if (!strcmp(argv[i], "--headless")) {
+            opts.headless = 1;
+        }
+        else {
+            fprintf(stderr, "unknown option %s, see the top of bench/bench_e2e.c\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (opts.bytes <= 0 || opts.rate < 0 || opts.line < TOKEN_LEN + 2) {
+        fprintf(stderr, "bad option value\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static long long
+parse_size(const char *str)
+{
+    char *end;
+    long long ret = strtoll(str, &end, 10);
+
+    switch (*end) {
+    case 'g':
+    case 'G':
+        ret *= 1024;
+        /* fall-through */
+    case 'm':
+    case 'M':
+        ret *= 1024;
+        /* fall-through */
+    case 'k':
+    case 'K':
+        ret *= 1024;
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+/* lines of opts.line +-50% bytes ending in CRLF, opts.ansi percent of them
+ * with a few colored words */
+static void
+generate(gen_t *gen)
+{
+    size_t cap = opts.bytes + 4096;
+    size_t lines_cap = opts.bytes / (opts.line / 2) + 1;
+
+    gen->buf = malloc(cap);
+    gen->token_end = malloc(sizeof(size_t) * lines_cap);
+    gen->sent_at = calloc(lines_cap, sizeof(double));
+    gen->seen_at = calloc(lines_cap, sizeof(double));
+
+    srand(1);
+
+    while (gen->len < (size_t)opts.bytes && gen->n_lines < lines_cap) {
+        int n = opts.line / 2 + rand() % (opts.line + 1);
+        int color = (rand() % 100) < opts.ansi;
+        size_t line_start = gen->len;
+
+        gen->len += sprintf(&gen->buf[gen->len], "<%08zu>", gen->n_lines % 100000000);
+        gen->token_end[gen->n_lines] = gen->len;
+        gen->n_lines++;
+
+        while (gen->len - line_start < (size_t)n - 2 && gen->len + 64 < cap) {
+            int word = 2 + rand() % 8;
+
+            if (color && (rand() % 3) == 0)
+                gen->len += sprintf(&gen->buf[gen->len], "\e[%d;1m", 31 + rand() % 7);
+
+            gen->buf[gen->len++] = ' ';
+            for (int i = 0; i < word; i++) {
+                gen->buf[gen->len++] = 'a' + rand() % 26;
+            }
+
+            if (color)
+                gen->len += sprintf(&gen->buf[gen->len], "\e[0m");
+        }
+
+        gen->buf[gen->len++] = '\r';
+        gen->buf[gen->len++] = '\n';
+    }
+}
+
+/* start bytenuts with its own HOME so no user config gets in the way */
+static pid_t
+spawn(const char *home, const char *log, const char *ser, int *term_fd)
+{
+    char *args[64];
+    int n_args = 0;
+    char cfg[128];
+    int in_pipe[2];
+    char *slave = NULL;
+    pid_t pid;
+
+    snprintf(cfg, sizeof(cfg), "%s/.config", home);
+    mkdir(cfg, 0755);
+    snprintf(cfg, sizeof(cfg), "%s/.config/bytenuts", home);
+    mkdir(cfg, 0755);
+
+    if (opts.headless) {
+        /* keys go in over a pipe, the screen goes to /dev/null */
+        if (pipe(in_pipe))
+            return -1;
+        *term_fd = in_pipe[1];
+    }
+    else {
+        struct winsize ws = { .ws_row = opts.rows, .ws_col = opts.cols };
+
+        *term_fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (*term_fd < 0 || grantpt(*term_fd) || unlockpt(*term_fd)) {
+            perror("posix_openpt");
+            return -1;
+        }
+        slave = strdup(ptsname(*term_fd));
+        ioctl(*term_fd, TIOCSWINSZ, &ws);
+    }
+    fcntl(*term_fd, F_SETFL, fcntl(*term_fd, F_GETFL) | O_NONBLOCK);
+
+    args[n_args++] = (char *)opts.bin;
+    args[n_args++] = "-l";
+    args[n_args++] = (char *)log;
+    if (opts.headless)
+        args[n_args++] = "--headless";
+    for (int i = 0; i < opts.n_extra && n_args < 60; i++) {
+        args[n_args++] = opts.extra[i];
+    }
+    args[n_args++] = (char *)ser;
+    args[n_args] = NULL;
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0) {
+        char cols[16], rows[16];
+
+        snprintf(cols, sizeof(cols), "%d", opts.cols);
+        snprintf(rows, sizeof(rows), "%d", opts.rows);
+        setenv("HOME", home, 1);
+        setenv("TERM", "xterm-256color", 1);
+        setenv("COLUMNS", cols, 1);
+        setenv("LINES", rows, 1);
+
+        if (opts.headless) {
+            int null = open("/dev/null", O_RDWR);
+
+            dup2(in_pipe[0], 0);
+            dup2(null, 1);
+            dup2(null, 2);
+        }
+        else {
+            int fd;
+
+            setsid();
+            fd = open(slave, O_RDWR);
+            if (fd < 0)
+                _exit(1);
+            dup2(fd, 0);
+            dup2(fd, 1);
+            dup2(fd, 2);
+        }
+
+        execv(opts.bin, args);
+        _exit(1);
+    }
+
+    /* only the child reads keys, so its end closing shows up as POLLERR */
+    if (opts.headless)
+        close(in_pipe[0]);
+
+    free(slave);
+    return pid;
+}
+
+/* bytenuts went away in the middle of the run, there are no numbers to give.
+ * status is from waitpid, -1 if it has not been reaped. Returns the exit
+ * code of the benchmark. */
+static int
+gone(pid_t pid, int status, const char *home)
+{
+    /* the terminal hangs up a moment before the exit can be reaped */
+    for (int i = 0; i < 100 && status == -1; i++) {
+        if (waitpid(pid, &status, WNOHANG) == 0)
+            nanosleep(&(struct timespec){ 0, 10000000 }, NULL);
+    }
+
+    if (status == -1 && waitpid(pid, &status, WNOHANG) == 0) {
+        fprintf(stderr, "bytenuts let go of its terminal, killing it\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+
+    if (WIFEXITED(status))
+        fprintf(stderr, "bytenuts exited early with status %d\n", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        fprintf(stderr, "bytenuts was killed by signal %d\n", WTERMSIG(status));
+    else
+        fprintf(stderr, "bytenuts went away\n");
+
+    nftw(home, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return 1;
+}
+
+/* find <nnnnnnnn> tokens in the terminal output, a token may be split over
+ * two reads */
+static void
+scan_tokens(gen_t *gen, const char *buf, size_t len, double t)
+{
+    static char *scratch;
+    static size_t scratch_cap;
+    static char carry[TOKEN_LEN];
+    static size_t n_carry;
+    size_t n = n_carry + len;
+
+    if (n > scratch_cap) {
+        scratch_cap = n * 2;
+        scratch = realloc(scratch, scratch_cap);
+    }
+    memcpy(scratch, carry, n_carry);
+    memcpy(&scratch[n_carry], buf, len);
+    n_carry = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t seq = 0;
+        size_t j;
+
+        if (scratch[i] != '<')
+            continue;
+
+        if (n - i < TOKEN_LEN) {
+            n_carry = n - i;
+            memcpy(carry, &scratch[i], n_carry);
+            break;
+        }
+
+        for (j = 1; j < 9 && scratch[i + j] >= '0' && scratch[i + j] <= '9'; j++) {
+            seq = seq * 10 + (scratch[i + j] - '0');
+        }
+
+        if (
+            j == 9 && scratch[i + 9] == '>' &&
+            seq < gen->n_lines && gen->seen_at[seq] == 0
+        ) {
+            gen->seen_at[seq] = t;
+        }
+    }
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static off_t
+file_size(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st))
+        return 0;
+
+    return st.st_size;
+}
+
+static int
+rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
@@ -0,0 +1,232 @@
+/* Throughput of splitting received data into printable runs, the way
+ * insert_buf does it, with the old byte at a time loop and with every
+ * scan_ctrl implementation the cpu has.
+ *
+ * usage: bench_scan [captured log ...]
+ * Without logs a synthetic log with some colored lines is used. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scan.h"
+
+#define READ_SZ   (1024)
+#define SYNTH_SZ  (64 * 1024 * 1024)
+#define MIN_BYTES (256 * 1024 * 1024)
+
+static size_t scan_bytewise(const char *buf, size_t len);
+static size_t split_runs(const char *buf, size_t len, int bytewise, char *line);
+static double now(void);
+static char *read_file(const char *path, size_t *len);
+static char *synth_log(size_t *len);
+static int self_check(void);
+static void bench(const char *name, const char *buf, size_t len, int bytewise);
+
+int
+main(int argc, char **argv)
+{
+    static const char *impls[] = { "scalar", "sse2", "avx2" };
+
+    if (self_check())
+        return 1;
+
+    for (int i = 1; i < argc || i == 1; i++) {
+        size_t len;
+        char *buf = argc > 1 ? read_file(argv[i], &len) : synth_log(&len);
+
+        if (!buf) {
+            fprintf(stderr, "failed to read %s\n", argv[i]);
+            return 1;
+        }
+
+        printf("%s (%zu bytes)\n", argc > 1 ? argv[i] : "synthetic log", len);
+        bench("bytewise", buf, len, 1);
+
+        for (size_t j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+            if (scan_use(impls[j]))
+                continue;
+            bench(impls[j], buf, len, 0);
+        }
+
+        free(buf);
+    }
+
+    return 0;
+}
+
+/* the loop insert_buf used before scan_ctrl */
+static size_t
+scan_bytewise(const char *buf, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len && buf[i] != '\n' && buf[i] != '\r' && buf[i] != '\e') {
+        i++;
+    }
+
+    return i;
+}
+
+/* copy the printable runs of buf into line, returns the number of runs */
+static size_t
+split_runs(const char *buf, size_t len, int bytewise, char *line)
+{
+    size_t runs = 0;
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t run = i + (bytewise ? scan_bytewise : scan_ctrl)(&buf[i], len - i);
+
+        if (run > i) {
+            memcpy(&line[pos], &buf[i], run - i);
+            pos = (pos + run - i) % READ_SZ;
+            runs++;
+        }
+
+        if (run < len && buf[run] == '\n')
+            pos = 0;
+
+        i = run + 1;
+    }
+
+    return runs;
+}
+
+static void
+bench(const char *name, const char *buf, size_t len, int bytewise)
+{
+    char line[READ_SZ * 2];
+    size_t total = 0;
+    size_t runs = 0;
+    double start = now();
+    double secs;
+
+    /* feed it in read sized chunks like the reader thread does */
+    while (total < MIN_BYTES) {
+        for (size_t off = 0; off < len; off += READ_SZ) {
+            size_t n = len - off < READ_SZ ? len - off : READ_SZ;
+
+            runs += split_runs(&buf[off], n, bytewise, line);
+        }
+        total += len;
+    }
+
+    secs = now() - start;
+    printf(
+        "  %-10s %8.1f MB/s (%zu runs)\n",
+        name, total / secs / (1024 * 1024), runs
+    );
+}
+
+/* every implementation has to agree with the plain loop */
+static int
+self_check()
+{
+    static const char *impls[] = { "scalar", "sse2", "avx2" };
+    char buf[256];
+
+    srand(1);
+
+    for (int iter = 0; iter < 100000; iter++) {
+        size_t len = rand() % sizeof(buf);
+        size_t expect;
+
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = 0x20 + rand() % 0xE0;
+        }
+        if (len > 0 && (iter & 1))
+            buf[rand() % len] = rand() % 0x20;
+
+        expect = len;
+        for (size_t i = 0; i < len; i++) {
+            if ((uint8_t)buf[i] < 0x20) {
+                expect = i;
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+            size_t got;
+
+            if (scan_use(impls[j]))
+                continue;
+
+            got = scan_ctrl(buf, len);
+            if (got != expect) {
+                fprintf(
+                    stderr, "%s: got %zu expected %zu for len %zu\n",
+                    impls[j], got, expect, len
+                );
+                return -1;
+            }
+        }
+    }
+
+    printf("self check ok\n");
+    return 0;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+read_file(const char *path, size_t *len)
+{
+    FILE *fp = fopen(path, "rb");
+    char *ret;
+    long sz;
+
+    if (!fp)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    ret = malloc(sz > 0 ? sz : 1);
+    *len = fread(ret, 1, sz, fp);
+    fclose(fp);
+
+    return ret;
+}
+
+/* lines of 20 to 120 characters, a few of them colored */
+static char *
+synth_log(size_t *len)
+{
+    char *ret = malloc(SYNTH_SZ);
+    size_t pos = 0;
+
+    srand(2);
+
+    while (pos + 256 < SYNTH_SZ) {
+        int n = 20 + rand() % 100;
+        int color = (rand() % 8) == 0;
+
+        if (color)
+            pos += sprintf(&ret[pos], "\e[38;5;%dm", rand() % 256);
+
+        for (int i = 0; i < n; i++) {
+            ret[pos++] = 'a' + rand() % 26;
+        }
+
+        if (color)
+            pos += sprintf(&ret[pos], "\e[0m");
+
+        ret[pos++] = '\r';
+        ret[pos++] = '\n';
+    }
+
+    *len = pos;
+    return ret;
+}
@@ -0,0 +1,207 @@
+/* Time to search a large scrollback with lines_find, both in memory and with
+ * most of it spilled to disk, for every scan_find implementation the cpu has.
+ * The search that finds nothing has to go through every line, so it is the
+ * worst case.
+ *
+ * usage: bench_search [lines]
+ * Defaults to 3 million lines of 20 to 120 characters. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lines.h"
+#include "scan.h"
+
+#define DEF_LINES (3000000)
+#define SPILL_PATH "/tmp/bench_search"
+
+static int fill(lines_t *lines, int n_lines);
+static int naive_find(lines_t *lines, int idx, int dir, const char *s, int *col);
+static double now(void);
+static int self_check(void);
+static void bench(const char *name, lines_t *lines);
+
+int
+main(int argc, char **argv)
+{
+    static const char *impls[] = { "scalar", "sse2", "avx2" };
+    int n_lines = argc > 1 ? atoi(argv[1]) : DEF_LINES;
+    lines_t mem = { 0 };
+    lines_t disk = { 0 };
+
+    if (self_check())
+        return 1;
+
+    fill(&mem, n_lines);
+    if (lines_spill(&disk, SPILL_PATH, 1000, 0)) {
+        fprintf(stderr, "failed to set up spill files at %s\n", SPILL_PATH);
+        return 1;
+    }
+    fill(&disk, n_lines);
+
+    printf("%d lines, %zuMB in memory\n", n_lines, mem.mem >> 20);
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (scan_use(impls[i]))
+            continue;
+
+        printf("%s\n", impls[i]);
+        bench("memory", &mem);
+        bench("spilled", &disk);
+    }
+
+    lines_free(&mem);
+    lines_free(&disk);
+
+    return 0;
+}
+
+/* lines of 20 to 120 lowercase characters, every 1000th line has a marker
+ * in it, some lines get runs so they are padded like colored lines are */
+static int
+fill(lines_t *lines, int n_lines)
+{
+    static const lines_run_t runs[] = { { 0, 1 }, { 4, 0 } };
+    char line[256];
+
+    srand(3);
+
+    for (int i = 0; i < n_lines; i++) {
+        int n = 20 + rand() % 100;
+
+        for (int j = 0; j < n; j++) {
+            line[j] = 'a' + rand() % 26;
+        }
+        if (i % 1000 == 500)
+            memcpy(&line[n - 10], "MARK", 4);
+
+        lines_newline(lines);
+        lines_write(lines, 0, line, n);
+        if (i % 8 == 0)
+            lines_finish(lines, runs, 2);
+    }
+
+    return 0;
+}
+
+/* lines_find one line at a time */
+static int
+naive_find(lines_t *lines, int idx, int dir, const char *s, int *col)
+{
+    int s_len = strlen(s);
+
+    for (; idx >= 0 && idx < lines->n_lines; idx += dir > 0 ? 1 : -1) {
+        int len;
+        const uint8_t *line = lines_get(lines, idx, &len);
+        int found = -1;
+
+        for (int i = 0; i + s_len <= len; i++) {
+            if (!memcmp(&line[i], s, s_len)) {
+                found = i;
+                if (dir > 0)
+                    break;
+            }
+        }
+
+        if (found >= 0) {
+            *col = found;
+            return idx;
+        }
+    }
+
+    return -1;
+}
+
+static void
+bench(const char *name, lines_t *lines)
+{
+    double start;
+    int col, hits = 0;
+    int line = lines->n_lines;
+
+    /* step back through every marker, like pressing next over and over */
+    start = now();
+    while ((line = lines_find(lines, line - 1, -1, "MARK", 4, &col)) >= 0) {
+        hits++;
+    }
+    printf(
+        "  %-8s every hit back to front: %d hits in %.1fms\n",
+        name, hits, (now() - start) * 1e3
+    );
+
+    start = now();
+    line = lines_find(lines, lines->n_lines - 1, -1, "not there", 9, &col);
+    printf(
+        "  %-8s no hit, back to front:   %.1fms\n",
+        name, (now() - start) * 1e3
+    );
+
+    start = now();
+    line = lines_find(lines, 0, 1, "not there", 9, &col);
+    printf(
+        "  %-8s no hit, front to back:   %.1fms\n",
+        name, (now() - start) * 1e3
+    );
+}
+
+/* lines_find has to agree with the line at a time search for every
+ * implementation, in memory and spilled */
+static int
+self_check()
+{
+    static const char *impls[] = { "scalar", "sse2", "avx2" };
+    static const char *needles[] = { "a", "ab", "MARK", "xyz", "qqq", "ARKa" };
+    lines_t lines[2] = { { 0 }, { 0 } };
+    int n_lines = 20000;
+
+    fill(&lines[0], n_lines);
+    if (lines_spill(&lines[1], SPILL_PATH, 1000, 0))
+        return -1;
+    fill(&lines[1], n_lines);
+
+    srand(4);
+
+    for (int iter = 0; iter < 2000; iter++) {
+        const char *s = needles[rand() % (sizeof(needles) / sizeof(needles[0]))];
+        int idx = rand() % n_lines;
+        int dir = (iter & 1) ? 1 : -1;
+        int col = 0, expect_col = -1;
+        int expect = naive_find(&lines[0], idx, dir, s, &expect_col);
+
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            if (scan_use(impls[i]))
+                continue;
+
+            for (int j = 0; j < 2; j++) {
+                int got = lines_find(&lines[j], idx, dir, s, strlen(s), &col);
+
+                if (got != expect || (got >= 0 && col != expect_col)) {
+                    fprintf(
+                        stderr,
+                        "%s: \"%s\" from %d dir %d got %d:%d expected %d:%d%s\n",
+                        impls[i], s, idx, dir, got, col, expect, expect_col,
+                        j ? " (spilled)" : ""
+                    );
+                    return -1;
+                }
+            }
+        }
+    }
+
+    lines_free(&lines[0]);
+    lines_free(&lines[1]);
+
+    printf("self check ok\n");
+    return 0;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,301 @@
+/* XModem send and receive against each other over PTYs. The sender and the
+ * receiver each get the slave of a PTY pair, and a relay copies between the
+ * masters, optionally corrupting data and turning ACKs into NAKs so the
+ * retransmit and duplicate block paths get exercised. The received file has
+ * to match what was sent, up to the padding of the last block. Streaming
+ * (1K-G) runs have no ACKs to wait for, and damage has to cancel both ends.
+ *
+ * usage: bench_xmodem [MB]
+ * Defaults to 4MB of random data. */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xmodem.h"
+
+#define DEF_MB   (4)
+#define IN_PATH  "/tmp/bench_xmodem.in"
+#define OUT_PATH "/tmp/bench_xmodem.out"
+
+typedef struct pty_struct {
+    int master;
+    int slave;
+} pty_t;
+
+typedef struct run_struct {
+    const char *name;
+    int block_sz;
+    int stream; /* receiver asks for 'G' */
+    size_t corrupt_every; /* data bytes between corrupted bytes, 0 for none */
+    int nak_every; /* ACKs between ones turned into NAKs, 0 for none */
+} run_t;
+
+static struct {
+    pty_t tx; /* sender side */
+    pty_t rx; /* receiver side */
+    volatile int running;
+    volatile int sending;
+    const run_t *run;
+    size_t size;
+    int send_ret;
+    int ack_fails;
+    int nak_fails;
+} bench;
+
+static int open_pty(pty_t *pty);
+static void *relay_thread(void *arg);
+static void *send_thread(void *arg);
+static void send_cb(size_t sent, size_t total, int ack_fails);
+static void recv_cb(size_t received, int nak_fails);
+static int check_output(size_t size);
+static double now(void);
+static int run(const run_t *run);
+
+int
+main(int argc, char **argv)
+{
+    static const run_t runs[] = {
+        { "128B", 128, 0, 0, 0 },
+        { "1K", 1024, 0, 0, 0 },
+        { "1K lossy", 1024, 0, 1 << 20, 500 },
+        { "1K-G", 1024, 1, 0, 0 },
+        { "1K-G lossy", 1024, 1, 1 << 20, 0 },
+    };
+    int mb = argc > 1 ? atoi(argv[1]) : DEF_MB;
+    FILE *fp = fopen(IN_PATH, "w");
+
+    if (!fp) {
+        perror(IN_PATH);
+        return 1;
+    }
+
+    /* not a multiple of either block size, so the last block gets padded */
+    bench.size = ((size_t)mb << 20) + 1000;
+    srand(5);
+    for (size_t i = 0; i < bench.size; i++) {
+        fputc(rand(), fp);
+    }
+    fclose(fp);
+
+    printf("%zu bytes\n", bench.size);
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (run(&runs[i]))
+            return 1;
+    }
+
+    unlink(IN_PATH);
+    unlink(OUT_PATH);
+
+    return 0;
+}
+
+static int
+run(const run_t *r)
+{
+    pthread_t relay, sender;
+    double start, secs;
+    int out_fd, ret;
+
+    if (open_pty(&bench.tx) || open_pty(&bench.rx)) {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    out_fd = open(OUT_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        perror(OUT_PATH);
+        return -1;
+    }
+
+    bench.run = r;
+    bench.ack_fails = 0;
+    bench.nak_fails = 0;
+    bench.running = 1;
+    bench.sending = 1;
+    pthread_create(&relay, NULL, relay_thread, NULL);
+    pthread_create(&sender, NULL, send_thread, NULL);
+
+    start = now();
+    ret = xmodem_recv(bench.rx.slave, out_fd, r->stream, recv_cb);
+    /* a cancelled sender keeps streaming until it sees the CANs */
+    while (bench.sending) {
+        uint8_t buf[4096];
+
+        if (poll(&(struct pollfd){ .fd = bench.rx.slave, .events = POLLIN }, 1, 10) > 0)
+            read(bench.rx.slave, buf, sizeof(buf));
+    }
+    pthread_join(sender, NULL);
+    secs = now() - start;
+
+    bench.running = 0;
+    pthread_join(relay, NULL);
+    close(out_fd);
+    close(bench.tx.master);
+    close(bench.tx.slave);
+    close(bench.rx.master);
+    close(bench.rx.slave);
+
+    /* damage is the end of a streamed transfer */
+    if (r->stream && r->corrupt_every) {
+        if (ret != XMODEM_ERR_DAMAGED || bench.send_ret != XMODEM_ERR_CANCEL) {
+            fprintf(stderr, "%s: receive %d, send %d\n", r->name, ret, bench.send_ret);
+            return -1;
+        }
+        printf("  %-10s cancelled both ends in %.2fs\n", r->name, secs);
+        return 0;
+    }
+
+    if (ret || bench.send_ret) {
+        fprintf(stderr, "%s: receive %d, send %d\n", r->name, ret, bench.send_ret);
+        return -1;
+    }
+    if (check_output(bench.size)) {
+        fprintf(stderr, "%s: received file differs\n", r->name);
+        return -1;
+    }
+
+    printf(
+        "  %-10s %8.1f KB/s %6.2fs (%d ACK fails, %d NAKs)\n",
+        r->name, bench.size / secs / 1024, secs, bench.ack_fails, bench.nak_fails
+    );
+
+    return 0;
+}
+
+static int
+open_pty(pty_t *pty)
+{
+    struct termios tio;
+
+    pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty->master < 0 || grantpt(pty->master) || unlockpt(pty->master))
+        return -1;
+
+    pty->slave = open(ptsname(pty->master), O_RDWR | O_NOCTTY);
+    if (pty->slave < 0)
+        return -1;
+
+    /* like serial_open does to a real port */
+    tcgetattr(pty->slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty->slave, TCSANOW, &tio);
+
+    return 0;
+}
+
+/* copies both ways between the masters, damaging what the run asks for */
+static void *
+relay_thread(void *arg)
+{
+    size_t data_bytes = 0;
+    int acks = 0;
+
+    while (bench.running) {
+        struct pollfd fds[2] = {
+            { .fd = bench.tx.master, .events = POLLIN },
+            { .fd = bench.rx.master, .events = POLLIN },
+        };
+        uint8_t buf[4096];
+        ssize_t n;
+
+        if (poll(fds, 2, 100) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN) {
+            n = read(bench.tx.master, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n && bench.run->corrupt_every; i++) {
+                if (++data_bytes % bench.run->corrupt_every == 0)
+                    buf[i] ^= 0x55;
+            }
+            if (n > 0)
+                write(bench.rx.master, buf, n);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            n = read(bench.rx.master, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n && bench.run->nak_every; i++) {
+                if (buf[i] == XMODEM_ACK && ++acks % bench.run->nak_every == 0)
+                    buf[i] = XMODEM_NAK;
+            }
+            if (n > 0)
+                write(bench.tx.master, buf, n);
+        }
+    }
+
+    return NULL;
+}
+
+static void *
+send_thread(void *arg)
+{
+    int in_fd = open(IN_PATH, O_RDONLY);
+
+    bench.send_ret = xmodem_send(
+        bench.tx.slave, in_fd, bench.size, bench.run->block_sz, send_cb
+    );
+    close(in_fd);
+    bench.sending = 0;
+
+    return NULL;
+}
+
+static void
+send_cb(size_t sent, size_t total, int ack_fails)
+{
+    bench.ack_fails = ack_fails;
+}
+
+static void
+recv_cb(size_t received, int nak_fails)
+{
+    bench.nak_fails = nak_fails;
+}
+
+/* the sent data, then nothing but padding up to a whole block */
+static int
+check_output(size_t size)
+{
+    FILE *in = fopen(IN_PATH, "r");
+    FILE *out = fopen(OUT_PATH, "r");
+    size_t pos = 0;
+    int a, b;
+    int ret = 0;
+
+    if (!in || !out)
+        return -1;
+
+    while ((b = fgetc(out)) != EOF) {
+        a = fgetc(in);
+        if ((a != EOF && a != b) || (a == EOF && b != XMODEM_PAD)) {
+            ret = -1;
+            break;
+        }
+        pos++;
+    }
+
+    if (pos < size || pos % bench.run->block_sz)
+        ret = -1;
+
+    fclose(in);
+    fclose(out);
+
+    return ret;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,672 @@
+/* ZModem uploads to a scripted receiver over a PTY. The sender gets the slave
+ * of a PTY pair and the receiver below reads the master, answering the way
+ * rz would: ZRINIT, ZRPOS to start a file, a ZACK for every ZCRCQ and ZRINIT
+ * after ZEOF. Runs can make it throw a subpacket away and ask for it again
+ * with ZRPOS while the sender is in the middle of its window, start from a
+ * partial copy when the sender offers ZCRESUM, or skip an offered file. The
+ * received file has to match what was sent, with nothing padded on.
+ *
+ * usage: bench_zmodem [MB]
+ * Defaults to 4MB of random data. */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc16.h"
+#include "crc32.h"
+#include "zmodem.h"
+
+#define DEF_MB    (4)
+#define IN_PATH   "/tmp/bench_zmodem.in"
+#define OUT_PATH  "/tmp/bench_zmodem.out"
+#define SKIP_NAME "skip.bin"
+#define RX_TO     (5000) /* in ms, the sender should never be quiet that long */
+
+/* the parts of the protocol the receiver needs */
+#define ZPAD      '*'
+#define ZDLE      (0x18)
+#define ZBIN      'A'
+#define ZHEX      'B'
+#define ZBIN32    'C'
+#define ZCRCE     'h'
+#define ZCRCG     'i'
+#define ZCRCQ     'j'
+#define ZCRCW     'k'
+#define ZRUB0     'l'
+#define ZRUB1     'm'
+#define CANFDX    (0x01)
+#define CANOVIO   (0x02)
+#define CANFC32   (0x20)
+#define ZCRESUM   (3)
+
+enum zm_frame_enum {
+    ZRQINIT = 0,
+    ZRINIT,
+    ZSINIT,
+    ZACK,
+    ZFILE,
+    ZSKIP,
+    ZNAK,
+    ZABORT,
+    ZFIN,
+    ZRPOS,
+    ZDATA,
+    ZEOF,
+};
+
+typedef struct pty_struct {
+    int master;
+    int slave;
+} pty_t;
+
+typedef struct run_struct {
+    const char *name;
+    size_t fail_at; /* throw away the subpacket with this byte, 0 for none */
+    int resume; /* the receiver already has the first third */
+    int skip; /* another file is offered first and skipped */
+} run_t;
+
+static struct {
+    pty_t pty;
+    const run_t *run;
+    size_t size;
+    volatile int sending;
+    int begin_ret;
+    int skip_ret;
+    int send_ret;
+    int end_ret;
+    /* what the sender saw */
+    int resends;
+    size_t first_sent;
+    /* what the receiver saw */
+    int conv;
+    int zrpos;
+    int zacks;
+    int skipped;
+    /* received bytes not looked at yet */
+    uint8_t rx[4096];
+    size_t rx_len;
+    size_t rx_pos;
+} bench;
+
+static int open_pty(pty_t *pty);
+static void *send_thread(void *arg);
+static void send_cb(size_t sent, size_t total, int resends);
+static int receive(const run_t *r, int out_fd, size_t have);
+static int get_byte(void);
+static int get_zdle(void);
+static int get_hex(void);
+static int get_header(uint8_t hdr[4]);
+static int get_subpacket(uint8_t *buf, size_t max, int *end);
+static int send_hex_header(int type, const uint8_t hdr[4]);
+static void pos_hdr(uint8_t hdr[4], size_t pos);
+static size_t hdr_pos(const uint8_t hdr[4]);
+static int check_output(size_t size);
+static double now(void);
+static int run(const run_t *run);
+
+int
+main(int argc, char **argv)
+{
+    int mb = argc > 1 ? atoi(argv[1]) : DEF_MB;
+    FILE *fp = fopen(IN_PATH, "w");
+
+    if (!fp) {
+        perror(IN_PATH);
+        return 1;
+    }
+
+    /* not a multiple of the subpacket size, so the last one is short */
+    bench.size = ((size_t)mb << 20) + 1000;
+    srand(5);
+    for (size_t i = 0; i < bench.size; i++) {
+        fputc(rand(), fp);
+    }
+    fclose(fp);
+
+    /* halfway through and off any ZCRCQ, so data is still in flight */
+    const run_t runs[] = {
+        { "clean", 0, 0, 0 },
+        { "ZRPOS", bench.size / 2 + 5000, 0, 0 },
+        { "ZCRESUM", 0, 1, 0 },
+        { "ZSKIP", 0, 0, 1 },
+    };
+
+    printf("%zu bytes\n", bench.size);
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (run(&runs[i]))
+            return 1;
+    }
+
+    unlink(IN_PATH);
+    unlink(OUT_PATH);
+
+    return 0;
+}
+
+static int
+run(const run_t *r)
+{
+    pthread_t sender;
+    double start, secs;
+    size_t have = r->resume ? bench.size / 3 + 123 : 0;
+    int out_fd, ret;
+
+    if (open_pty(&bench.pty)) {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    out_fd = open(OUT_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        perror(OUT_PATH);
+        return -1;
+    }
+
+    /* the partial copy an earlier upload left behind */
+    if (have) {
+        uint8_t buf[4096];
+        int in_fd = open(IN_PATH, O_RDONLY);
+
+        for (size_t left = have; left > 0;) {
+            ssize_t n = read(in_fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+
+            if (n <= 0 || write(out_fd, buf, n) != n) {
+                perror(OUT_PATH);
+                return -1;
+            }
+            left -= n;
+        }
+        close(in_fd);
+    }
+
+    bench.run = r;
+    bench.resends = 0;
+    bench.first_sent = 0;
+    bench.conv = -1;
+    bench.zrpos = 0;
+    bench.zacks = 0;
+    bench.skipped = 0;
+    bench.rx_len = 0;
+    bench.rx_pos = 0;
+    bench.sending = 1;
+    pthread_create(&sender, NULL, send_thread, NULL);
+
+    start = now();
+    ret = receive(r, out_fd, have);
+    /* a stuck sender gets cancelled rather than left to time out */
+    if (ret) {
+        static const uint8_t cans[8] = {
+            ZDLE, ZDLE, ZDLE, ZDLE, ZDLE, ZDLE, ZDLE, ZDLE
+        };
+
+        write(bench.pty.master, cans, sizeof(cans));
+    }
+    /* drain the OO after ZFIN so the sender never blocks on a full PTY */
+    while (bench.sending) {
+        uint8_t buf[4096];
+
+        if (poll(&(struct pollfd){ .fd = bench.pty.master, .events = POLLIN }, 1, 10) > 0)
+            read(bench.pty.master, buf, sizeof(buf));
+    }
+    pthread_join(sender, NULL);
+    secs = now() - start;
+
+    close(out_fd);
+    close(bench.pty.master);
+    close(bench.pty.slave);
+
+    if (
+        ret || bench.begin_ret || bench.send_ret || bench.end_ret ||
+        (r->skip && bench.skip_ret != ZMODEM_ERR_SKIPPED)
+    ) {
+        fprintf(
+            stderr, "%s: receive %d, begin %d, skip %d, send %d, end %d\n",
+            r->name, ret, bench.begin_ret, bench.skip_ret, bench.send_ret,
+            bench.end_ret
+        );
+        return -1;
+    }
+    if (check_output(bench.size)) {
+        fprintf(stderr, "%s: received file differs\n", r->name);
+        return -1;
+    }
+
+    /* every run has to have taken the path it was there for */
+    if (r->fail_at && (bench.zrpos != 1 || bench.resends != 1)) {
+        fprintf(
+            stderr, "%s: %d ZRPOS sent, %d resends seen\n",
+            r->name, bench.zrpos, bench.resends
+        );
+        return -1;
+    }
+    if (!r->fail_at && (bench.zrpos || bench.resends)) {
+        fprintf(stderr, "%s: resent without a ZRPOS\n", r->name);
+        return -1;
+    }
+    if (r->resume && (bench.conv != ZCRESUM || bench.first_sent <= have)) {
+        fprintf(
+            stderr, "%s: offered with %d, first sent up to %zu of %zu\n",
+            r->name, bench.conv, bench.first_sent, have
+        );
+        return -1;
+    }
+    if (r->skip && bench.skipped != 1) {
+        fprintf(stderr, "%s: %d files skipped\n", r->name, bench.skipped);
+        return -1;
+    }
+    if (!bench.zacks) {
+        fprintf(stderr, "%s: the window never asked for a ZACK\n", r->name);
+        return -1;
+    }
+
+    printf(
+        "  %-10s %8.1f KB/s %6.2fs (%d ZACKs, %d resends)\n",
+        r->name, (bench.size - have) / secs / 1024, secs, bench.zacks,
+        bench.resends
+    );
+
+    return 0;
+}
+
+static int
+open_pty(pty_t *pty)
+{
+    struct termios tio;
+
+    pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty->master < 0 || grantpt(pty->master) || unlockpt(pty->master))
+        return -1;
+
+    pty->slave = open(ptsname(pty->master), O_RDWR | O_NOCTTY);
+    if (pty->slave < 0)
+        return -1;
+
+    /* like serial_open does to a real port */
+    tcgetattr(pty->slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty->slave, TCSANOW, &tio);
+
+    return 0;
+}
+
+static void *
+send_thread(void *arg)
+{
+    int in_fd = open(IN_PATH, O_RDONLY);
+
+    bench.skip_ret = 0;
+    bench.send_ret = 0;
+    bench.end_ret = 0;
+
+    bench.begin_ret = zmodem_begin(bench.pty.slave);
+    if (!bench.begin_ret && bench.run->skip)
+        bench.skip_ret = zmodem_send(in_fd, SKIP_NAME, bench.size, 0, 0, send_cb);
+    if (!bench.begin_ret) {
+        bench.send_ret = zmodem_send(
+            in_fd, "bench.bin", bench.size, time(NULL), bench.run->resume, send_cb
+        );
+    }
+    if (!bench.begin_ret && !bench.send_ret)
+        bench.end_ret = zmodem_end();
+
+    close(in_fd);
+    bench.sending = 0;
+
+    return NULL;
+}
+
+static void
+send_cb(size_t sent, size_t total, int resends)
+{
+    if (!bench.first_sent)
+        bench.first_sent = sent;
+    bench.resends = resends;
+}
+
+/* rz, as far as the runs need it. Returns 0 once the sender said ZFIN. */
+static int
+receive(const run_t *r, int out_fd, size_t have)
+{
+    static const uint8_t rinit[4] = { 0, 0, 0, CANFDX | CANOVIO | CANFC32 };
+    static const uint8_t zeros[4] = { 0 };
+    uint8_t buf[8192];
+    uint8_t hdr[4];
+    size_t pos = 0;
+    int failed = 0;
+
+    while (1) {
+        int type = get_header(hdr);
+        int end;
+        int n;
+
+        switch (type) {
+        case ZRQINIT:
+            send_hex_header(ZRINIT, rinit);
+            break;
+        case ZFILE:
+            n = get_subpacket(buf, sizeof(buf) - 1, &end);
+            if (n < 0) {
+                send_hex_header(ZNAK, zeros);
+                break;
+            }
+            buf[n] = '\0';
+
+            if (r->skip && !strcmp((char *)buf, SKIP_NAME)) {
+                bench.skipped++;
+                send_hex_header(ZSKIP, zeros);
+                break;
+            }
+
+            bench.conv = hdr[3];
+            pos = hdr[3] == ZCRESUM ? have : 0;
+            ftruncate(out_fd, pos);
+            pos_hdr(hdr, pos);
+            send_hex_header(ZRPOS, hdr);
+            break;
+        case ZDATA:
+            /* left over from before a ZRPOS, wait for the frame asked for */
+            if (hdr_pos(hdr) != pos) {
+                pos_hdr(hdr, pos);
+                send_hex_header(ZRPOS, hdr);
+                break;
+            }
+
+            do {
+                n = get_subpacket(buf, sizeof(buf), &end);
+                if (n >= 0 && r->fail_at && !failed && pos + n > r->fail_at) {
+                    failed = 1;
+                    n = -1;
+                }
+
+                if (n < 0) {
+                    bench.zrpos++;
+                    pos_hdr(hdr, pos);
+                    send_hex_header(ZRPOS, hdr);
+                    break;
+                }
+
+                if (pwrite(out_fd, buf, n, pos) != n) {
+                    perror(OUT_PATH);
+                    return -1;
+                }
+                pos += n;
+
+                if (end == ZCRCQ || end == ZCRCW) {
+                    bench.zacks++;
+                    pos_hdr(hdr, pos);
+                    send_hex_header(ZACK, hdr);
+                }
+            } while (end == ZCRCG || end == ZCRCQ);
+            break;
+        case ZEOF:
+            /* one from before a ZRPOS does not end the file */
+            if (hdr_pos(hdr) == pos)
+                send_hex_header(ZRINIT, rinit);
+            break;
+        case ZFIN:
+            send_hex_header(ZFIN, zeros);
+            return 0;
+        case -1:
+            fprintf(stderr, "%s: the sender went quiet\n", r->name);
+            return -1;
+        default:
+            break;
+        }
+    }
+}
+
+static int
+get_byte()
+{
+    if (bench.rx_pos == bench.rx_len) {
+        struct pollfd pfd = { .fd = bench.pty.master, .events = POLLIN };
+        ssize_t n;
+
+        if (poll(&pfd, 1, RX_TO) <= 0)
+            return -1;
+
+        n = read(bench.pty.master, bench.rx, sizeof(bench.rx));
+        if (n <= 0)
+            return -1;
+
+        bench.rx_len = n;
+        bench.rx_pos = 0;
+    }
+
+    return bench.rx[bench.rx_pos++];
+}
+
+/* a byte with the escaping undone, -1 on a timeout or a bad escape and the
+ * end byte with 0x100 set when it ends a subpacket */
+static int
+get_zdle()
+{
+    int c;
+
+    do {
+        c = get_byte();
+    } while (c == 0x11 || c == 0x13 || c == 0x91 || c == 0x93);
+
+    if (c != ZDLE)
+        return c;
+
+    c = get_byte();
+    if (c >= ZCRCE && c <= ZCRCW)
+        return c | 0x100;
+    else if (c == ZRUB0)
+        return 0x7F;
+    else if (c == ZRUB1)
+        return 0xFF;
+    else if (c >= 0 && (c & 0x60) == 0x40)
+        return c ^ 0x40;
+
+    return -1;
+}
+
+static int
+get_hex()
+{
+    int ret = 0;
+
+    for (int i = 0; i < 2; i++) {
+        int c = get_byte();
+
+        if (c >= '0' && c <= '9')
+            ret = ret << 4 | (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            ret = ret << 4 | (c - 'a' + 10);
+        else
+            return -1;
+    }
+
+    return ret;
+}
+
+/* the type of the next good header, skipping whatever comes before it (the
+ * rest of a frame after a ZRPOS), -1 if the sender goes quiet */
+static int
+get_header(uint8_t hdr[4])
+{
+    while (1) {
+        uint8_t raw[9];
+        int len, n;
+        int c = get_byte();
+
+        if (c < 0)
+            return -1;
+        if (c != ZPAD)
+            continue;
+
+        do {
+            c = get_byte();
+        } while (c == ZPAD);
+        if (c != ZDLE)
+            continue;
+
+        c = get_byte();
+        if (c == ZHEX) {
+            for (len = 0; len < 7; len++) {
+                int b = get_hex();
+
+                if (b < 0)
+                    break;
+                raw[len] = b;
+            }
+
+            if (len == 7 && crc16(raw, 5) == (raw[5] << 8 | raw[6])) {
+                memcpy(hdr, &raw[1], 4);
+                return raw[0];
+            }
+        } else if (c == ZBIN || c == ZBIN32) {
+            n = c == ZBIN32 ? 9 : 7;
+            for (len = 0; len < n; len++) {
+                int b = get_zdle();
+
+                if (b < 0 || b > 0xFF)
+                    break;
+                raw[len] = b;
+            }
+
+            if (len == 9) {
+                uint32_t crc = crc32(raw, 5);
+
+                if (
+                    raw[5] == (crc & 0xFF) && raw[6] == ((crc >> 8) & 0xFF) &&
+                    raw[7] == ((crc >> 16) & 0xFF) && raw[8] == crc >> 24
+                ) {
+                    memcpy(hdr, &raw[1], 4);
+                    return raw[0];
+                }
+            } else if (len == 7 && crc16(raw, 5) == (raw[5] << 8 | raw[6])) {
+                memcpy(hdr, &raw[1], 4);
+                return raw[0];
+            }
+        }
+    }
+}
+
+/* the data of a subpacket with CRC-32 (we said CANFC32), its length or -1 if
+ * it did not come in whole */
+static int
+get_subpacket(uint8_t *buf, size_t max, int *end)
+{
+    size_t len = 0;
+    uint8_t end_byte;
+    uint32_t crc;
+
+    while (1) {
+        int c = get_zdle();
+
+        if (c < 0)
+            return -1;
+        if (c > 0xFF) {
+            *end = c & 0xFF;
+            break;
+        }
+        if (len == max)
+            return -1;
+        buf[len++] = c;
+    }
+
+    end_byte = *end;
+    crc = crc32_update(crc32(buf, len), &end_byte, 1);
+    for (int i = 0; i < 4; i++) {
+        int c = get_zdle();
+
+        if (c != ((crc >> (8 * i)) & 0xFF))
+            return -1;
+    }
+
+    return len;
+}
+
+static int
+send_hex_header(int type, const uint8_t hdr[4])
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t raw[7] = { type, hdr[0], hdr[1], hdr[2], hdr[3] };
+    uint16_t crc = crc16(raw, 5);
+    char out[32];
+    size_t len = 0;
+
+    raw[5] = crc >> 8;
+    raw[6] = crc & 0xFF;
+
+    out[len++] = ZPAD;
+    out[len++] = ZPAD;
+    out[len++] = ZDLE;
+    out[len++] = ZHEX;
+    for (int i = 0; i < sizeof(raw); i++) {
+        out[len++] = hex[raw[i] >> 4];
+        out[len++] = hex[raw[i] & 0xF];
+    }
+    out[len++] = '\r';
+    out[len++] = '\n' | 0x80;
+
+    return write(bench.pty.master, out, len) == len ? 0 : -1;
+}
+
+/* positions go least significant byte first */
+static void
+pos_hdr(uint8_t hdr[4], size_t pos)
+{
+    for (int i = 0; i < 4; i++) {
+        hdr[i] = pos >> (8 * i);
+    }
+}
+
+static size_t
+hdr_pos(const uint8_t hdr[4])
+{
+    return hdr[0] | hdr[1] << 8 | hdr[2] << 16 | (size_t)hdr[3] << 24;
+}
+
+/* exactly the sent data */
+static int
+check_output(size_t size)
+{
+    FILE *in = fopen(IN_PATH, "r");
+    FILE *out = fopen(OUT_PATH, "r");
+    size_t pos = 0;
+    int a, b;
+    int ret = 0;
+
+    if (!in || !out)
+        return -1;
+
+    while ((b = fgetc(out)) != EOF) {
+        a = fgetc(in);
+        if (a != b) {
+            ret = -1;
+            break;
+        }
+        pos++;
+    }
+
+    if (pos != size)
+        ret = -1;
+
+    fclose(in);
+    fclose(out);
+
+    return ret;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
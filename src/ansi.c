@@ -0,0 +1,229 @@
+#include "ansi.h"
+
+#define MAX_SGR_PARAMS (32)
+
+#define SET_FG(a, c) ((a) = ((a) & ~0x1FFu) | (uint32_t)((c) + 1))
+#define SET_BG(a, c) ((a) = ((a) & ~(0x1FFu << 9)) | ((uint32_t)((c) + 1) << 9))
+
+static void apply_sgr(ansi_t *an);
+static int extended_color(const int *p, int n, int *used);
+static int rgb_to_256(int r, int g, int b);
+static int cube_step(int v);
+
+size_t
+ansi_parse(ansi_t *an, const char *buf, size_t len)
+{
+    size_t i = 0;
+
+    if (an->state == ANSI_GROUND) {
+        an->state = ANSI_ESC;
+        i = 1;
+    }
+
+    while (i < len && an->state != ANSI_GROUND) {
+        uint8_t c = buf[i];
+
+        /* a line break cuts a broken sequence short and is kept as text */
+        if (c == '\n' || c == '\r') {
+            an->state = ANSI_GROUND;
+            break;
+        }
+
+        switch (an->state) {
+        case ANSI_ESC:
+            if (c == '[') {
+                an->state = ANSI_CSI;
+                an->n_params = 0;
+            }
+            else if (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') {
+                an->state = ANSI_STR;
+            }
+            /* intermediates (e.g. ESC ( B) are followed by one more byte */
+            else if (c < 0x20 || c > 0x2F) {
+                an->state = ANSI_GROUND;
+            }
+            break;
+
+        case ANSI_CSI:
+            if (c == '\e') {
+                /* start over with the new sequence */
+                an->state = ANSI_ESC;
+            }
+            else if (c >= 0x40 && c <= 0x7E) {
+                if (c == 'm')
+                    apply_sgr(an);
+                an->state = ANSI_GROUND;
+            }
+            else if (c >= 0x20 && an->n_params < (int)sizeof(an->params)) {
+                an->params[an->n_params] = c;
+                an->n_params++;
+            }
+            break;
+
+        case ANSI_STR:
+            if (c == '\a')
+                an->state = ANSI_GROUND;
+            else if (c == '\e')
+                an->state = ANSI_STR_ESC;
+            break;
+
+        case ANSI_STR_ESC:
+            /* ESC \ ends the string, anything else starts a new sequence */
+            if (c != '\\') {
+                an->state = ANSI_ESC;
+                continue;
+            }
+            an->state = ANSI_GROUND;
+            break;
+        }
+
+        i++;
+    }
+
+    return i;
+}
+
+static void
+apply_sgr(ansi_t *an)
+{
+    int p[MAX_SGR_PARAMS] = { 0 };
+    int n = 0;
+    uint32_t attr = an->attr;
+
+    /* private sequences (e.g. ESC [ > 4 m) are not SGR */
+    if (an->n_params > 0 && an->params[0] >= '<' && an->params[0] <= '?')
+        return;
+
+    /* empty parameters mean 0 */
+    for (int i = 0; i < an->n_params; i++) {
+        char c = an->params[i];
+
+        if (c >= '0' && c <= '9') {
+            if (p[n] < 100000)
+                p[n] = p[n] * 10 + (c - '0');
+        }
+        else if ((c == ';' || c == ':') && n + 1 < MAX_SGR_PARAMS) {
+            n++;
+        }
+    }
+    n++;
+
+    for (int i = 0; i < n; i++) {
+        int code = p[i];
+        int col, used;
+
+        if (code == 0) {
+            attr = 0;
+        }
+        else if (code == 1) {
+            attr |= ANSI_BOLD;
+        }
+        else if (code == 4) {
+            attr |= ANSI_UNDERLINE;
+        }
+        else if (code == 7) {
+            attr |= ANSI_REVERSE;
+        }
+        else if (code == 22) {
+            attr &= ~ANSI_BOLD;
+        }
+        else if (code == 24) {
+            attr &= ~ANSI_UNDERLINE;
+        }
+        else if (code == 27) {
+            attr &= ~ANSI_REVERSE;
+        }
+        else if (code >= 30 && code <= 37) {
+            SET_FG(attr, code - 30);
+        }
+        else if (code == 39) {
+            SET_FG(attr, -1);
+        }
+        else if (code >= 40 && code <= 47) {
+            SET_BG(attr, code - 40);
+        }
+        else if (code == 49) {
+            SET_BG(attr, -1);
+        }
+        else if (code >= 90 && code <= 97) {
+            SET_FG(attr, code - 90 + 8);
+        }
+        else if (code >= 100 && code <= 107) {
+            SET_BG(attr, code - 100 + 8);
+        }
+        else if (code == 38 || code == 48) {
+            col = extended_color(&p[i + 1], n - i - 1, &used);
+            i += used;
+
+            if (col >= 0 && code == 38)
+                SET_FG(attr, col);
+            else if (col >= 0)
+                SET_BG(attr, col);
+        }
+    }
+
+    an->attr = attr;
+}
+
+/* parse the parameters after 38 or 48, either 5;n or 2;r;g;b */
+static int
+extended_color(const int *p, int n, int *used)
+{
+    if (n >= 2 && p[0] == 5) {
+        *used = 2;
+        return p[1] & 0xFF;
+    }
+
+    if (n >= 4 && p[0] == 2) {
+        *used = 4;
+        return rgb_to_256(p[1], p[2], p[3]);
+    }
+
+    /* nothing sensible follows, drop the rest */
+    *used = n;
+    return -1;
+}
+
+/* closest color of the 6x6x6 cube or the gray ramp */
+static int
+rgb_to_256(int r, int g, int b)
+{
+    static const int steps[6] = { 0, 95, 135, 175, 215, 255 };
+    int cr, cg, cb, gray, gi, gv;
+    long d_cube, d_gray;
+
+    r = r > 255 ? 255 : r;
+    g = g > 255 ? 255 : g;
+    b = b > 255 ? 255 : b;
+
+    cr = cube_step(r);
+    cg = cube_step(g);
+    cb = cube_step(b);
+
+    gray = (r + g + b) / 3;
+    gi = gray > 238 ? 23 : (gray < 3 ? 0 : (gray - 3) / 10);
+    gv = 8 + gi * 10;
+
+    d_cube = (long)(r - steps[cr]) * (r - steps[cr]) +
+        (long)(g - steps[cg]) * (g - steps[cg]) +
+        (long)(b - steps[cb]) * (b - steps[cb]);
+    d_gray = (long)(r - gv) * (r - gv) +
+        (long)(g - gv) * (g - gv) +
+        (long)(b - gv) * (b - gv);
+
+    if (d_gray < d_cube)
+        return 232 + gi;
+
+    return 16 + cr * 36 + cg * 6 + cb;
+}
+
+static int
+cube_step(int v)
+{
+    if (v < 48)
+        return 0;
+    if (v < 115)
+        return 1;
+
+    return (v - 35) / 40;
+}
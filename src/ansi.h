@@ -0,0 +1,40 @@
+#ifndef _ANSI_H_
+#define _ANSI_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Parser for the escape sequences in the received bytes. SGR sequences update
+ * the current attribute, every other sequence is consumed and dropped. The
+ * state carries over between calls, so sequences can be split across reads. */
+
+/* An attribute packs the foreground and background colors (0-255, stored
+ * plus one so 0 is the terminal default) and the text attributes. An attribute
+ * of 0 is plain text. Truecolor gets mapped to the closest of the 256 colors. */
+#define ANSI_FG(a)      ((int)((a) & 0x1FF) - 1)
+#define ANSI_BG(a)      ((int)(((a) >> 9) & 0x1FF) - 1)
+#define ANSI_BOLD       (1 << 18)
+#define ANSI_UNDERLINE  (1 << 19)
+#define ANSI_REVERSE    (1 << 20)
+
+enum ansi_state_enum {
+    ANSI_GROUND = 0,
+    ANSI_ESC,
+    ANSI_CSI,
+    ANSI_STR, /* OSC/DCS/APC etc. ended by BEL or ST */
+    ANSI_STR_ESC,
+};
+
+typedef struct ansi_struct {
+    int state;
+    char params[64]; /* parameter bytes of the CSI so far */
+    int n_params;
+    uint32_t attr; /* current SGR attribute */
+} ansi_t;
+
+/* Consume bytes of an escape sequence. buf must start with ESC, or state must
+ * be past ANSI_GROUND. Returns the number of bytes consumed, which is all of
+ * len if the sequence did not end in buf. */
+size_t ansi_parse(ansi_t *an, const char *buf, size_t len);
+
+#endif /* _ANSI_H_ */
@@ -0,0 +1,460 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#  include <arpa/inet.h>
+#  include <fcntl.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#endif
+
+#include "bridge.h"
+#include "cheerios.h"
+#include "wakeup.h"
+
+/* received data kept for clients to catch up on, a power of two */
+#define RING_SZ (1024 * 1024)
+
+/* how often to retry queueing client data when the port is not taking it */
+#define RETRY_MS (5)
+
+typedef struct bridge_client_struct {
+    int fd;
+    uint64_t cursor; /* total received bytes this client has been sent */
+    uint8_t pend[1024]; /* sent by the client, not queued to the port yet */
+    size_t pend_len;
+} bridge_client_t;
+
+static struct {
+    int listen_fd;
+    char *unix_path; /* removed again on close */
+    pthread_t thr;
+    volatile int running;
+    wakeup_t wake; /* kicks the thread when data comes in or on close */
+    /* written by the reader thread. claim moves before the bytes get
+     * written and head after, so a client copying bytes that claim has
+     * passed by a ring knows they may have been overwritten. */
+    uint8_t *ring;
+    _Atomic uint64_t claim;
+    _Atomic uint64_t head;
+    _Atomic int n_clients;
+    _Atomic uint64_t dropped;
+    /* bridge thread */
+    bridge_client_t clients[BRIDGE_MAX_CLIENTS];
+} bridge = {
+    .listen_fd = -1,
+    .wake = { .fds = { -1, -1 } },
+};
+
+#ifndef __MINGW32__
+static int listen_on(const char *addr);
+static void *bridge_thread(void *arg);
+static void accept_client(void);
+static void drop_client(bridge_client_t *client);
+static int client_rx(bridge_client_t *client);
+static void client_tx(bridge_client_t *client);
+static void skip_ahead(bridge_client_t *client, uint64_t head);
+#endif
+
+#ifdef __MINGW32__
+int
+bridge_open(const char *addr)
+{
+    return -1;
+}
+
+int
+bridge_start()
+{
+    return -1;
+}
+
+void
+bridge_rx(const void *buf, size_t len)
+{
+}
+
+int
+bridge_report(int *clients, uint64_t *dropped)
+{
+    return -1;
+}
+
+void
+bridge_close()
+{
+}
+#else
+int
+bridge_open(const char *addr)
+{
+    for (int i = 0; i < BRIDGE_MAX_CLIENTS; i++) {
+        bridge.clients[i].fd = -1;
+    }
+
+    bridge.ring = malloc(RING_SZ);
+    if (!bridge.ring)
+        return -1;
+
+    bridge.listen_fd = listen_on(addr);
+    if (bridge.listen_fd < 0 || wakeup_init(&bridge.wake)) {
+        bridge_close();
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+bridge_start()
+{
+    if (bridge.listen_fd < 0)
+        return -1;
+
+    bridge.running = 1;
+    if (pthread_create(&bridge.thr, NULL, bridge_thread, NULL)) {
+        bridge.running = 0;
+        bridge_close();
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+bridge_rx(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t head;
+
+    /* nobody to keep it for */
+    if (!atomic_load_explicit(&bridge.n_clients, memory_order_relaxed))
+        return;
+
+    /* only the newest ring's worth matters */
+    if (len > RING_SZ) {
+        p += len - RING_SZ;
+        len = RING_SZ;
+    }
+
+    head = atomic_load_explicit(&bridge.head, memory_order_relaxed);
+    atomic_store_explicit(&bridge.claim, head + len, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (size_t done = 0; done < len;) {
+        size_t off = (head + done) & (RING_SZ - 1);
+        size_t n = len - done;
+
+        if (n > RING_SZ - off)
+            n = RING_SZ - off;
+
+        memcpy(&bridge.ring[off], &p[done], n);
+        done += n;
+    }
+
+    atomic_store_explicit(&bridge.head, head + len, memory_order_release);
+    wakeup_signal(&bridge.wake);
+}
+
+int
+bridge_report(int *clients, uint64_t *dropped)
+{
+    if (bridge.listen_fd < 0)
+        return -1;
+
+    *clients = atomic_load(&bridge.n_clients);
+    *dropped = atomic_load(&bridge.dropped);
+
+    return 0;
+}
+
+void
+bridge_close()
+{
+    if (!bridge.ring)
+        return;
+
+    if (bridge.running) {
+        bridge.running = 0;
+        wakeup_signal(&bridge.wake);
+        pthread_join(bridge.thr, NULL);
+    }
+    wakeup_destroy(&bridge.wake);
+
+    for (int i = 0; i < BRIDGE_MAX_CLIENTS; i++) {
+        if (bridge.clients[i].fd >= 0)
+            drop_client(&bridge.clients[i]);
+    }
+
+    if (bridge.listen_fd >= 0) {
+        close(bridge.listen_fd);
+        bridge.listen_fd = -1;
+    }
+
+    if (bridge.unix_path) {
+        unlink(bridge.unix_path);
+        free(bridge.unix_path);
+        bridge.unix_path = NULL;
+    }
+
+    free(bridge.ring);
+    bridge.ring = NULL;
+}
+
+/* a listening socket for addr, -1 on error */
+static int
+listen_on(const char *addr)
+{
+    int fd;
+
+    if (strchr(addr, '/')) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+        if (strlen(addr) >= sizeof(sun.sun_path))
+            return -1;
+        strcpy(sun.sun_path, addr);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        /* a socket left over from a crash is in the way */
+        unlink(addr);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun))) {
+            close(fd);
+            return -1;
+        }
+
+        bridge.unix_path = strdup(addr);
+    }
+    else {
+        struct sockaddr_in sin = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        const char *colon = strrchr(addr, ':');
+        char host[64];
+        long port;
+        int on = 1;
+
+        if (colon) {
+            if ((size_t)(colon - addr) >= sizeof(host))
+                return -1;
+            memcpy(host, addr, colon - addr);
+            host[colon - addr] = 0;
+            if (inet_pton(AF_INET, host, &sin.sin_addr) != 1)
+                return -1;
+            addr = colon + 1;
+        }
+
+        port = strtol(addr, NULL, 10);
+        if (port <= 0 || port > 65535)
+            return -1;
+        sin.sin_port = htons(port);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, BRIDGE_MAX_CLIENTS)) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+/* sends clients what came in, and queues what they send. A client only gets
+ * read while what it sent last is queued. */
+static void *
+bridge_thread(void *arg)
+{
+    while (bridge.running) {
+        struct pollfd fds[BRIDGE_MAX_CLIENTS + 2];
+        int ids[BRIDGE_MAX_CLIENTS + 2];
+        uint64_t head = atomic_load_explicit(&bridge.head, memory_order_acquire);
+        int nfds = 2;
+        int to_ms = -1;
+
+        fds[0].fd = wakeup_fd(&bridge.wake);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = bridge.listen_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        for (int i = 0; i < BRIDGE_MAX_CLIENTS; i++) {
+            bridge_client_t *client = &bridge.clients[i];
+
+            if (client->fd < 0)
+                continue;
+
+            /* counted as dropped now rather than once it can take more */
+            skip_ahead(client, head);
+
+            fds[nfds].fd = client->fd;
+            fds[nfds].events = (client->pend_len ? 0 : POLLIN) |
+                (client->cursor < head ? POLLOUT : 0);
+            fds[nfds].revents = 0;
+            ids[nfds] = i;
+            nfds++;
+
+            if (client->pend_len)
+                to_ms = RETRY_MS;
+        }
+
+        if (poll(fds, nfds, to_ms) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+            wakeup_drain(&bridge.wake);
+
+        for (int j = 2; j < nfds; j++) {
+            bridge_client_t *client = &bridge.clients[ids[j]];
+            short ev = fds[j].revents;
+
+            if ((ev & (POLLIN | POLLHUP | POLLERR)) && client_rx(client)) {
+                drop_client(client);
+                continue;
+            }
+
+            /* the port may have room for what was left over by now */
+            if (client->pend_len) {
+                size_t n = cheerios_input_some(0, (char *)client->pend, client->pend_len);
+
+                client->pend_len -= n;
+                memmove(client->pend, &client->pend[n], client->pend_len);
+            }
+
+            if (ev & POLLOUT)
+                client_tx(client);
+        }
+
+        if (fds[1].revents & POLLIN)
+            accept_client();
+    }
+
+    return NULL;
+}
+
+static void
+accept_client()
+{
+    int fd = accept(bridge.listen_fd, NULL, NULL);
+    int on = 1;
+
+    if (fd < 0)
+        return;
+
+    for (int i = 0; i < BRIDGE_MAX_CLIENTS; i++) {
+        bridge_client_t *client = &bridge.clients[i];
+
+        if (client->fd >= 0)
+            continue;
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        /* fails harmlessly on a Unix socket */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        client->fd = fd;
+        client->pend_len = 0;
+        /* clients only get what comes in after they connect */
+        atomic_fetch_add(&bridge.n_clients, 1);
+        client->cursor = atomic_load_explicit(&bridge.head, memory_order_acquire);
+        return;
+    }
+
+    /* full */
+    close(fd);
+}
+
+static void
+drop_client(bridge_client_t *client)
+{
+    close(client->fd);
+    client->fd = -1;
+    atomic_fetch_sub(&bridge.n_clients, 1);
+}
+
+/* read what the client sent and queue as much of it as the port takes,
+ * -1 once the client is gone */
+static int
+client_rx(bridge_client_t *client)
+{
+    ssize_t n;
+
+    if (client->pend_len)
+        return 0;
+
+    n = recv(client->fd, client->pend, sizeof(client->pend), MSG_DONTWAIT);
+    if (n == 0)
+        return -1;
+    if (n < 0)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+    client->pend_len = n;
+
+    return 0;
+}
+
+/* send the client what it has not got yet, skipping what it fell too far
+ * behind on */
+static void
+client_tx(bridge_client_t *client)
+{
+    uint8_t buf[16 * 1024];
+    uint64_t head = atomic_load_explicit(&bridge.head, memory_order_acquire);
+    size_t off, len;
+    ssize_t ret;
+
+    skip_ahead(client, head);
+
+    off = client->cursor & (RING_SZ - 1);
+    len = head - client->cursor;
+    if (len > RING_SZ - off)
+        len = RING_SZ - off;
+    if (len > sizeof(buf))
+        len = sizeof(buf);
+    if (len == 0)
+        return;
+
+    memcpy(buf, &bridge.ring[off], len);
+
+    /* the reader lapped us while copying, the next call skips ahead */
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&bridge.claim, memory_order_relaxed) - client->cursor > RING_SZ)
+        return;
+
+    ret = send(client->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret > 0)
+        client->cursor += ret;
+}
+
+/* a client more than the ring behind lost the oldest of it */
+static void
+skip_ahead(bridge_client_t *client, uint64_t head)
+{
+    if (head - client->cursor > RING_SZ) {
+        atomic_fetch_add(&bridge.dropped, head - RING_SZ - client->cursor);
+        client->cursor = head - RING_SZ;
+    }
+}
+#endif /* __MINGW32__ */
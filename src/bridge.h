@@ -0,0 +1,35 @@
+#ifndef _BRIDGE_H_
+#define _BRIDGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shares the first serial port with other programs over a local socket.
+ *
+ * Everything read from the port goes out to every connected client, and
+ * whatever the clients send is queued to the port like typed input. Received
+ * data goes through a ring that each client follows with its own cursor, so
+ * the reader never waits on a client. A client that falls more than the ring
+ * behind skips ahead and loses what it missed. */
+
+#define BRIDGE_MAX_CLIENTS (16)
+
+/* Listen on addr, a TCP "[host:]port" (127.0.0.1 if no host is given) or the
+ * path of a Unix socket. Clients wait to be accepted until bridge_start. */
+int bridge_open(const char *addr);
+
+/* Start serving clients, once cheerios is ready to queue what they send */
+int bridge_start(void);
+
+/* Hand len bytes read from the port to the clients, only ever called from the
+ * reader thread and never blocks */
+void bridge_rx(const void *buf, size_t len);
+
+/* Connected clients and bytes dropped for clients that fell behind, returns
+ * -1 when there is no bridge */
+int bridge_report(int *clients, uint64_t *dropped);
+
+/* Disconnect everyone and stop listening */
+void bridge_close(void);
+
+#endif /* _BRIDGE_H_ */
@@ -12,12 +12,15 @@
 #include <unistd.h>
 
 #include "bytenuts.h"
+#include "bridge.h"
+#include "capture.h"
 #include "cheerios.h"
 #include "ingest.h"
 
 #define USAGE ( \
 "USAGE\n\n" \
-"bytenuts [OPTIONS] <serial path>\n" \
+"bytenuts [OPTIONS] <serial path> [<serial path> ...]\n" \
+"\nSeveral serial paths (up to 8) open in tiled panes sharing the input line.\n" \
 "\nConfigs get loaded from ${HOME}/.bytenuts/config (if file exists)\n" \
 "\n OPTIONS\n=========\n\n" \
 "-h\n    Show this help.\n\n" \
@@ -25,15 +28,28 @@
 "-l <path>\n   Log all output to the given file.\n\n" \
 "-c <path>\n   Load a config from the given path rather than the default.\n\n" \
 "-r|--resume\n    Resume the previous instance of bytenuts.\n\n" \
-"--colors=<0|1>\n    Turn 8-bit ANSI colors off/on.\n\n" \
+"--headless\n    Draw to the null device rather than the terminal, for benchmarks.\n\n" \
+"--capture <path>\n    Record everything sent and received with timestamps to a binary capture.\n\n" \
+"--replay <path>\n    Play a capture back rather than opening a serial port, no serial path needed.\n\n" \
+"--speed=<n>\n    Replay n times faster than captured, 0 for as fast as possible (default 1).\n\n" \
+"--bridge=<[host:]port|path>\n    Share the first serial port over a local TCP port or Unix socket.\n\n" \
+"--colors=<0|1>\n    Turn ANSI colors off/on.\n\n" \
 "--echo=<0|1>\n    Turn input echoing off/on.\n\n" \
 "--no_crlf=<0|1>\n    Choose to send LF and not CRLF on input.\n\n" \
 "--escape=<char>\n    Change the default ctrl+b escape character.\n\n" \
 "--inter_cmd_to=<ms>\n    Set the intercommand timeout in milliseconds (default is 10ms).\n\n" \
-"--time_fmt=<fmt>\n    Time format as used by strftime to prepend to every log line.\n" \
+"--time_fmt=<fmt>\n    Time format as used by strftime to prepend to every log line.\n\n" \
+"--fps=<hz>\n    Maximum output window redraws per second (default is 60).\n\n" \
+"--scrollback_lines=<n>\n    Output lines to keep in memory before spilling to disk (default no limit).\n\n" \
+"--scrollback_bytes=<n>[K|M|G]\n    Output bytes to keep in memory before spilling to disk (default 64M).\n\n" \
+"--log_rotate_bytes=<n>[K|M|G]\n    Start a new log segment once one has this many bytes (default no limit).\n\n" \
+"--log_rotate_secs=<s>\n    Start a new log segment once one is this many seconds old (default no limit).\n\n" \
+"--log_keep=<n>\n    Number of log segments to keep, older ones get removed (default all).\n" \
 )
 
 static int parse_args(int argc, char **argv);
+static int start_headless();
+static long long parse_size(const char *str);
 static int load_configs();
 static int read_state();
 static int load_state();
@@ -58,27 +74,60 @@ bytenuts_run(int argc, char **argv)
         read_state();
     }
 
-    bytenuts.serial_fd = serial_open(bytenuts.config.serial_path, bytenuts.config.baud);
-    if (bytenuts.serial_fd == SERIAL_INVALID) {
-        printf(
-            "Failed to open serial port \"%s\"\r\n",
-            bytenuts.config.serial_path
-        );
+    if (bytenuts.replay_path) {
+        bytenuts.serial_fds[0] = capture_replay(bytenuts.replay_path, bytenuts.speed);
+        if (bytenuts.serial_fds[0] == SERIAL_INVALID) {
+            printf("Failed to replay capture \"%s\"\r\n", bytenuts.replay_path);
+            return -1;
+        }
+    }
+    else {
+        for (int i = 0; i < bytenuts.n_ports; i++) {
+            bytenuts.serial_fds[i] = serial_open(
+                bytenuts.serial_paths[i], bytenuts.config.baud
+            );
+            if (bytenuts.serial_fds[i] == SERIAL_INVALID) {
+                printf(
+                    "Failed to open serial port \"%s\"\r\n",
+                    bytenuts.serial_paths[i]
+                );
+                return -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < bytenuts.n_ports; i++) {
+        printf("Opened \"%s\"\r\n", bytenuts.serial_paths[i]);
+    }
+
+    if (bytenuts.capture_path && capture_open(bytenuts.capture_path)) {
+        printf("Failed to open capture \"%s\"\r\n", bytenuts.capture_path);
         return -1;
     }
 
-    printf("Opened \"%s\"\r\n", bytenuts.config.serial_path);
+    if (bytenuts.bridge_addr && bridge_open(bytenuts.bridge_addr)) {
+        printf("Failed to open bridge \"%s\"\r\n", bytenuts.bridge_addr);
+        return -1;
+    }
 
 #ifndef __MINGW32__
     /* use pseudo-terminals for testing purposes */
-    if (!strcmp(bytenuts.config.serial_path, "/dev/ptmx")) {
-        grantpt(bytenuts.serial_fd);
-        unlockpt(bytenuts.serial_fd);
+    for (int i = 0; i < bytenuts.n_ports; i++) {
+        if (!strcmp(bytenuts.serial_paths[i], "/dev/ptmx")) {
+            grantpt(bytenuts.serial_fds[i]);
+            unlockpt(bytenuts.serial_fds[i]);
+        }
     }
 #endif
 
     // Initialize ncurses
-    initscr();
+    if (bytenuts.headless) {
+        if (start_headless())
+            return -1;
+    }
+    else {
+        initscr();
+    }
     raw();
     noecho();
 #if 0
@@ -117,12 +166,15 @@ bytenuts_run(int argc, char **argv)
 
     cheerios_start(&bytenuts);
     ingest_start(&bytenuts);
-
+    if (bytenuts.bridge_addr && bridge_start())
+        cheerios_info("Failed to start the bridge");
 #ifndef __MINGW32__
-    if (!strcmp(bytenuts.config.serial_path, "/dev/ptmx")) {
-        char info[128];
-        snprintf(info, sizeof(info), "Opened PTY port %s", ptsname(bytenuts.serial_fd));
-        cheerios_info(info);
+    for (int i = 0; i < bytenuts.n_ports; i++) {
+        if (!strcmp(bytenuts.serial_paths[i], "/dev/ptmx")) {
+            char info[128];
+            snprintf(info, sizeof(info), "Opened PTY port %s", ptsname(bytenuts.serial_fds[i]));
+            cheerios_info(info);
+        }
     }
 #endif
 
@@ -160,13 +212,19 @@ bytenuts_kill()
 {
     ingest_stop();
     cheerios_stop();
+    /* after cheerios, its reader feeds the bridge */
+    bridge_close();
+    capture_close();
 
     delwin(bytenuts.status_win);
     delwin(bytenuts.in_win);
     delwin(bytenuts.out_win);
     endwin();
 
-    serial_close(bytenuts.serial_fd);
+    capture_replay_stop();
+    for (int i = 0; i < bytenuts.n_ports; i++) {
+        serial_close(bytenuts.serial_fds[i]);
+    }
 }
 
 int
@@ -188,12 +246,26 @@ bytenuts_print_stats()
     cheerios_insert(st_line, strlen(st_line));
     sprintf(st_line, "log_path: %s\r\n", bytenuts.config.log_path);
     cheerios_insert(st_line, strlen(st_line));
-    sprintf(st_line, "serial_path: %s\r\n", bytenuts.config.serial_path);
-    cheerios_insert(st_line, strlen(st_line));
+    for (int i = 0; i < bytenuts.n_ports; i++) {
+        snprintf(st_line, sizeof(st_line), "serial_path: %s\r\n", bytenuts.serial_paths[i]);
+        cheerios_insert(st_line, strlen(st_line));
+    }
     sprintf(st_line, "inter_cmd_to: %d\r\n", bytenuts.config.inter_cmd_to);
     cheerios_insert(st_line, strlen(st_line));
     sprintf(st_line, "time_fmt: %s\r\n", bytenuts.config.time_fmt);
     cheerios_insert(st_line, strlen(st_line));
+    sprintf(st_line, "fps: %d\r\n", bytenuts.config.fps);
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(st_line, "scrollback_lines: %d\r\n", bytenuts.config.scrollback_lines);
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(st_line, "scrollback_bytes: %zu\r\n", bytenuts.config.scrollback_bytes);
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(st_line, "log_rotate_bytes: %zu\r\n", bytenuts.config.log_rotate_bytes);
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(st_line, "log_rotate_secs: %d\r\n", bytenuts.config.log_rotate_secs);
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(st_line, "log_keep: %d\r\n", bytenuts.config.log_keep);
+    cheerios_insert(st_line, strlen(st_line));
 
     return 0;
 }
@@ -237,6 +309,11 @@ bytenuts_set_status(int user, const char *fmt, ...)
             free(bytenuts.cmdpg_status);
         bytenuts.cmdpg_status = new_status;
         break;
+    case STATUS_STATS:
+        if (bytenuts.stats_status)
+            free(bytenuts.stats_status);
+        bytenuts.stats_status = new_status;
+        break;
     default:
         free(new_status);
         pthread_mutex_unlock(&bytenuts.lock);
@@ -261,6 +338,8 @@ bytenuts_set_status(int user, const char *fmt, ...)
         bytenuts.bytenuts_status, bytenuts.ingest_status,
         bytenuts.cheerios_status, bytenuts.cmdpg_status
     );
+    if (bytenuts.stats_status && bytenuts.stats_status[0])
+        wprintw(bytenuts.status_win, "--%s--|", bytenuts.stats_status);
 
     wmove(bytenuts.in_win, cy, cx);
     curs_set(1);
@@ -294,7 +373,7 @@ bytenuts_update_screen_size()
     pthread_mutex_unlock(&bytenuts.term_lock);
 
     bytenuts_set_status(STATUS_BYTENUTS, old_status);
-    cheerios_insert("", 0);
+    cheerios_redraw();
     ingest_refresh();
     free(old_status);
 
@@ -304,6 +383,8 @@ bytenuts_update_screen_size()
 static int
 parse_args(int argc, char **argv)
 {
+    int i;
+
     if (argc < 2)
         return -1;
 
@@ -326,7 +407,10 @@ parse_args(int argc, char **argv)
 #endif
     }
 
-    for (int i = 1; i < argc - 1; i++) {
+    bytenuts.speed = 1;
+
+    /* options up to the first argument that is not one, the serial paths */
+    for (i = 1; i < argc; i++) {
         size_t arg_len = strlen(argv[i]);
 
         if (!strcmp(argv[i], "-h")) {
@@ -392,19 +476,155 @@ parse_args(int argc, char **argv)
             bytenuts.config.time_fmt = strdup(&argv[i][11]);
             bytenuts.config_overrides[5] = 1;
         }
+        else if (arg_len > 6 && !memcmp(argv[i], "--fps=", 6)) {
+            long fps = strtol(&argv[i][6], NULL, 10);
+            if (fps > 0) {
+                bytenuts.config.fps = fps;
+                bytenuts.config_overrides[6] = 1;
+            }
+        }
+        else if (arg_len > 19 && !memcmp(argv[i], "--scrollback_lines=", 19)) {
+            long sb_lines = strtol(&argv[i][19], NULL, 10);
+            if (sb_lines >= 0) {
+                bytenuts.config.scrollback_lines = sb_lines;
+                bytenuts.config_overrides[7] = 1;
+            }
+        }
+        else if (arg_len > 19 && !memcmp(argv[i], "--scrollback_bytes=", 19)) {
+            long long sb_bytes = parse_size(&argv[i][19]);
+            if (sb_bytes >= 0) {
+                bytenuts.config.scrollback_bytes = sb_bytes;
+                bytenuts.config_overrides[8] = 1;
+            }
+        }
+        else if (arg_len > 19 && !memcmp(argv[i], "--log_rotate_bytes=", 19)) {
+            long long rot_bytes = parse_size(&argv[i][19]);
+            if (rot_bytes >= 0) {
+                bytenuts.config.log_rotate_bytes = rot_bytes;
+                bytenuts.config_overrides[9] = 1;
+            }
+        }
+        else if (arg_len > 18 && !memcmp(argv[i], "--log_rotate_secs=", 18)) {
+            long rot_secs = strtol(&argv[i][18], NULL, 10);
+            if (rot_secs >= 0) {
+                bytenuts.config.log_rotate_secs = rot_secs;
+                bytenuts.config_overrides[10] = 1;
+            }
+        }
+        else if (arg_len > 11 && !memcmp(argv[i], "--log_keep=", 11)) {
+            long keep = strtol(&argv[i][11], NULL, 10);
+            if (keep >= 0) {
+                bytenuts.config.log_keep = keep;
+                bytenuts.config_overrides[11] = 1;
+            }
+        }
         else if (!strcmp(argv[i], "--resume") || !strcmp(argv[i], "-r")) {
             bytenuts.resume = 1;
         }
+        else if (!strcmp(argv[i], "--headless")) {
+            bytenuts.headless = 1;
+        }
+        else if (!strcmp(argv[i], "--capture")) {
+            i++;
+            if (i == argc || (i == argc - 1 && !bytenuts.replay_path))
+                return -1;
+
+            bytenuts.capture_path = strdup(argv[i]);
+        }
+        else if (!strcmp(argv[i], "--replay")) {
+            i++;
+            if (i == argc)
+                return -1;
+
+            bytenuts.replay_path = strdup(argv[i]);
+        }
+        else if (arg_len > 8 && !memcmp(argv[i], "--speed=", 8)) {
+            double speed = strtod(&argv[i][8], NULL);
+            if (speed >= 0) {
+                bytenuts.speed = speed;
+            }
+        }
+        else if (arg_len > 9 && !memcmp(argv[i], "--bridge=", 9)) {
+            bytenuts.bridge_addr = strdup(&argv[i][9]);
+        }
+        else if (argv[i][0] != '-') {
+            break;
+        }
         else {
             return -1;
         }
     }
 
-    bytenuts.config.serial_path = strdup(argv[argc - 1]);
+    if (bytenuts.replay_path) {
+        /* a replay has no serial path, one given anyway is not used */
+        bytenuts.serial_paths[bytenuts.n_ports++] = strdup(bytenuts.replay_path);
+    }
+    else {
+        if (i == argc || argc - i > BYTENUTS_MAX_PORTS)
+            return -1;
+
+        for (; i < argc; i++) {
+            if (argv[i][0] == '-')
+                return -1;
+            bytenuts.serial_paths[bytenuts.n_ports++] = strdup(argv[i]);
+        }
+    }
+
+    bytenuts.config.serial_path = strdup(bytenuts.serial_paths[0]);
 
     return 0;
 }
 
+/* start curses with its output going nowhere and input from stdin, which does
+ * not need to be a terminal. The size comes from LINES and COLUMNS. */
+static int
+start_headless()
+{
+#ifdef __MINGW32__
+    FILE *null = fopen("NUL", "w");
+#else
+    FILE *null = fopen("/dev/null", "w");
+#endif
+    char *term = getenv("TERM");
+
+    if (!null || !newterm(term ? term : "xterm-256color", null, stdin)) {
+        printf("Failed to start headless\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* parse a byte count with an optional K, M, or G suffix, -1 on error */
+static long long
+parse_size(const char *str)
+{
+    char *end;
+    long long ret = strtoll(str, &end, 10);
+
+    if (end == str || ret < 0)
+        return -1;
+
+    switch (*end) {
+    case 'g':
+    case 'G':
+        ret *= 1024;
+        /* fall-through */
+    case 'm':
+    case 'M':
+        ret *= 1024;
+        /* fall-through */
+    case 'k':
+    case 'K':
+        ret *= 1024;
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
 static int
 load_configs()
 {
@@ -461,6 +681,42 @@ load_configs()
                 time_fmt_len--;
             }
         }
+        else if (!bytenuts.config_overrides[6] && !memcmp(line, "fps=", 4)) {
+            long fps = strtol(&line[4], NULL, 10);
+            if (fps > 0) {
+                bytenuts.config.fps = fps;
+            }
+        }
+        else if (!bytenuts.config_overrides[7] && !memcmp(line, "scrollback_lines=", 17)) {
+            long sb_lines = strtol(&line[17], NULL, 10);
+            if (sb_lines >= 0) {
+                bytenuts.config.scrollback_lines = sb_lines;
+            }
+        }
+        else if (!bytenuts.config_overrides[8] && !memcmp(line, "scrollback_bytes=", 17)) {
+            long long sb_bytes = parse_size(&line[17]);
+            if (sb_bytes >= 0) {
+                bytenuts.config.scrollback_bytes = sb_bytes;
+            }
+        }
+        else if (!bytenuts.config_overrides[9] && !memcmp(line, "log_rotate_bytes=", 17)) {
+            long long rot_bytes = parse_size(&line[17]);
+            if (rot_bytes >= 0) {
+                bytenuts.config.log_rotate_bytes = rot_bytes;
+            }
+        }
+        else if (!bytenuts.config_overrides[10] && !memcmp(line, "log_rotate_secs=", 16)) {
+            long rot_secs = strtol(&line[16], NULL, 10);
+            if (rot_secs >= 0) {
+                bytenuts.config.log_rotate_secs = rot_secs;
+            }
+        }
+        else if (!bytenuts.config_overrides[11] && !memcmp(line, "log_keep=", 9)) {
+            long keep = strtol(&line[9], NULL, 10);
+            if (keep >= 0) {
+                bytenuts.config.log_keep = keep;
+            }
+        }
     }
 
     return 0;
@@ -499,16 +755,7 @@ read_state()
     if (fd)
         fclose(fd);
 
-    stat(".config/bytenuts/outbuf.log", &st);
-    fd = fopen(".config/bytenuts/outbuf.log", "r");
-
-    if (fd && st.st_size > 0) {
-        bytenuts.state.buf = malloc(st.st_size);
-        bytenuts.state.buf_len = st.st_size;
-        fread(bytenuts.state.buf, 1, st.st_size, fd);
-    }
-    if (fd)
-        fclose(fd);
+    /* the output is picked up by cheerios_start, without reading it all */
 
     chdir(cwd);
     free(cwd);
@@ -530,12 +777,5 @@ load_state()
         bytenuts.state.history_len = 0;
     }
 
-    if (bytenuts.state.buf) {
-        cheerios_insert(bytenuts.state.buf, bytenuts.state.buf_len);
-        free(bytenuts.state.buf);
-        bytenuts.state.buf = NULL;
-        bytenuts.state.buf_len = 0;
-    }
-
     return 0;
 }
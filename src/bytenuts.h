@@ -13,14 +13,15 @@
 
 #include "serial.h"
 
+/* serial ports one process can have open, each in its own pane */
+#define BYTENUTS_MAX_PORTS (8)
+
 /* https://en.wikipedia.org/wiki/Control_character#How_control_characters_map_to_keyboards */
 #define CTRL(c) ((c)&31)
 
 typedef struct bytenuts_state_struct {
     char **history; /* commands from previous session */
     int history_len;
-    char *buf; /* previous buffer */
-    size_t buf_len;
 } bytenuts_state_t;
 
 typedef struct bytenuts_config_struct {
@@ -31,11 +32,21 @@ typedef struct bytenuts_config_struct {
     long baud; /* baud rate */
     char *config_path; /* config file path */
     char *log_path; /* path to the log file (if it exists) */
-    char *serial_path; /* path to the target serial device */
+    char *serial_path; /* path to the (first) target serial device */
     uint32_t inter_cmd_to; /* inter command timeout in ms */
     /* time format to be prepended to all log lines in the output file only,
      * NULL for no time prepended */
     char *time_fmt;
+    int fps; /* max output window redraws per second, default 60 */
+    /* lines and bytes of output to keep in memory, older output is spilled
+     * to disk, 0 for no limit */
+    int scrollback_lines;
+    size_t scrollback_bytes;
+    /* start a new log segment after this many bytes or seconds, 0 for no
+     * limit, and keep only the newest log_keep segments, 0 to keep all */
+    size_t log_rotate_bytes;
+    int log_rotate_secs;
+    int log_keep;
 } bytenuts_config_t;
 
 #define CONFIG_DEFAULT (bytenuts_config_t){                                    \
@@ -49,13 +60,26 @@ typedef struct bytenuts_config_struct {
     .serial_path = NULL,                                                       \
     .inter_cmd_to = 10,                                                        \
     .time_fmt = NULL,                                                          \
+    .fps = 60,                                                                 \
+    .scrollback_lines = 0,                                                     \
+    .scrollback_bytes = 64 * 1024 * 1024,                                      \
+    .log_rotate_bytes = 0,                                                     \
+    .log_rotate_secs = 0,                                                      \
+    .log_keep = 0,                                                             \
 }
 
 typedef struct bytenuts_struct {
-    serial_t serial_fd;
+    serial_t serial_fds[BYTENUTS_MAX_PORTS];
+    char *serial_paths[BYTENUTS_MAX_PORTS];
+    int n_ports;
     bytenuts_config_t config;
-    int config_overrides[6];
+    int config_overrides[12];
     int resume;
+    int headless; /* draw to the null device, for benchmarks */
+    char *capture_path; /* record everything sent and received here */
+    char *replay_path; /* play this capture back rather than opening a port */
+    double speed; /* replay speed, 0 for as fast as possible */
+    char *bridge_addr; /* share the first port on this socket */
     bytenuts_state_t state;
     WINDOW *status_win;
     WINDOW *out_win;
@@ -69,6 +93,7 @@ typedef struct bytenuts_struct {
     char *ingest_status;
     char *cheerios_status;
     char *cmdpg_status;
+    char *stats_status;
 } bytenuts_t;
 
 /* startup the application */
@@ -87,6 +112,7 @@ int bytenuts_print_stats();
 #define STATUS_INGEST   (1)
 #define STATUS_CHEERIOS (2)
 #define STATUS_CMDPAGE  (3)
+#define STATUS_STATS    (4) /* only shown when not empty */
 /* set the status for the given thread */
 int bytenuts_set_status(int user, const char *fmt, ...);
 
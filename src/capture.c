@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#endif
+
+#include "capture.h"
+#include "logger.h"
+#include "stats.h"
+
+/* records bigger than this mean the file is broken */
+#define MAX_REC_LEN (16 * 1024 * 1024)
+
+static struct {
+    logger_handle logger;
+    /* replay */
+    pthread_t thr;
+    volatile int running;
+    FILE *file;
+    int fd; /* our end of the stand-in port */
+    double speed;
+} capture = {
+    .fd = -1,
+};
+
+static void record(int port, int dir, const void *buf, size_t len);
+#ifndef __MINGW32__
+static void *replay_thread(void *arg);
+static void wait_until(uint64_t due_ns);
+static void drain(int to_ms);
+static void send_all(const uint8_t *buf, size_t len);
+#endif
+
+int
+capture_open(const char *path)
+{
+    capture_header_t hdr = { .magic = CAPTURE_MAGIC };
+    struct timespec wall;
+    logger_handle logger = logger_create();
+
+    if (!logger)
+        return -1;
+
+    if (logger_add_file(logger, path)) {
+        logger_destroy(logger);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &wall);
+    hdr.mono_ns = stats_now_ns();
+    hdr.wall_ns = (uint64_t)wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+    logger_write(logger, &hdr, sizeof(hdr));
+
+    capture.logger = logger;
+
+    return 0;
+}
+
+void
+capture_rx(int port, const void *buf, size_t len)
+{
+    if (capture.logger)
+        record(port, CAPTURE_RX, buf, len);
+}
+
+void
+capture_tx(int port, const void *buf, size_t len)
+{
+    if (capture.logger)
+        record(port, CAPTURE_TX, buf, len);
+}
+
+void
+capture_close()
+{
+    logger_destroy(capture.logger);
+    capture.logger = NULL;
+}
+
+#ifdef __MINGW32__
+serial_t
+capture_replay(const char *path, double speed)
+{
+    return SERIAL_INVALID;
+}
+
+void
+capture_replay_stop()
+{
+}
+#else
+serial_t
+capture_replay(const char *path, double speed)
+{
+    capture_header_t hdr;
+    int fds[2];
+
+    capture.file = fopen(path, "rb");
+    if (!capture.file)
+        return SERIAL_INVALID;
+
+    if (
+        fread(&hdr, sizeof(hdr), 1, capture.file) != 1 ||
+        memcmp(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic)) ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds)
+    ) {
+        fclose(capture.file);
+        capture.file = NULL;
+        return SERIAL_INVALID;
+    }
+
+    /* the port end acts like a serial port opened with O_NDELAY */
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    capture.fd = fds[1];
+    capture.speed = speed;
+    capture.running = 1;
+    if (pthread_create(&capture.thr, NULL, replay_thread, NULL)) {
+        close(fds[0]);
+        close(fds[1]);
+        fclose(capture.file);
+        capture.file = NULL;
+        capture.fd = -1;
+        return SERIAL_INVALID;
+    }
+
+    return fds[0];
+}
+
+void
+capture_replay_stop()
+{
+    if (capture.fd < 0)
+        return;
+
+    capture.running = 0;
+    /* kicks the thread out of a send the other end is not reading */
+    shutdown(capture.fd, SHUT_RDWR);
+    pthread_join(capture.thr, NULL);
+
+    close(capture.fd);
+    capture.fd = -1;
+    fclose(capture.file);
+    capture.file = NULL;
+}
+#endif /* __MINGW32__ */
+
+static void
+record(int port, int dir, const void *buf, size_t len)
+{
+    capture_rec_t rec = {
+        .t_ns = stats_now_ns(),
+        .len = len,
+        .dir = dir,
+        .port = port,
+    };
+
+    logger_write_rec(capture.logger, &rec, sizeof(rec), buf, len);
+}
+
+#ifndef __MINGW32__
+/* sends the received data of each record once it is due, measured from the
+ * first record */
+static void *
+replay_thread(void *arg)
+{
+    capture_rec_t rec;
+    uint8_t *buf = NULL;
+    size_t buf_cap = 0;
+    uint64_t start = stats_now_ns();
+    uint64_t first = 0;
+    int started = 0;
+
+    while (capture.running && fread(&rec, sizeof(rec), 1, capture.file) == 1) {
+        if (rec.len > MAX_REC_LEN)
+            break;
+
+        if (rec.len > buf_cap) {
+            uint8_t *tmp = realloc(buf, rec.len);
+
+            if (!tmp)
+                break;
+            buf = tmp;
+            buf_cap = rec.len;
+        }
+
+        if (fread(buf, 1, rec.len, capture.file) != rec.len)
+            break;
+
+        if (rec.dir != CAPTURE_RX || rec.port != 0)
+            continue;
+
+        if (!started) {
+            first = rec.t_ns;
+            started = 1;
+        }
+
+        if (capture.speed > 0)
+            wait_until(start + (uint64_t)((rec.t_ns - first) / capture.speed));
+
+        send_all(buf, rec.len);
+    }
+
+    free(buf);
+
+    /* the port stays up once the capture is done */
+    while (capture.running) {
+        drain(100);
+    }
+
+    return NULL;
+}
+
+/* sleep until due_ns on the monotonic clock, throwing away whatever gets
+ * written to the port in the meantime */
+static void
+wait_until(uint64_t due_ns)
+{
+    while (capture.running) {
+        uint64_t now = stats_now_ns();
+        uint64_t left;
+
+        if (now >= due_ns)
+            return;
+
+        /* poll only has millisecond resolution, sleep out the rest */
+        left = due_ns - now;
+        if (left > 2000000) {
+            drain((left - 1000000) / 1000000);
+        } else {
+            struct timespec ts = { 0, left };
+
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+static void
+drain(int to_ms)
+{
+    struct pollfd fds = { .fd = capture.fd, .events = POLLIN };
+    uint8_t buf[1024];
+
+    if (to_ms > 100)
+        to_ms = 100;
+
+    if (poll(&fds, 1, to_ms) > 0 && (fds.revents & POLLIN))
+        recv(capture.fd, buf, sizeof(buf), MSG_DONTWAIT);
+}
+
+static void
+send_all(const uint8_t *buf, size_t len)
+{
+    while (len > 0 && capture.running) {
+        ssize_t ret = send(capture.fd, buf, len, MSG_NOSIGNAL);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        buf += ret;
+        len -= ret;
+    }
+}
+#endif /* __MINGW32__ */
@@ -0,0 +1,60 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "serial.h"
+
+/* Binary capture of everything that went over the port, and replay of it.
+ *
+ * A capture file starts with a capture_header_t followed by records, each a
+ * capture_rec_t and then len bytes of data. t_ns is CLOCK_MONOTONIC at the
+ * time of the read or write, and the header has both clocks at the start of
+ * the capture to get wall clock times back. Everything is in the byte order
+ * of the machine that captured it. */
+
+#define CAPTURE_MAGIC "bncap01\n"
+
+enum capture_dir_enum {
+    CAPTURE_RX = 0, /* read from the device */
+    CAPTURE_TX, /* written to the device */
+};
+
+typedef struct capture_header_struct {
+    char magic[8];
+    uint64_t mono_ns; /* CLOCK_MONOTONIC when the capture started */
+    uint64_t wall_ns; /* CLOCK_REALTIME at the same time */
+} capture_header_t;
+
+typedef struct capture_rec_struct {
+    uint64_t t_ns;
+    uint32_t len;
+    uint8_t dir;
+    uint8_t port; /* index of the port, in the order they were opened */
+    uint8_t pad[2];
+} capture_rec_t;
+
+/* Start capturing to the file at path. Records are written out by a logger
+ * thread, so capturing never blocks on the disk. */
+int capture_open(const char *path);
+
+/* Record len bytes read from a port, does nothing when not capturing */
+void capture_rx(int port, const void *buf, size_t len);
+
+/* Record len bytes written to a port, does nothing when not capturing */
+void capture_tx(int port, const void *buf, size_t len);
+
+/* Flush and close the capture */
+void capture_close(void);
+
+/* Play the data received by the first port of the capture at path back with
+ * the original timing divided by speed, or as fast as it is read with a speed of 0. The
+ * returned handle stands in for the serial port, anything written to it is
+ * thrown away. */
+serial_t capture_replay(const char *path, double speed);
+
+/* Stop the replay, call before closing the handle */
+void capture_replay_stop(void);
+
+#endif /* _CAPTURE_H_ */
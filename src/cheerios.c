@@ -3,6 +3,8 @@
 #else
 #  include <ncurses.h>
 #endif
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
@@ -11,36 +13,146 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#ifndef __MINGW32__
+#  include <dirent.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/epoll.h>
+#  include <sys/mman.h>
+#endif
 
+#include "bridge.h"
+#include "bstr.h"
+#include "capture.h"
 #include "cheerios.h"
+#include "paths.h"
+#include "scan.h"
+#include "stats.h"
+#include "timer_math.h"
 #include "xmodem.h"
+#include "zmodem.h"
+
+/* lines that were there before a filter was set get tested this many at a
+ * time, once per frame */
+#define FILTER_BATCH (20000)
+
+/* epoll data of the reader's wakeup, ports use their index */
+#define WAKE_ID (BYTENUTS_MAX_PORTS)
+
+/* how long a hung up port is left alone before reading it again */
+#define PARK_NS (100000000ULL)
+
+/* a port sharing the log with others holds back a line that has not ended
+ * up to this many bytes */
+#define LOG_HOLD_MAX (64 * 1024)
 
 static cheerios_t cheerios;
 
 static void *cheerios_thread(void *arg);
-static int insert_buf(line_buffer_t *lines, const char *buf, size_t len);
-static int write_lines(line_buffer_t *lines);
-static int handle_color(line_buffer_t *lines, int line_idx, int *pos, int apply);
-short curs_color(int fg);
-static int newline(line_buffer_t *lines);
+static void cheerios_cleanup(void);
+static void *render_thread(void *arg);
+static void *tx_thread(void *arg);
+#ifndef __MINGW32__
+static int watch_ports(int ep);
+#endif
+static int tx_flush(cheerios_port_t *port, int to_ms);
+static void mark_dirty(cheerios_port_t *port);
+static void update_stats_bar(void);
+static void sweep_spills(void);
+static void redraw_all(void);
+static void layout(void);
+static void place(WINDOW **win, int y, int x, int height, int width);
+static char *scrollback_file(int port);
+static int insert_buf(cheerios_port_t *port, const char *buf, size_t len);
+static void render_frame(void);
+static int snapshot_lines(cheerios_port_t *port, int height, int width);
+static void snapshot_runs(
+    frame_t *frame,
+    const lines_run_t *runs,
+    int n_runs,
+    int start,
+    int end
+);
+static int highlight_runs(
+    frame_t *frame,
+    const lines_run_t *runs,
+    int n_runs,
+    int start,
+    int end
+);
+static int next_on_line(cheerios_port_t *port, int dir, int *col);
+static int draw_frame(cheerios_port_t *port, int height);
+static void draw_title(cheerios_port_t *port);
+static void set_attr(WINDOW *win, uint32_t attr);
+static short color_pair(int fg, int bg);
+static short term_color(int col);
+static void put_text(line_buffer_t *lines, const char *buf, int len);
+static int line_runs(line_buffer_t *lines, int len);
+static int newline(cheerios_port_t *port, int stamp);
+static long bottom_row(line_buffer_t *lines);
+static void set_bottom_row(line_buffer_t *lines, long row);
+static void log_append(cheerios_port_t *port, const void *buf, size_t len);
+static void log_stamp(cheerios_port_t *port);
+static void log_time(cheerios_port_t *port);
+static void log_text(cheerios_port_t *port, const void *buf, size_t len);
+static int split_time_fmt(const char *fmt);
+static uint64_t wall_ns(void);
+static int gutter_width(int width);
+static void put_gutter(char *buf, int gw, uint64_t t, uint64_t prev);
+static void load_log(const char *path);
+static int load_file(const char *path);
+static int send_batch(char **paths, int n_paths, int zmodem, int resume);
 
 int
 cheerios_start(bytenuts_t *bytenuts)
 {
     char *home = getenv("HOME");
+    int continued = 0; /* the old backup log is being added to */
+    int loaded = 0; /* the old scrollback got loaded */
 
     memset(&cheerios, 0, sizeof(cheerios_t));
 
     cheerios.output = bytenuts->out_win;
     cheerios.term_lock = &bytenuts->term_lock;
-    cheerios.ser_fd = bytenuts->serial_fd;
-    cheerios.lines.bot = -1;
+    cheerios.n_ports = bytenuts->n_ports;
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        cheerios_port_t *port = &cheerios.ports[i];
+
+        port->ser_fd = bytenuts->serial_fds[i];
+        port->name = strdup(bytenuts->serial_paths[i]);
+        port->tag = strrchr(port->name, '/') ? strrchr(port->name, '/') + 1 : port->name;
+        port->lines.bot = -1;
+        port->lines.fbot = -1;
+        port->hit_line = -1;
+        /* draw a first frame for whatever got resumed */
+        port->redraw = 1;
+        port->dirty = 1;
+        if (ring_init(&port->txq, 64 * 1024))
+            return -1;
+        pthread_mutex_init(&port->tx_lock, NULL);
+    }
+    layout();
 
     cheerios.config = &bytenuts->config;
+    if (cheerios.config->time_fmt && split_time_fmt(cheerios.config->time_fmt))
+        return -1;
+
+    cheerios.logger = logger_create();
+    if (!cheerios.logger) {
+        return -1;
+    }
+
+    /* the -l and backup logs are read as text */
+    logger_mark_drops(cheerios.logger);
+    logger_rotate(
+        cheerios.logger,
+        cheerios.config->log_rotate_bytes,
+        cheerios.config->log_rotate_secs,
+        cheerios.config->log_keep
+    );
 
     if (cheerios.config->log_path) {
-        cheerios.log = fopen(cheerios.config->log_path, "w");
-        if (!cheerios.log) {
+        if (logger_add_file(cheerios.logger, cheerios.config->log_path)) {
             return -1;
         }
     }
@@ -62,63 +174,227 @@ cheerios_start(bytenuts_t *bytenuts)
             "%s/.config/bytenuts/outbuf.%lld.log",
             home, (long long)pid
         );
-        cheerios.backup = fopen(cheerios.backup_filename, "w");
+
+        /* a resumed session keeps adding to the old log, nothing gets copied */
+        if (bytenuts->resume) {
+            char *old_log = paths_logfile("outbuf", 0);
+
+            continued = old_log && !logger_move(old_log, cheerios.backup_filename);
+            free(old_log);
+        }
+
+        if (
+            continued ?
+            logger_append_file(cheerios.logger, cheerios.backup_filename) :
+            logger_add_file(cheerios.logger, cheerios.backup_filename)
+        ) {
+            free(cheerios.backup_filename);
+            cheerios.backup_filename = NULL;
+        }
     }
 
-    pthread_cond_init(&cheerios.cond, NULL);
-    pthread_mutex_init(&cheerios.lock, NULL);
-    cheerios.running = 1;
-    pthread_create(&cheerios.thr, NULL, cheerios_thread, NULL);
+    /* spill files are always set up so the scrollback can be saved on exit,
+     * without limits nothing gets spilled before then */
+    cheerios.scrollback_path = paths_bnconf_dir();
+    if (cheerios.scrollback_path) {
+        cheerios.scrollback_path = paths_append(cheerios.scrollback_path, "scrollback");
+        sweep_spills();
+
+        for (int i = 0; i < cheerios.n_ports; i++) {
+            lines_t *store = &cheerios.ports[i].lines.store;
+            char *saved = scrollback_file(i);
+            char *spill_path = bstr_print(
+                strdup(cheerios.scrollback_path),
+                ".%lld.%d", (long long)getpid(), i
+            );
+            int port_loaded = 0;
+
+            if (bytenuts->resume) {
+                port_loaded = !lines_load(
+                    store, saved, spill_path,
+                    cheerios.config->scrollback_lines,
+                    cheerios.config->scrollback_bytes
+                );
+            }
+            if (!port_loaded) {
+                lines_spill(
+                    store, spill_path,
+                    cheerios.config->scrollback_lines,
+                    cheerios.config->scrollback_bytes
+                );
+            }
+            if (i == 0)
+                loaded = port_loaded;
+
+            free(saved);
+            free(spill_path);
+        }
+    }
+
+    /* no saved scrollback to go with the old log, parse the log instead */
+    if (continued && !loaded)
+        load_log(cheerios.backup_filename);
 
+    scan_init();
+    stats_init();
+
+    /* before the render thread can start setting up pairs */
     if (cheerios.config->colors) {
         start_color();
         use_default_colors();
     }
 
+    if (
+        wakeup_init(&cheerios.wake) ||
+        wakeup_init(&cheerios.render_wake) ||
+        wakeup_init(&cheerios.tx_wake)
+    ) {
+        return -1;
+    }
+    pthread_mutex_init(&cheerios.lock, NULL);
+    cheerios.frame_scrolling = -1;
+    cheerios.dirty = 1;
+    cheerios.running = 1;
+    pthread_create(&cheerios.thr, NULL, cheerios_thread, NULL);
+    pthread_create(&cheerios.render_thr, NULL, render_thread, NULL);
+    pthread_create(&cheerios.tx_thr, NULL, tx_thread, NULL);
+
     return 0;
 }
 
 int
-cheerios_pause()
+cheerios_pause(int idx)
 {
+    cheerios_port_t *port = &cheerios.ports[idx];
+
+    /* held until cheerios_resume, a bridge client only trylocks it so
+     * nothing gets queued in the middle of a transfer. Typed input that is
+     * already queued goes out first. */
+    pthread_mutex_lock(&port->tx_lock);
+    tx_flush(port, 1000);
+
     pthread_mutex_lock(&cheerios.lock);
-    cheerios.mode = CHEERIOS_MODE_PAUSED;
+    port->paused = 1;
     pthread_mutex_unlock(&cheerios.lock);
+    wakeup_signal(&cheerios.wake);
+    wakeup_signal(&cheerios.tx_wake);
+
+    /* the writer may have checked paused just before, wait for it to be
+     * done with the fd */
+    while (!port->tx_stopped && cheerios.running) {
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
 
     cheerios_info("Paused");
     return 0;
 }
 
 int
-cheerios_resume()
+cheerios_resume(int idx)
 {
+    cheerios_port_t *port = &cheerios.ports[idx];
+
     pthread_mutex_lock(&cheerios.lock);
-    cheerios.mode = CHEERIOS_MODE_NORMAL;
-    pthread_cond_signal(&cheerios.cond);
+    port->paused = 0;
     pthread_mutex_unlock(&cheerios.lock);
+    pthread_mutex_unlock(&port->tx_lock);
+    wakeup_signal(&cheerios.wake);
+    wakeup_signal(&cheerios.tx_wake);
 
     cheerios_info("Resumed");
     return 0;
 }
 
 int
-cheerios_goback(int lines)
+cheerios_goback(int rows)
+{
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    int height, width;
+    long bottom;
+
+    getmaxyx(port->output, height, width);
+
+    pthread_mutex_lock(&cheerios.lock);
+    width -= gutter_width(width);
+
+    /* the filtered view scrolls by lines */
+    if (port->filtering) {
+        int n = port->filter.n_matches;
+        int fbot = port->lines.fbot < 0 ? n - 1 : port->lines.fbot;
+
+        if (rows < 0)
+            fbot = height - 1;
+        else
+            fbot -= rows;
+
+        if (fbot > n - 1)
+            fbot = n - 1;
+        port->lines.fbot = fbot < 0 ? (n > 0 ? 0 : -1) : fbot;
+        mark_dirty(port);
+
+        pthread_mutex_unlock(&cheerios.lock);
+        return 0;
+    }
+
+    wrap_sync(&port->lines.wrap, &port->lines.store, width);
+
+    if (rows < 0) { /* go back as far as we can */
+        bottom = height - 1;
+    }
+    else { /* just move the bottom row up */
+        bottom = bottom_row(&port->lines) - rows;
+    }
+
+    set_bottom_row(&port->lines, bottom < 0 ? 0 : bottom);
+    mark_dirty(port);
+
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return 0;
+}
+
+int
+cheerios_gofwd(int rows)
 {
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    int width = getmaxx(port->output);
+    long bottom;
+
     pthread_mutex_lock(&cheerios.lock);
+    width -= gutter_width(width);
+
+    if (port->filtering) {
+        int fbot = port->lines.fbot;
+
+        if (rows < 0 || fbot < 0 || fbot + rows >= port->filter.n_matches - 1)
+            port->lines.fbot = -1;
+        else
+            port->lines.fbot = fbot + rows;
+        mark_dirty(port);
 
-    if (lines < 0) { /* go back as far as we can */
-        cheerios.lines.bot = getmaxy(cheerios.output) % cheerios.lines.n_lines;
+        pthread_mutex_unlock(&cheerios.lock);
+        return 0;
+    }
+
+    wrap_sync(&port->lines.wrap, &port->lines.store, width);
+
+    if (rows < 0) { /* go to front, which also ends a search */
+        port->lines.bot = -1;
+        if (port->hit_line >= 0) {
+            port->hit_line = -1;
+            port->redraw = 1;
+        }
     }
-    else { /* just increment the bot pointer */
-        if (cheerios.lines.bot < 0)
-            cheerios.lines.bot = cheerios.lines.n_lines - 1;
+    else { /* just move the bottom row down */
+        bottom = bottom_row(&port->lines) + rows;
 
-        cheerios.lines.bot -= lines;
-        if (cheerios.lines.bot < 0)
-            cheerios.lines.bot = 0;
+        if (bottom >= port->lines.wrap.total - 1)
+            port->lines.bot = -1;
+        else
+            set_bottom_row(&port->lines, bottom);
     }
 
-    write_lines(&cheerios.lines);
+    mark_dirty(port);
 
     pthread_mutex_unlock(&cheerios.lock);
 
@@ -126,74 +402,244 @@ cheerios_goback(int lines)
 }
 
 int
-cheerios_gofwd(int lines)
+cheerios_search(const char *s, int dir)
 {
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    int height, width;
+    int from, line, col;
+    long row;
+
+    getmaxyx(port->output, height, width);
+
     pthread_mutex_lock(&cheerios.lock);
+    width -= gutter_width(width);
 
-    if (lines < 0) { /* go to front */
-        cheerios.lines.bot = -1;
+    wrap_sync(&port->lines.wrap, &port->lines.store, width);
+
+    if (s) {
+        free(port->search);
+        port->search = strdup(s);
+        port->search_len = strlen(s);
+        port->hit_line = -1;
+    }
+
+    if (!port->search) {
+        pthread_mutex_unlock(&cheerios.lock);
+        return -1;
     }
-    else { /* just increment the bot pointer */
-        if (cheerios.lines.bot < 0)
-            cheerios.lines.bot = cheerios.lines.n_lines - 1;
 
-        cheerios.lines.bot += lines;
-        if (cheerios.lines.bot >= cheerios.lines.n_lines)
-            cheerios.lines.bot = -1;
+    /* the rest of the line of the last hit comes before the next line */
+    if (port->hit_line >= 0 && !next_on_line(port, dir, &col)) {
+        line = port->hit_line;
+    }
+    else {
+        if (port->hit_line >= 0)
+            from = port->hit_line + (dir < 0 ? -1 : 1);
+        else if (port->lines.bot >= 0)
+            from = port->lines.bot;
+        else
+            from = port->lines.store.n_lines - 1;
+
+        line = lines_find(
+            &port->lines.store, from, dir,
+            port->search, port->search_len, &col
+        );
+    }
+    if (line < 0) {
+        pthread_mutex_unlock(&cheerios.lock);
+        return -1;
     }
 
-    write_lines(&cheerios.lines);
+    port->hit_line = line;
+    port->hit_col = col;
+    /* hits are shown in the full view */
+    port->filtering = 0;
+
+    /* put the row with the hit in the middle of the window */
+    row = wrap_row_of(&port->lines.wrap, &port->lines.store, line) +
+        col / width + height / 2;
+    if (row > port->lines.wrap.total - 1)
+        row = port->lines.wrap.total - 1;
+
+    set_bottom_row(&port->lines, row);
+    port->redraw = 1;
+    mark_dirty(port);
 
     pthread_mutex_unlock(&cheerios.lock);
 
     return 0;
 }
 
+int
+cheerios_filter(const char *pattern, int regex)
+{
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    int ret = 0;
+
+    pthread_mutex_lock(&cheerios.lock);
+
+    if (pattern && pattern[0]) {
+        ret = filter_set(&port->filter, pattern, regex);
+        if (!ret)
+            port->filtering = 1;
+    }
+    else if (pattern) {
+        port->filtering = 0;
+    }
+    else if (port->filter.pattern) {
+        port->filtering = !port->filtering;
+    }
+    else {
+        ret = -1;
+    }
+
+    if (!ret) {
+        port->lines.fbot = -1;
+        port->redraw = 1;
+        mark_dirty(port);
+    }
+
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return ret;
+}
+
 int
 cheerios_stop()
 {
     cheerios.running = 0;
+    wakeup_signal(&cheerios.wake);
+    wakeup_signal(&cheerios.render_wake);
+    wakeup_signal(&cheerios.tx_wake);
     pthread_join(cheerios.thr, NULL);
+    pthread_join(cheerios.render_thr, NULL);
+    pthread_join(cheerios.tx_thr, NULL);
+    wakeup_destroy(&cheerios.wake);
+    wakeup_destroy(&cheerios.render_wake);
+    wakeup_destroy(&cheerios.tx_wake);
+
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        cheerios_port_t *port = &cheerios.ports[i];
+
+        /* keep the scrollback around for --resume */
+        if (cheerios.scrollback_path) {
+            int n_lines = port->lines.store.n_lines;
+            char *saved = scrollback_file(i);
+
+            if (n_lines > 0 && cheerios.config->colors) {
+                int len = lines_len(&port->lines.store, n_lines - 1);
+
+                lines_finish(
+                    &port->lines.store, port->lines.runs,
+                    line_runs(&port->lines, len)
+                );
+            }
+            lines_save(&port->lines.store, saved);
+            free(saved);
+        }
+
+        /* a single port draws straight to the window bytenuts owns */
+        if (port->title) {
+            delwin(port->title);
+            delwin(port->output);
+        }
+
+        /* a bridge client may still be queueing */
+        pthread_mutex_lock(&port->tx_lock);
+        ring_free(&port->txq);
+        pthread_mutex_unlock(&port->tx_lock);
+        lines_free(&port->lines.store);
+        wrap_free(&port->lines.wrap);
+        free(port->lines.attrs);
+        free(port->lines.runs);
+        free(port->frame.rows);
+        free(port->frame.row_lens);
+        free(port->frame.buf);
+        free(port->frame.runs);
+        free(port->frame.row_runs);
+        free(port->frame.row_n_runs);
+        free(port->frame.hl_runs);
+        free(port->frame.gutter);
+        free(port->search);
+        filter_free(&port->filter);
+        free(port->name);
+    }
+
+    free(cheerios.scrollback_path);
+    free(cheerios.pairs);
+    for (int i = 0; i < cheerios.n_tsegs; i++) {
+        free(cheerios.tsegs[i].fmt);
+    }
+    free(cheerios.tsegs);
+
     return 0;
 }
 
 int
 cheerios_input(const char *buf, size_t len)
 {
-    size_t len_left = len;
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
     size_t p = 0;
 
-    pthread_mutex_lock(&cheerios.lock);
-    while (len_left > 0) {
-        ssize_t tmp = serial_write(cheerios.ser_fd, &buf[p], len_left);
-
-        if (tmp < 0) {
-            pthread_mutex_unlock(&cheerios.lock);
-            return -1;
+    /* held throughout so the input does not get split up by a bridge client */
+    pthread_mutex_lock(&port->tx_lock);
+    while (p < len) {
+        p += ring_push(&port->txq, &buf[p], len - p);
+        wakeup_signal(&cheerios.tx_wake);
+
+        /* the device is not keeping up, wait for the writer to make room */
+        if (p < len) {
+            if (!cheerios.running) {
+                pthread_mutex_unlock(&port->tx_lock);
+                return -1;
+            }
+            nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
         }
-
-        len_left -= tmp;
     }
-    pthread_mutex_unlock(&cheerios.lock);
+    pthread_mutex_unlock(&port->tx_lock);
 
     return 0;
 }
 
+size_t
+cheerios_input_some(int idx, const char *buf, size_t len)
+{
+    cheerios_port_t *port = &cheerios.ports[idx];
+    size_t n = 0;
+
+    /* whoever has it will be done soon, the caller comes back later */
+    if (idx >= cheerios.n_ports || pthread_mutex_trylock(&port->tx_lock))
+        return 0;
+
+    if (cheerios.running) {
+        n = ring_push(&port->txq, buf, len);
+        if (n)
+            wakeup_signal(&cheerios.tx_wake);
+    }
+    pthread_mutex_unlock(&port->tx_lock);
+
+    return n;
+}
+
 int
 cheerios_info(const char *line)
 {
     size_t line_len = strlen(line);
     char *line_parsed = calloc(1, line_len + 12 + 1);
+    cheerios_port_t *port;
+
     sprintf(line_parsed, "BYTENUTS: %s\r\n", line);
 
     pthread_mutex_lock(&cheerios.lock);
 
-    if (cheerios.lines.pos != 0) {
-        insert_buf(&cheerios.lines, "\r\n", 2);
+    port = &cheerios.ports[cheerios.sel];
+    if (port->lines.pos != 0) {
+        insert_buf(port, "\r\n", 2);
     }
-    insert_buf(&cheerios.lines, line_parsed, strlen(line_parsed));
+    insert_buf(port, line_parsed, strlen(line_parsed));
 
     pthread_mutex_unlock(&cheerios.lock);
+    free(line_parsed);
     return 0;
 }
 
@@ -224,7 +670,7 @@ int
 cheerios_insert(const char *buf, size_t len)
 {
     pthread_mutex_lock(&cheerios.lock);
-    insert_buf(&cheerios.lines, buf, len);
+    insert_buf(&cheerios.ports[cheerios.sel], buf, len);
     pthread_mutex_unlock(&cheerios.lock);
 
     return 0;
@@ -252,6 +698,7 @@ __xmodem_callback(size_t sent, size_t total, int ack_fails)
 int
 cheerios_xmodem(const char *path, int block_sz)
 {
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
     struct stat st = { 0 };
     FILE *fd;
     char info[128];
@@ -273,416 +720,1902 @@ cheerios_xmodem(const char *path, int block_sz)
         return -1;
     }
 
-    cheerios_pause();
+    /* typed input goes out first, then the writer keeps off the port */
+    cheerios_pause(cheerios.sel);
     if (xmodem_send(
-            cheerios.ser_fd,
+            port->ser_fd,
             fileno(fd),
             st.st_size,
             block_sz,
             __xmodem_callback
     )) {
         fclose(fd);
-        cheerios_resume();
+        cheerios_resume(cheerios.sel);
         return -1;
     }
 
     fclose(fd);
-    cheerios_resume();
+    cheerios_resume(cheerios.sel);
     return 0;
 }
 
-int
-cheerios_print_stats()
+static void
+__zmodem_callback(size_t sent, size_t total, int resends)
 {
-    char st_line[128];
+    char status_str[128];
 
-    sprintf(st_line, "output line count: %d\r\n", cheerios.lines.n_lines);
-    cheerios_insert(st_line, strlen(st_line));
+    snprintf(
+        status_str, sizeof(status_str),
+        "\r  %.02f/%.02fKB (%.01f%%, %d resends)",
+        (sent / 1024.0),
+        (total / 1024.0),
+        total ? (sent * 100.0 / total) : 100.0,
+        resends
+    );
 
-    return 0;
+    cheerios_insert(status_str, strlen(status_str));
 }
 
 int
-cheerios_getmaxy()
+cheerios_ymodem(char **paths, int n_paths)
 {
-    int y, x;
-    getmaxyx(cheerios.output, y, x);
-    (void)x;
-    return y;
+    return send_batch(paths, n_paths, 0, 0);
 }
 
 int
-cheerios_getmaxx()
+cheerios_zmodem(char **paths, int n_paths, int resume)
 {
-    int y, x;
-    getmaxyx(cheerios.output, y, x);
-    (void)y;
-    return x;
+    return send_batch(paths, n_paths, 1, resume);
 }
 
-int
-cheerios_set_window(WINDOW *win)
+static void
+__xmodem_recv_callback(size_t received, int nak_fails)
 {
-    pthread_mutex_lock(&cheerios.lock);
-
-    delwin(cheerios.output);
-    cheerios.output = win;
-    write_lines(&cheerios.lines);
+    char status_str[128];
 
-    pthread_mutex_unlock(&cheerios.lock);
+    snprintf(
+        status_str, sizeof(status_str),
+        "\r  %.02fKB (%d NAKs)",
+        (received / 1024.0),
+        nak_fails
+    );
 
-    return 0;
+    cheerios_insert(status_str, strlen(status_str));
 }
 
-static void *
-cheerios_thread(void *arg)
+int
+cheerios_xmodem_recv(const char *path)
 {
-    char buf[1024];
-    ssize_t read_ret = 0;
-
-    while (cheerios.running) {
-        pthread_mutex_lock(&cheerios.lock);
-
-        while (cheerios.mode == CHEERIOS_MODE_PAUSED) {
-            pthread_cond_wait(&cheerios.cond, &cheerios.lock);
-        }
-
-        read_ret = serial_read(cheerios.ser_fd, buf, sizeof(buf));
-        if (read_ret > 0) {
-            insert_buf(&cheerios.lines, buf, read_ret);
-        }
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    FILE *fd;
+    char info[128];
+    int ret;
 
-        pthread_mutex_unlock(&cheerios.lock);
-        nanosleep(&(struct timespec){ 0, 100000 }, NULL);
+    fd = fopen(path, "w");
+    if (!fd) {
+        cheerios_info("Failed to open file!");
+        return -1;
     }
 
-    if (cheerios.log)
-        fclose(cheerios.log);
-
-    if (cheerios.backup) {
-        char *out_filename;
-        int out_filename_len;
-        char *home = getenv("HOME");
-
-        /* do not chdir as other threads can still be running */
-        out_filename_len = snprintf(
-            NULL, 0,
-            "%s/.config/bytenuts/outbuf.log",
-            home
-        );
-        out_filename = calloc(1, out_filename_len + 1);
-        snprintf(
-            out_filename, out_filename_len + 1,
-            "%s/.config/bytenuts/outbuf.log",
-            home
-        );
+    snprintf(info, sizeof(info), "Receiving %s, start the sender", path);
+    cheerios_info(info);
 
-        /* move this processes log to the path that can be loaded on resumption */
-        fclose(cheerios.backup);
-        rename(cheerios.backup_filename, out_filename);
+    cheerios_pause(cheerios.sel);
+    ret = xmodem_recv(port->ser_fd, fileno(fd), 0, __xmodem_recv_callback);
+    fclose(fd);
+    cheerios_resume(cheerios.sel);
 
-        free(out_filename);
-        free(cheerios.backup_filename);
+    if (ret) {
+        snprintf(info, sizeof(info), "Receive failed (%d)", ret);
+        cheerios_info(info);
+        return -1;
     }
 
-    pthread_exit(NULL);
-    return NULL;
+    return 0;
 }
 
+/* send the files at paths in one ymodem or zmodem session */
 static int
-insert_buf(line_buffer_t *lines, const char *buf, size_t len)
+send_batch(char **paths, int n_paths, int zmodem, int resume)
 {
-    if (lines->n_lines == 0)
-        newline(lines);
-
-    for (size_t i = 0; i < len; i++) {
-        if (cheerios.mode == CHEERIOS_MODE_NORMAL) {
-            if (cheerios.log)
-               fwrite(&buf[i], 1, 1, cheerios.log);
-            if (cheerios.backup)
-                fwrite(&buf[i], 1, 1, cheerios.backup);
-        }
-
-        /* line feed starts a new row */
-        if (buf[i] == '\n') {
-            newline(lines);
-        }
-        /* carriage return just sets pos to 0 */
-        else if (buf[i] == '\r') {
-            lines->pos = 0;
-        }
-        else {
-            if (lines->pos >= lines->line_lens[lines->n_lines - 1]) {
-                lines->line_lens[lines->n_lines - 1] = lines->pos + 1;
-                lines->lines[lines->n_lines - 1] = realloc(
-                    lines->lines[lines->n_lines - 1],
-                    sizeof(uint8_t) * lines->line_lens[lines->n_lines - 1]
-                );
-            }
-
-            lines->lines[lines->n_lines - 1][lines->pos] = buf[i];
-            lines->pos++;
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    FILE **fds;
+    char info[128];
+    int ret = 0;
+
+    /* every file has to be there before the batch starts */
+    fds = calloc(n_paths, sizeof(*fds));
+    for (int i = 0; i < n_paths; i++) {
+        fds[i] = fopen(paths[i], "r");
+        if (!fds[i]) {
+            snprintf(info, sizeof(info), "Failed to open %s!", paths[i]);
+            cheerios_info(info);
+            ret = -1;
+            goto batch_cleanup;
         }
     }
 
-    write_lines(lines);
-    return 0;
-}
-
-static int
-write_lines(line_buffer_t *lines)
-{
-    int row = lines->bot;
-    int rows_printed = 0;
-    int window_height = getmaxy(cheerios.output);
-    int window_width = getmaxx(cheerios.output);
-    line_buffer_t lines_wrapped = { 0 };
-
-    if (row < 0)
-        row = lines->n_lines - 1;
-
-    while (row >= 0 && rows_printed < window_height) {
-        /* we can print the whole line */
-        if (lines->line_lens[row] <= window_width) {
-            lines_wrapped.n_lines++;
-            lines_wrapped.lines = realloc(
-                lines_wrapped.lines,
-                sizeof(uint8_t *) * lines_wrapped.n_lines
-            );
-            lines_wrapped.line_lens = realloc(
-                lines_wrapped.line_lens,
-                sizeof(int) * lines_wrapped.n_lines
-            );
+    cheerios_pause(cheerios.sel);
 
-            lines_wrapped.lines[lines_wrapped.n_lines - 1] = lines->lines[row];
-            lines_wrapped.line_lens[lines_wrapped.n_lines - 1] = lines->line_lens[row];
+    if (zmodem)
+        ret = zmodem_begin(port->ser_fd);
 
-            rows_printed++;
-        }
-        /* we have to split the line */
-        else {
-            int n_split = lines->line_lens[row] / window_width;
+    for (int i = 0; i < n_paths && !ret; i++) {
+        struct stat st = { 0 };
+        const char *name = strrchr(paths[i], '/') ? strrchr(paths[i], '/') + 1 : paths[i];
 
-            if ((lines->line_lens[row] % window_width) == 0)
-                n_split--;
+        fstat(fileno(fds[i]), &st);
 
-            lines_wrapped.n_lines += n_split + 1;
-            lines_wrapped.lines = realloc(
-                lines_wrapped.lines,
-                sizeof(uint8_t *) * lines_wrapped.n_lines
-            );
-            lines_wrapped.line_lens = realloc(
-                lines_wrapped.line_lens,
-                sizeof(int) * lines_wrapped.n_lines
+        snprintf(
+            info, sizeof(info),
+            "Sending %s (%ld), %d of %d",
+            paths[i],
+            st.st_size,
+            i + 1,
+            n_paths
+        );
+        cheerios_info(info);
+
+        if (!zmodem) {
+            ret = ymodem_send(
+                port->ser_fd,
+                fileno(fds[i]),
+                name,
+                st.st_size,
+                st.st_mtime,
+                __xmodem_callback
             );
+            continue;
+        }
 
-            /* fill out lines that fill the width */
-            for (int i = 0; i < n_split; i++) {
-                lines_wrapped.lines[lines_wrapped.n_lines - 1 - i] =
-                    &lines->lines[row][i * window_width];
-                lines_wrapped.line_lens[lines_wrapped.n_lines - 1 - i] =
-                    window_width;
-            }
-            /* left over */
-            lines_wrapped.lines[lines_wrapped.n_lines - 1 - n_split] =
-                &lines->lines[row][n_split * window_width];
-
-            if ((lines->line_lens[row] % window_width) == 0) {
-                lines_wrapped.line_lens[lines_wrapped.n_lines - 1 - n_split] = window_width;
-            } else {
-                lines_wrapped.line_lens[lines_wrapped.n_lines - 1 - n_split] =
-                    lines->line_lens[row] % window_width;
-            }
+        ret = zmodem_send(
+            fileno(fds[i]),
+            name,
+            st.st_size,
+            st.st_mtime,
+            resume,
+            __zmodem_callback
+        );
 
-            rows_printed += n_split + 1;
+        /* e.g. it already has the file, the rest of the batch goes on */
+        if (ret == ZMODEM_ERR_SKIPPED) {
+            cheerios_info("Skipped by the receiver");
+            ret = 0;
         }
-
-        row--;
     }
 
-    pthread_mutex_lock(cheerios.term_lock);
-
-    curs_set(0);
-    werase(cheerios.output);
-
-    /* the copying process reverses the order of the rows... */
-    row = 0;
-    rows_printed = 0;
-    while (row < lines_wrapped.n_lines && rows_printed < window_height) {
-        wmove(cheerios.output, window_height - rows_printed - 1, 0);
-
-        for (int i = 0; i < lines_wrapped.line_lens[row]; i++) {
-            handle_color(&lines_wrapped, row, &i, 1);
-
-            if (i >= getmaxx(cheerios.output)) {
-                break;
-            }
+    if (!ret)
+        ret = zmodem ? zmodem_end() : ymodem_finish(port->ser_fd);
 
-            if (i < lines_wrapped.line_lens[row]) {
-                waddch(cheerios.output, lines_wrapped.lines[row][i]);
-            }
-        }
+    cheerios_resume(cheerios.sel);
 
-        rows_printed++;
-        row++;
+    if (ret) {
+        snprintf(info, sizeof(info), "Batch failed (%d)", ret);
+        cheerios_info(info);
+        ret = -1;
     }
 
-    curs_set(1);
-    wrefresh(cheerios.output);
-
-    pthread_mutex_unlock(cheerios.term_lock);
-
-    if (lines->bot < 0) {
-        bytenuts_set_status(STATUS_CHEERIOS, "scrolling");
-    } else {
-        bytenuts_set_status(STATUS_CHEERIOS, "locked");
+batch_cleanup:
+    for (int i = 0; i < n_paths; i++) {
+        if (fds[i])
+            fclose(fds[i]);
     }
+    free(fds);
 
-    if (lines_wrapped.lines)
-        free(lines_wrapped.lines);
-    if (lines_wrapped.line_lens)
-        free(lines_wrapped.line_lens);
+    return ret;
+}
+
+int
+cheerios_print_stats()
+{
+    cheerios_port_t *port = &cheerios.ports[cheerios.sel];
+    stats_report_t rep;
+    char a[16], b[16], c[16];
+    char st_line[256];
+    int len = 0;
+    size_t backlog = 0, dropped = 0;
+    uint64_t bridge_dropped;
+    int clients;
+
+    sprintf(st_line, "output line count: %d\r\n", port->lines.store.n_lines);
+    cheerios_insert(st_line, strlen(st_line));
+
+    pthread_mutex_lock(&cheerios.lock);
+    sprintf(
+        st_line, "output lines in memory: %d (%zuKB), %d spilled to disk\r\n",
+        port->lines.store.n_lines - port->lines.store.line0,
+        port->lines.store.mem / 1024,
+        port->lines.store.line0
+    );
+    if (cheerios.logger) {
+        backlog = logger_backlog(cheerios.logger);
+        dropped = logger_dropped(cheerios.logger);
+    }
+    pthread_mutex_unlock(&cheerios.lock);
+    cheerios_insert(st_line, strlen(st_line));
+
+    stats_report(&rep);
+
+    sprintf(
+        st_line, "rx: %s, %s/s now, %s/s avg\r\n",
+        stats_fmt_bytes(a, sizeof(a), rep.rx_bytes),
+        stats_fmt_bytes(b, sizeof(b), rep.rx_now),
+        stats_fmt_bytes(c, sizeof(c), rep.rx_avg)
+    );
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(
+        st_line, "tx: %s, %s/s now, %s/s avg\r\n",
+        stats_fmt_bytes(a, sizeof(a), rep.tx_bytes),
+        stats_fmt_bytes(b, sizeof(b), rep.tx_now),
+        stats_fmt_bytes(c, sizeof(c), rep.tx_avg)
+    );
+    cheerios_insert(st_line, strlen(st_line));
+
+    /* only the sizes that showed up */
+    len = sprintf(st_line, "read sizes:");
+    for (int i = 0; i < STATS_READ_BUCKETS; i++) {
+        if (rep.reads[i] == 0)
+            continue;
+
+        if (i == STATS_READ_BUCKETS - 1)
+            len += sprintf(&st_line[len], " %d+:%llu", 1 << i, (unsigned long long)rep.reads[i]);
+        else
+            len += sprintf(
+                &st_line[len], " %d-%d:%llu",
+                1 << i, (2 << i) - 1, (unsigned long long)rep.reads[i]
+            );
+    }
+    sprintf(&st_line[len], "\r\n");
+    cheerios_insert(st_line, strlen(st_line));
+
+    sprintf(
+        st_line, "render: %.1f frames/s, %.2fms avg frame, %llu frames\r\n",
+        rep.fps, rep.frame_ms, (unsigned long long)rep.frames
+    );
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(
+        st_line,
+        "lock waits: reader %.1fms, render %.1fms, render term_lock %.1fms\r\n",
+        rep.lock_ms[STATS_LOCK_RX],
+        rep.lock_ms[STATS_LOCK_RENDER],
+        rep.lock_ms[STATS_LOCK_TERM]
+    );
+    cheerios_insert(st_line, strlen(st_line));
+    sprintf(
+        st_line, "log backlog: %s, %s dropped\r\n",
+        stats_fmt_bytes(a, sizeof(a), backlog),
+        stats_fmt_bytes(b, sizeof(b), dropped)
+    );
+    cheerios_insert(st_line, strlen(st_line));
+
+    if (bridge_report(&clients, &bridge_dropped) == 0) {
+        sprintf(
+            st_line, "bridge: %d clients, %s dropped\r\n",
+            clients, stats_fmt_bytes(a, sizeof(a), bridge_dropped)
+        );
+        cheerios_insert(st_line, strlen(st_line));
+    }
+
+    return 0;
+}
+
+int
+cheerios_toggle_stats_bar()
+{
+    cheerios.stats_bar = !cheerios.stats_bar;
+    update_stats_bar();
+
+    return 0;
+}
+
+int
+cheerios_toggle_gutter()
+{
+    pthread_mutex_lock(&cheerios.lock);
+    cheerios.gutter = (cheerios.gutter + 1) % CHEERIOS_GUTTER_MODES;
+    redraw_all();
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return 0;
+}
+
+int
+cheerios_toggle_gutter_us()
+{
+    pthread_mutex_lock(&cheerios.lock);
+    cheerios.gutter_us = !cheerios.gutter_us;
+    redraw_all();
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return 0;
+}
+
+int
+cheerios_select_next()
+{
+    int sel;
+
+    pthread_mutex_lock(&cheerios.lock);
+    cheerios.sel = (cheerios.sel + 1) % cheerios.n_ports;
+    sel = cheerios.sel;
+    /* the titles show which port is selected */
+    redraw_all();
+    cheerios.frame_scrolling = -1;
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return sel;
+}
+
+const char *
+cheerios_port_name()
+{
+    return cheerios.ports[cheerios.sel].name;
+}
+
+int
+cheerios_getmaxy()
+{
+    int y, x;
+    getmaxyx(cheerios.ports[cheerios.sel].output, y, x);
+    (void)x;
+    return y;
+}
+
+int
+cheerios_getmaxx()
+{
+    int y, x;
+    getmaxyx(cheerios.ports[cheerios.sel].output, y, x);
+    (void)y;
+    return x;
+}
+
+int
+cheerios_set_window(WINDOW *win)
+{
+    pthread_mutex_lock(&cheerios.lock);
+
+    pthread_mutex_lock(cheerios.term_lock);
+    delwin(cheerios.output);
+    cheerios.output = win;
+    layout();
+    pthread_mutex_unlock(cheerios.term_lock);
+    redraw_all();
+
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return 0;
+}
+
+int
+cheerios_redraw()
+{
+    pthread_mutex_lock(&cheerios.lock);
+
+    pthread_mutex_lock(cheerios.term_lock);
+    layout();
+    pthread_mutex_unlock(cheerios.term_lock);
+    redraw_all();
+
+    pthread_mutex_unlock(&cheerios.lock);
+
+    return 0;
+}
+
+#ifdef __MINGW32__
+static void *
+cheerios_thread(void *arg)
+{
+    char buf[1024];
+    ssize_t read_ret = 0;
+
+    while (cheerios.running) {
+        stats_lock(&cheerios.lock, STATS_LOCK_RX);
+
+        for (int i = 0; i < cheerios.n_ports; i++) {
+            cheerios_port_t *port = &cheerios.ports[i];
+
+            if (port->paused)
+                continue;
+
+            read_ret = serial_read(port->ser_fd, buf, sizeof(buf));
+            if (read_ret > 0) {
+                stats_rx(read_ret);
+                capture_rx(i, buf, read_ret);
+                if (i == 0)
+                    bridge_rx(buf, read_ret);
+                insert_buf(port, buf, read_ret);
+            }
+        }
+
+        pthread_mutex_unlock(&cheerios.lock);
+        nanosleep(&(struct timespec){ 0, 100000 }, NULL);
+    }
+
+    cheerios_cleanup();
+
+    pthread_exit(NULL);
+    return NULL;
+}
+#else
+/* reads every port from one epoll set, the event data being the index of the
+ * port or WAKE_ID */
+static void *
+cheerios_thread(void *arg)
+{
+    char buf[1024];
+    struct epoll_event evs[BYTENUTS_MAX_PORTS + 1];
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.u32 = WAKE_ID };
+    int ep = epoll_create1(0);
+
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, wakeup_fd(&cheerios.wake), &wake_ev))
+        cheerios.running = 0;
+
+    while (cheerios.running) {
+        int to_ms = watch_ports(ep);
+        int n = epoll_wait(ep, evs, BYTENUTS_MAX_PORTS + 1, to_ms);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int idx = evs[i].data.u32;
+            cheerios_port_t *port;
+            ssize_t read_ret = 1;
+
+            if (idx == WAKE_ID) {
+                wakeup_drain(&cheerios.wake);
+                continue;
+            }
+
+            port = &cheerios.ports[idx];
+            stats_lock(&cheerios.lock, STATS_LOCK_RX);
+
+            /* the port may have been paused while we were in epoll */
+            if (!port->paused) {
+                read_ret = read(port->ser_fd, buf, sizeof(buf));
+                if (read_ret > 0) {
+                    stats_rx(read_ret);
+                    capture_rx(idx, buf, read_ret);
+                    if (idx == 0)
+                        bridge_rx(buf, read_ret);
+                    insert_buf(port, buf, read_ret);
+                }
+            }
+
+            pthread_mutex_unlock(&cheerios.lock);
+
+            /* a hung up port (e.g. a PTY nobody opened yet) polls readable
+             * forever, so it sits out for a while rather than spinning */
+            if (read_ret == 0 || (read_ret < 0 && errno != EAGAIN && errno != EINTR)) {
+                epoll_ctl(ep, EPOLL_CTL_DEL, port->ser_fd, NULL);
+                port->watched = 0;
+                port->park_ns = stats_now_ns() + PARK_NS;
+            }
+        }
+    }
+
+    if (ep >= 0)
+        close(ep);
+
+    cheerios_cleanup();
+
+    pthread_exit(NULL);
+    return NULL;
+}
+
+/* bring the epoll set in line with the ports, a paused port is left out so
+ * xmodem owns it. Returns how long to wait for before a port that sits out is
+ * due back, -1 for as long as it takes. */
+static int
+watch_ports(int ep)
+{
+    uint64_t now = stats_now_ns();
+    int to_ms = -1;
+
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        cheerios_port_t *port = &cheerios.ports[i];
+        int want = !port->paused && now >= port->park_ns;
+
+        if (want && !port->watched) {
+            struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+
+            port->watched = !epoll_ctl(ep, EPOLL_CTL_ADD, port->ser_fd, &ev);
+            if (!port->watched)
+                port->park_ns = now + PARK_NS;
+        }
+        else if (!want && port->watched) {
+            epoll_ctl(ep, EPOLL_CTL_DEL, port->ser_fd, NULL);
+            port->watched = 0;
+        }
+
+        if (!port->paused && port->park_ns > now) {
+            int ms = (port->park_ns - now + 999999) / 1000000;
+
+            if (to_ms < 0 || ms < to_ms)
+                to_ms = ms;
+        }
+    }
+
+    return to_ms;
+}
+#endif /* __MINGW32__ */
+
+#ifdef __MINGW32__
+static void *
+tx_thread(void *arg)
+{
+    while (cheerios.running) {
+        int sent = 0;
+
+        for (int i = 0; i < cheerios.n_ports; i++) {
+            cheerios_port_t *port = &cheerios.ports[i];
+            const uint8_t *buf;
+            size_t len = ring_peek(&port->txq, &buf);
+            ssize_t ret = 0;
+            int paused = port->paused;
+
+            /* cheerios_pause waits to hear that we keep off the port */
+            port->tx_stopped = paused;
+            if (len > 0 && !paused)
+                ret = serial_write(port->ser_fd, buf, len);
+
+            if (ret > 0) {
+                stats_tx(ret);
+                capture_tx(i, buf, ret);
+                ring_consume(&port->txq, ret);
+                sent = 1;
+            }
+        }
+
+        if (!sent)
+            nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+
+    pthread_exit(NULL);
+    return NULL;
+}
+#else
+/* writes queued input to the devices as fast as they take it, waiting for
+ * POLLOUT rather than spinning on a full fd */
+static void *
+tx_thread(void *arg)
+{
+    while (cheerios.running) {
+        struct pollfd fds[BYTENUTS_MAX_PORTS + 1];
+        int ids[BYTENUTS_MAX_PORTS + 1];
+        int nfds = 1;
+        int hung = 0;
+
+        fds[0].fd = wakeup_fd(&cheerios.tx_wake);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        for (int i = 0; i < cheerios.n_ports; i++) {
+            int paused = cheerios.ports[i].paused;
+
+            /* cheerios_pause waits to hear that we keep off the port, which
+             * holds once it is out of the poll set */
+            cheerios.ports[i].tx_stopped = paused;
+            if (paused || ring_used(&cheerios.ports[i].txq) == 0)
+                continue;
+
+            fds[nfds].fd = cheerios.ports[i].ser_fd;
+            fds[nfds].events = POLLOUT;
+            fds[nfds].revents = 0;
+            ids[nfds] = i;
+            nfds++;
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+            wakeup_drain(&cheerios.tx_wake);
+
+        for (int j = 1; j < nfds; j++) {
+            cheerios_port_t *port = &cheerios.ports[ids[j]];
+            const uint8_t *buf;
+            size_t len;
+            ssize_t ret;
+
+            /* the port may have been paused while we were in poll */
+            if (fds[j].revents == 0 || port->paused)
+                continue;
+
+            /* partial writes just leave the rest queued */
+            len = ring_peek(&port->txq, &buf);
+            ret = write(port->ser_fd, buf, len);
+            if (ret > 0) {
+                stats_tx(ret);
+                capture_tx(ids[j], buf, ret);
+                ring_consume(&port->txq, ret);
+            }
+            else if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+                hung = 1;
+            }
+        }
+
+        /* a hung up port polls writable forever, back off */
+        if (hung) {
+            fds[0].revents = 0;
+            poll(fds, 1, 100);
+            if (fds[0].revents & POLLIN)
+                wakeup_drain(&cheerios.tx_wake);
+        }
+    }
+
+    pthread_exit(NULL);
+    return NULL;
+}
+#endif /* __MINGW32__ */
+
+/* wait up to to_ms for the writer to send everything queued */
+static int
+tx_flush(cheerios_port_t *port, int to_ms)
+{
+    for (int i = 0; i < to_ms && ring_used(&port->txq) > 0; i++) {
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+
+    return ring_used(&port->txq) > 0 ? -1 : 0;
+}
+
+/* redraws the output window at most config->fps times a second, so bursts of
+ * input get coalesced into a single frame. Also ticks the stats once a
+ * second. */
+static void *
+render_thread(void *arg)
+{
+    struct timespec period = { 0 };
+    struct timespec next = { 0 };
+    struct timespec tick;
+    long period_ns = 1000000000L / cheerios.config->fps;
+
+    period.tv_sec = period_ns / 1000000000L;
+    period.tv_nsec = period_ns % 1000000000L;
+
+    clock_gettime(CLOCK_MONOTONIC, &tick);
+    timer_add_ms(&tick, 1000);
+
+    while (cheerios.running) {
+        struct timespec now;
+        struct timespec tick_left;
+        int to_ms, frame_ms;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timer_cmp(&now, &tick) >= 0) {
+            stats_tick();
+            update_stats_bar();
+
+            tick = now;
+            timer_add_ms(&tick, 1000);
+        }
+
+        tick_left = tick;
+        timer_sub(&tick_left, &now);
+        to_ms = tick_left.tv_sec * 1000 + (tick_left.tv_nsec + 999999) / 1000000;
+
+        if (cheerios.dirty) {
+            if (timer_cmp(&now, &next) >= 0) {
+                render_frame();
+
+                next = now;
+                timer_add(&next, &period);
+                continue;
+            }
+
+            /* too soon, wait for the rest of the frame period */
+            timer_sub(&next, &now);
+            frame_ms = next.tv_sec * 1000 + (next.tv_nsec + 999999) / 1000000;
+            if (frame_ms < to_ms)
+                to_ms = frame_ms;
+            timer_add(&next, &now);
+        }
+
+#ifdef __MINGW32__
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+#else
+        struct pollfd pfd = {
+            .fd = wakeup_fd(&cheerios.render_wake),
+            .events = POLLIN,
+        };
+
+        if (poll(&pfd, 1, to_ms) > 0)
+            wakeup_drain(&cheerios.render_wake);
+#endif
+    }
+
+    pthread_exit(NULL);
+    return NULL;
+}
+
+/* put the live stats in the status bar, or clear them. A log that could not
+ * keep up gets a warning there either way. */
+static void
+update_stats_bar()
+{
+    stats_report_t rep;
+    char rx[16], tx[16], mem[16], lost[16];
+    char warn[48] = "";
+    size_t backlog = 0, dropped = 0;
+    size_t lines_mem = 0;
+
+    pthread_mutex_lock(&cheerios.lock);
+    if (cheerios.logger) {
+        backlog = logger_backlog(cheerios.logger);
+        dropped = logger_dropped(cheerios.logger);
+    }
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        lines_mem += cheerios.ports[i].lines.store.mem;
+    }
+    stats_fmt_bytes(mem, sizeof(mem), lines_mem);
+    pthread_mutex_unlock(&cheerios.lock);
+
+    if (dropped) {
+        snprintf(
+            warn, sizeof(warn), "LOG DROPPED %s",
+            stats_fmt_bytes(lost, sizeof(lost), dropped)
+        );
+    }
+
+    if (!cheerios.stats_bar) {
+        bytenuts_set_status(STATUS_STATS, "%s", warn);
+        return;
+    }
+
+    stats_report(&rep);
+
+    bytenuts_set_status(
+        STATUS_STATS, "rx %s/s tx %s/s %.0ffps %.1fms log %zuK mem %s%s%s",
+        stats_fmt_bytes(rx, sizeof(rx), rep.rx_now),
+        stats_fmt_bytes(tx, sizeof(tx), rep.tx_now),
+        rep.fps, rep.frame_ms, backlog / 1024, mem, dropped ? " " : "", warn
+    );
+}
+
+/* flag the lines of a port as needing a redraw, must hold cheerios.lock */
+static void
+mark_dirty(cheerios_port_t *port)
+{
+    port->dirty = 1;
+    if (!cheerios.dirty) {
+        cheerios.dirty = 1;
+        wakeup_signal(&cheerios.render_wake);
+    }
+}
+
+/* repaint every pane with the next frame, must hold cheerios.lock */
+static void
+redraw_all()
+{
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        cheerios.ports[i].redraw = 1;
+        mark_dirty(&cheerios.ports[i]);
+    }
+}
+
+/* tile the panes over cheerios.output, each with a title row above its
+ * output. The panes are laid out in rows, about as many rows as panes per
+ * row, and the last rows get one pane less when they do not divide evenly.
+ * A single port just gets cheerios.output. Must hold term_lock once the
+ * threads are running. */
+static void
+layout()
+{
+    int top, left, height, width;
+    int n = cheerios.n_ports;
+    int n_rows = 1;
+
+    if (n == 1) {
+        cheerios.ports[0].output = cheerios.output;
+        /* lets ncurses scroll with the terminal's scroll region while
+         * tailing */
+        idlok(cheerios.output, TRUE);
+        return;
+    }
+
+    getbegyx(cheerios.output, top, left);
+    getmaxyx(cheerios.output, height, width);
+
+    while (n_rows * n_rows < n) {
+        n_rows++;
+    }
+
+    for (int r = 0, i = 0; r < n_rows; r++) {
+        int n_cols = n / n_rows + (r < n % n_rows);
+        int y = top + height * r / n_rows;
+        int h = top + height * (r + 1) / n_rows - y;
+
+        for (int c = 0; c < n_cols; c++, i++) {
+            cheerios_port_t *port = &cheerios.ports[i];
+            int x = left + width * c / n_cols;
+            int w = left + width * (c + 1) / n_cols - x;
+
+            /* a blank column between panes side by side */
+            if (c < n_cols - 1)
+                w--;
+
+            place(&port->title, y, x, 1, w);
+            place(&port->output, y + 1, x, h - 1, w);
+            if (port->output)
+                idlok(port->output, TRUE);
+        }
+    }
+}
+
+/* create win at the given spot, or move it there. A window that does not fit
+ * on the screen stays where it was, or NULL if it is new. */
+static void
+place(WINDOW **win, int y, int x, int height, int width)
+{
+    if (height < 1 || width < 1)
+        return;
+
+    if (!*win) {
+        *win = newwin(height, width, y, x);
+        return;
+    }
+
+    /* shrink first so it never hangs off the screen on the way */
+    wresize(*win, 1, 1);
+    mvwin(*win, y, x);
+    wresize(*win, height, width);
+}
+
+/* path the scrollback of a port is saved to, without the extensions */
+static char *
+scrollback_file(int port)
+{
+    if (port == 0)
+        return strdup(cheerios.scrollback_path);
+
+    return bstr_print(strdup(cheerios.scrollback_path), "%d", port);
+}
+
+/* remove the spill files of instances that died without cleaning up, they
+ * are named scrollback.<pid>.* */
+static void
+sweep_spills()
+{
+#ifndef __MINGW32__
+    char *dir = paths_bnconf_dir();
+    DIR *dp = dir ? opendir(dir) : NULL;
+    struct dirent *ent;
+
+    while (dp && (ent = readdir(dp))) {
+        const char *p = ent->d_name;
+        char *end;
+        long long pid;
+
+        if (strncmp(p, "scrollback.", 11) || p[11] < '0' || p[11] > '9')
+            continue;
+
+        pid = strtoll(&p[11], &end, 10);
+        if (*end != '.' || pid == getpid())
+            continue;
+
+        if (kill(pid, 0) && errno == ESRCH) {
+            char *path = paths_append(strdup(dir), p);
+
+            unlink(path);
+            free(path);
+        }
+    }
+
+    if (dp)
+        closedir(dp);
+    free(dir);
+#endif
+}
+
+static void
+cheerios_cleanup()
+{
+    /* flushes whatever is still queued, lines held back included */
+    pthread_mutex_lock(&cheerios.lock);
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        cheerios_port_t *port = &cheerios.ports[i];
+
+        if (port->log_len > 0 && cheerios.logger)
+            logger_write(cheerios.logger, port->log_buf, port->log_len);
+        free(port->log_buf);
+        port->log_buf = NULL;
+        port->log_len = 0;
+    }
+    logger_destroy(cheerios.logger);
+    cheerios.logger = NULL;
+    pthread_mutex_unlock(&cheerios.lock);
+
+    if (cheerios.backup_filename) {
+        char *out_filename;
+        int out_filename_len;
+        char *home = getenv("HOME");
+
+        /* do not chdir as other threads can still be running */
+        out_filename_len = snprintf(
+            NULL, 0,
+            "%s/.config/bytenuts/outbuf.log",
+            home
+        );
+        out_filename = calloc(1, out_filename_len + 1);
+        snprintf(
+            out_filename, out_filename_len + 1,
+            "%s/.config/bytenuts/outbuf.log",
+            home
+        );
+
+        /* move this processes log to the path that can be loaded on resumption */
+        logger_move(cheerios.backup_filename, out_filename);
+
+        free(out_filename);
+        free(cheerios.backup_filename);
+    }
+}
+
+static int
+insert_buf(cheerios_port_t *port, const char *buf, size_t len)
+{
+    line_buffer_t *lines = &port->lines;
+    int nfiles = logger_nfiles(cheerios.logger);
+    int log = nfiles && !port->paused && !cheerios.quiet;
+    int stamp = nfiles && !cheerios.quiet &&
+        (cheerios.config->time_fmt || cheerios.n_ports > 1);
+    size_t logged = 0;
+    size_t i = 0;
+
+    cheerios.line_ns = cheerios.quiet ? 0 : wall_ns();
+
+    if (lines->store.n_lines == 0)
+        newline(port, stamp);
+    /* a line gets the time its first byte came in */
+    else if (lines_len(&lines->store, lines->store.n_lines - 1) == 0)
+        lines_set_time(&lines->store, cheerios.line_ns);
+
+    while (i < len) {
+        size_t run;
+
+        /* finish a sequence split by the last read */
+        if (lines->ansi.state != ANSI_GROUND) {
+            i += ansi_parse(&lines->ansi, &buf[i], len - i);
+            continue;
+        }
+
+        /* printable runs go into the line in one write */
+        run = i + scan_ctrl(&buf[i], len - i);
+        if (run > i)
+            put_text(lines, &buf[i], run - i);
+
+        if (run == len)
+            break;
+
+        /* escape sequences are parsed here and never stored */
+        if (buf[run] == '\e') {
+            i = run + ansi_parse(&lines->ansi, &buf[run], len - run);
+            continue;
+        }
+
+        /* line feed starts a new row */
+        if (buf[run] == '\n') {
+            if (log) {
+                log_text(port, &buf[logged], run + 1 - logged);
+                port->log_done = port->log_len;
+                logged = run + 1;
+            }
+            newline(port, stamp);
+        }
+        /* carriage return just sets pos to 0 */
+        else if (buf[run] == '\r') {
+            lines->pos = 0;
+        }
+        /* tabs become spaces so every stored byte is one column */
+        else if (buf[run] == '\t') {
+            put_text(lines, "        ", 8 - (lines->pos % 8));
+        }
+        else if (buf[run] == '\b') {
+            if (lines->pos > 0)
+                lines->pos--;
+        }
+        /* the rest (bell, NUL, ...) have nothing to show */
+
+        i = run + 1;
+    }
+
+    if (log)
+        log_text(port, &buf[logged], len - logged);
+
+    /* the chunk goes to the logger in one piece. Ports sharing the log only
+     * hand over whole lines so theirs never get mixed up. */
+    if (cheerios.n_ports == 1 || port->log_len > LOG_HOLD_MAX)
+        port->log_done = port->log_len;
+    if (port->log_done > 0) {
+        logger_write(cheerios.logger, port->log_buf, port->log_done);
+        port->log_len -= port->log_done;
+        memmove(port->log_buf, &port->log_buf[port->log_done], port->log_len);
+        port->log_done = 0;
+    }
+
+    mark_dirty(port);
+    return 0;
+}
+
+/* draw the panes of the ports that changed */
+static void
+render_frame()
+{
+    uint64_t start = stats_now_ns();
+
+    pthread_mutex_lock(&cheerios.lock);
+    cheerios.dirty = 0;
+    pthread_mutex_unlock(&cheerios.lock);
+
+    for (int i = 0; i < cheerios.n_ports; i++) {
+        cheerios_port_t *port = &cheerios.ports[i];
+        int height, width;
+
+        if (!port->dirty || !port->output)
+            continue;
+
+        stats_lock(cheerios.term_lock, STATS_LOCK_TERM);
+        getmaxyx(port->output, height, width);
+        pthread_mutex_unlock(cheerios.term_lock);
+
+        /* only copying happens under the lock, ncurses never blocks the
+         * reader */
+        stats_lock(&cheerios.lock, STATS_LOCK_RENDER);
+        port->dirty = 0;
+        snapshot_lines(port, height, width);
+        pthread_mutex_unlock(&cheerios.lock);
+
+        draw_frame(port, height);
+    }
+
+    stats_frame(stats_now_ns() - start);
+}
+
+/* copy the wrapped rows that are visible in a height x width window into
+ * port->frame, must hold cheerios.lock. When the window was following the
+ * output and still is, only the rows from the old last line down are copied
+ * as everything above them just moved up. */
+static int
+snapshot_lines(cheerios_port_t *port, int height, int width)
+{
+    line_buffer_t *lines = &port->lines;
+    frame_t *frame = &port->frame;
+    filter_t *flt = port->filtering ? &port->filter : NULL;
+    int row = lines->bot;
+    int max_rows = height;
+    long last_row = 0;
+    size_t used = 0;
+    int gw;
+
+    if (height <= 0 || width <= 0) {
+        frame->n_rows = 0;
+        return 0;
+    }
+
+    /* the gutter takes its columns from the text */
+    gw = gutter_width(width);
+    width -= gw;
+    frame->gutter_w = gw;
+    if (frame->gutter_sz < (size_t)height * gw) {
+        frame->gutter_sz = (size_t)height * gw;
+        frame->gutter = realloc(frame->gutter, frame->gutter_sz);
+    }
+
+    /* at most a window's worth of rows and bytes ever get copied */
+    if (frame->cap < height) {
+        frame->cap = height;
+        frame->rows = realloc(frame->rows, sizeof(uint8_t *) * height);
+        frame->row_lens = realloc(frame->row_lens, sizeof(int) * height);
+        frame->row_runs = realloc(frame->row_runs, sizeof(int) * height);
+        frame->row_n_runs = realloc(frame->row_n_runs, sizeof(int) * height);
+    }
+    if (frame->buf_sz < (size_t)height * width) {
+        frame->buf_sz = (size_t)height * width;
+        frame->buf = realloc(frame->buf, frame->buf_sz);
+    }
+
+    /* keep the wrap index current so scrolling never has to catch up */
+    wrap_sync(&lines->wrap, &lines->store, width);
+
+    /* the last line is not finished, so it is not tested yet */
+    if (filter_sync(&port->filter, &lines->store, lines->store.n_lines - 1, FILTER_BATCH))
+        mark_dirty(port);
+
+    if (lines->store.n_lines > 0)
+        last_row = wrap_row_of(&lines->wrap, &lines->store, lines->store.n_lines - 1);
+
+    frame->full = 1;
+    frame->scroll = 0;
+
+    if (
+        !port->redraw && !flt &&
+        lines->bot < 0 && frame->bot < 0 &&
+        height == port->frame_height && width == port->frame_width &&
+        lines->wrap.total >= port->frame_total
+    ) {
+        long damaged = lines->wrap.total - port->frame_last;
+
+        if (damaged < height) {
+            frame->full = 0;
+            frame->scroll = lines->wrap.total - port->frame_total;
+            max_rows = damaged;
+        }
+    }
+
+    port->redraw = 0;
+    port->frame_total = lines->wrap.total;
+    port->frame_last = last_row;
+    port->frame_height = height;
+    port->frame_width = width;
+
+    frame->n_rows = 0;
+    frame->n_runs = 0;
+    frame->bot = flt ? lines->fbot : lines->bot;
+    frame->filtered = flt != NULL;
+
+    /* while filtering, row walks the matches instead of the lines */
+    if (flt)
+        row = lines->fbot < 0 ? flt->n_matches - 1 : lines->fbot;
+    else if (row < 0)
+        row = lines->store.n_lines - 1;
+
+    for (int first = 1; row >= 0 && frame->n_rows < max_rows; first = 0) {
+        int idx = flt ? flt->matches[row] : row;
+        int len, n_runs;
+        const lines_run_t *runs;
+        const uint8_t *line = lines_get_runs(
+            &lines->store, idx, &len, &runs, &n_runs
+        );
+        int n_split = wrap_rows(len, width) - 1;
+        uint64_t t = 0, prev = 0;
+
+        /* the last line has no time until its first byte comes in */
+        if (gw && (len > 0 || idx < lines->store.n_lines - 1)) {
+            t = lines_time(&lines->store, idx);
+            if (cheerios.gutter == CHEERIOS_GUTTER_DELTA && idx > 0)
+                prev = lines_time(&lines->store, idx - 1);
+        }
+
+        /* the last line has no runs stored yet */
+        if (idx == lines->store.n_lines - 1) {
+            runs = lines->runs;
+            n_runs = line_runs(lines, len);
+        }
+        if (!cheerios.config->colors)
+            n_runs = 0;
+        if (idx == port->hit_line) {
+            n_runs = highlight_runs(
+                frame, runs, n_runs,
+                port->hit_col, port->hit_col + port->search_len
+            );
+            runs = frame->hl_runs;
+        }
+
+        /* rows of the bottom line below bot_sub are out of view */
+        if (first && !flt && lines->bot >= 0 && lines->bot_sub < n_split)
+            n_split = lines->bot_sub;
+
+        /* the rows of a line get stored bottom up, like the lines */
+        for (int i = n_split; i >= 0 && frame->n_rows < max_rows; i--) {
+            int row_len = len - i * width;
+
+            if (row_len > width)
+                row_len = width;
+            if (row_len > 0)
+                memcpy(&frame->buf[used], &line[i * width], row_len);
+
+            snapshot_runs(frame, runs, n_runs, i * width, i * width + row_len);
+
+            /* only the first row of a line gets a stamp */
+            if (gw) {
+                char *g = &frame->gutter[(size_t)frame->n_rows * gw];
+
+                if (i == 0)
+                    put_gutter(g, gw, t, prev);
+                else
+                    memset(g, ' ', gw);
+            }
+
+            frame->rows[frame->n_rows] = &frame->buf[used];
+            frame->row_lens[frame->n_rows] = row_len;
+            frame->n_rows++;
+            used += row_len;
+        }
+
+        row--;
+    }
 
     return 0;
 }
 
+/* copy the runs covering columns start to end of a line into the frame as
+ * the runs of row frame->n_rows */
+static void
+snapshot_runs(
+    frame_t *frame,
+    const lines_run_t *runs,
+    int n_runs,
+    int start,
+    int end
+)
+{
+    uint32_t attr = 0;
+    int i = 0;
+
+    frame->row_runs[frame->n_rows] = frame->n_runs;
+
+    /* a row can have at most one run per column plus the one it starts in */
+    if (frame->n_runs + (end - start) + 1 > frame->runs_cap) {
+        frame->runs_cap = (frame->n_runs + (end - start) + 1) * 2;
+        frame->runs = realloc(frame->runs, sizeof(lines_run_t) * frame->runs_cap);
+    }
+
+    /* the attribute the row starts with */
+    for (; i < n_runs && runs[i].col <= (uint32_t)start; i++) {
+        attr = runs[i].attr;
+    }
+    if (attr) {
+        frame->runs[frame->n_runs].col = 0;
+        frame->runs[frame->n_runs].attr = attr;
+        frame->n_runs++;
+    }
+
+    for (; i < n_runs && runs[i].col < (uint32_t)end; i++) {
+        frame->runs[frame->n_runs].col = runs[i].col - start;
+        frame->runs[frame->n_runs].attr = runs[i].attr;
+        frame->n_runs++;
+    }
+
+    frame->row_n_runs[frame->n_rows] = frame->n_runs - frame->row_runs[frame->n_rows];
+}
+
+/* copy runs into frame->hl_runs with columns start to end flipped to
+ * reverse video, returns the number of runs */
 static int
-handle_color(line_buffer_t *lines, int line_idx, int *pos, int apply)
+highlight_runs(
+    frame_t *frame,
+    const lines_run_t *runs,
+    int n_runs,
+    int start,
+    int end
+)
 {
-    short fg, bg = -1;
-    int enable = -1;
-    int p = *pos;
-    uint8_t *line = lines->lines[line_idx];
-    int line_len = lines->line_lens[line_idx];
+    lines_run_t *hl;
+    uint32_t attr = 0;
+    int i = 0, n = 0;
 
-    if (!cheerios.config->colors)
-        return 0;
+    if (n_runs + 2 > frame->hl_cap) {
+        frame->hl_cap = (n_runs + 2) * 2;
+        frame->hl_runs = realloc(frame->hl_runs, sizeof(lines_run_t) * frame->hl_cap);
+    }
+    hl = frame->hl_runs;
 
-    while (p < line_len) {
-        int fit_col = (p + 7) <= line_len;
-        int fit_en = (p + 4) <= line_len;
+    for (; i < n_runs && runs[i].col < (uint32_t)start; i++) {
+        attr = runs[i].attr;
+        hl[n++] = runs[i];
+    }
 
-        /* fg or bg color */
-        if (
-            fit_col &&
-            (
-                !memcmp(&line[p], "\e[38;5;", 7) ||
-                !memcmp(&line[p], "\e[48;5;", 7)
-            )
-        ) {
-            char col_str[4] = { 0 };
-            short *col = line[p + 2] == '3' ? &fg : &bg;
+    /* the attribute at start, unless a run begins right there */
+    if (i < n_runs && runs[i].col == (uint32_t)start)
+        attr = runs[i++].attr;
 
-            p += 7;
-            if (p >= line_len)
-                break;
+    hl[n].col = start;
+    hl[n].attr = attr ^ ANSI_REVERSE;
+    n++;
 
-            for (int i = 0; i < 3; i++) {
-                if (line[p] == 'm') {
-                    break;
-                }
-                else if (line[p] < '0' || line[p] > '9') {
-                    col_str[0] = '\0';
-                    break;
-                }
+    /* runs starting within the hit get flipped too */
+    for (; i < n_runs && runs[i].col < (uint32_t)end; i++) {
+        attr = runs[i].attr;
+        hl[n].col = runs[i].col;
+        hl[n].attr = attr ^ ANSI_REVERSE;
+        n++;
+    }
 
-                col_str[i] = line[p];
-                p++;
-            }
+    /* back to the attribute the line has after the hit */
+    if (i == n_runs || runs[i].col > (uint32_t)end) {
+        hl[n].col = end;
+        hl[n].attr = attr;
+        n++;
+    }
 
-            if (col_str[0] == '\0')
-                break;
+    for (; i < n_runs; i++) {
+        hl[n++] = runs[i];
+    }
 
-            *col = strtol(col_str, NULL, 10);
-            p++;
-        }
-        /* enable our color */
-        else if (fit_en && !memcmp(&line[p], "\e[1m", 4)) {
-            p += 4;
-            enable = 1;
-            break;
+    return n;
+}
+
+/* the next hit of the search on the line of the last one, right of it when
+ * dir > 0 and left of it otherwise, must hold cheerios.lock */
+static int
+next_on_line(cheerios_port_t *port, int dir, int *col)
+{
+    int len;
+    const uint8_t *buf = lines_get(&port->lines.store, port->hit_line, &len);
+
+    if (!buf)
+        return -1;
+
+    for (
+        int i = port->hit_col + (dir > 0 ? 1 : -1);
+        i >= 0 && i + port->search_len <= len;
+        i += dir > 0 ? 1 : -1
+    ) {
+        if (!memcmp(&buf[i], port->search, port->search_len)) {
+            *col = i;
+            return 0;
         }
-        /* disable our color */
-        else if (fit_en && !memcmp(&line[p], "\e[0m", 4)) {
-            p += 4;
-            enable = 0;
-            break;
+    }
+
+    return -1;
+}
+
+/* draw port->frame to the output window */
+static int
+draw_frame(cheerios_port_t *port, int height)
+{
+    frame_t *frame = &port->frame;
+    int scrolling = frame->bot < 0;
+    int state = scrolling | (frame->filtered << 1);
+
+    stats_lock(cheerios.term_lock, STATS_LOCK_TERM);
+
+    curs_set(0);
+
+    if (frame->full) {
+        werase(port->output);
+        if (port->title)
+            draw_title(port);
+    }
+    else if (frame->scroll > 0) {
+        /* only while scrolling, or a full bottom row would scroll too */
+        scrollok(port->output, TRUE);
+        wscrl(port->output, frame->scroll);
+        scrollok(port->output, FALSE);
+    }
+
+    for (int row = 0; row < frame->n_rows && row < height; row++) {
+        const lines_run_t *run = &frame->runs[frame->row_runs[row]];
+        const lines_run_t *run_end = run + frame->row_n_runs[row];
+
+        wmove(port->output, height - row - 1, 0);
+        if (!frame->full)
+            wclrtoeol(port->output);
+
+        if (frame->gutter_w) {
+            wattr_set(port->output, A_DIM, 0, NULL);
+            waddnstr(
+                port->output,
+                &frame->gutter[(size_t)row * frame->gutter_w], frame->gutter_w
+            );
+            set_attr(port->output, 0);
         }
-        /* this is not a color code */
-        else {
-            break;
+
+        for (int i = 0; i < frame->row_lens[row]; i++) {
+            if (run < run_end && run->col == (uint32_t)i) {
+                set_attr(port->output, run->attr);
+                run++;
+            }
+
+            waddch(port->output, frame->rows[row][i]);
         }
+
+        set_attr(port->output, 0);
+    }
+
+    curs_set(1);
+    wrefresh(port->output);
+
+    pthread_mutex_unlock(cheerios.term_lock);
+
+    /* the status bar is about the selected port */
+    if (port == &cheerios.ports[cheerios.sel] && state != cheerios.frame_scrolling) {
+        cheerios.frame_scrolling = state;
+        bytenuts_set_status(
+            STATUS_CHEERIOS, "%s%s",
+            frame->filtered ? "filtered, " : "",
+            scrolling ? "scrolling" : "locked"
+        );
+    }
+
+    return 0;
+}
+
+/* name the port in the title row of its pane, the selected one standing out,
+ * must hold term_lock */
+static void
+draw_title(cheerios_port_t *port)
+{
+    int width = getmaxx(port->title);
+    int sel = port == &cheerios.ports[cheerios.sel];
+
+    wattr_set(port->title, sel ? A_REVERSE : A_DIM, 0, NULL);
+    wmove(port->title, 0, 0);
+    for (int i = 0; i < width; i++) {
+        waddch(port->title, '-');
     }
+    mvwprintw(port->title, 0, 0, "--%s--", port->name);
+    wattr_set(port->title, A_NORMAL, 0, NULL);
+    wrefresh(port->title);
+}
+
+/* apply an ansi attribute to a window, must hold term_lock */
+static void
+set_attr(WINDOW *win, uint32_t attr)
+{
+    attr_t a = A_NORMAL;
 
-    if (!apply) {
-        *pos = p;
+    if (attr & ANSI_BOLD)
+        a |= A_BOLD;
+    if (attr & ANSI_UNDERLINE)
+        a |= A_UNDERLINE;
+    if (attr & ANSI_REVERSE)
+        a |= A_REVERSE;
+
+    wattr_set(win, a, color_pair(ANSI_FG(attr), ANSI_BG(attr)), NULL);
+}
+
+/* get the pair for a fg/bg combination, -1 being the default color. Pairs are
+ * set up the first time a combination shows up and kept until they run out. */
+static short
+color_pair(int fg, int bg)
+{
+    int max_pairs = COLOR_PAIRS < 32767 ? COLOR_PAIRS : 32767;
+    short *pair;
+
+    if ((fg < 0 && bg < 0) || !has_colors())
         return 0;
+
+    if (!cheerios.pairs) {
+        cheerios.pairs = calloc(257 * 257, sizeof(short));
+        cheerios.next_pair = 1;
     }
 
-    if (enable == 0) {
-        for (int i = 0; i < NCOLOR_PAIRS; i++) {
-            if (lines->enabled_pairs[i]) {
-                wattroff(cheerios.output, COLOR_PAIR(i + 1));
-                lines->enabled_pairs[i] = 0;
-            }
+    pair = &cheerios.pairs[(fg + 1) * 257 + (bg + 1)];
+    if (*pair)
+        return *pair;
+
+    /* out of pairs, start over. colors already on screen may change until
+     * the next frame redraws them. */
+    if (cheerios.next_pair >= max_pairs) {
+        memset(cheerios.pairs, 0, 257 * 257 * sizeof(short));
+        cheerios.next_pair = 1;
+    }
+
+    if (init_pair(cheerios.next_pair, term_color(fg), term_color(bg)) == ERR)
+        return 0;
+
+    *pair = cheerios.next_pair;
+    cheerios.next_pair++;
+
+    return *pair;
+}
+
+/* fit one of the 256 colors into what the terminal supports */
+static short
+term_color(int col)
+{
+    if (col < COLORS)
+        return col;
+
+    /* bright colors become the normal ones */
+    if (col < 16)
+        return col - 8;
+
+    /* gray ramp */
+    if (col >= 232)
+        return col < 244 ? COLOR_BLACK : COLOR_WHITE;
+
+    /* keep the channels of the color cube that are at least half on */
+    col -= 16;
+    return ((col / 36) >= 3 ? COLOR_RED : 0) |
+        (((col / 6) % 6) >= 3 ? COLOR_GREEN : 0) |
+        ((col % 6) >= 3 ? COLOR_BLUE : 0);
+}
+
+/* write text at the cursor with the current attribute */
+static void
+put_text(line_buffer_t *lines, const char *buf, int len)
+{
+    if (lines->pos + len > lines->attrs_cap) {
+        int cap = lines->attrs_cap ? lines->attrs_cap : 256;
+
+        while (cap < lines->pos + len) {
+            cap *= 2;
         }
+
+        lines->attrs = realloc(lines->attrs, sizeof(uint32_t) * cap);
+        lines->attrs_cap = cap;
     }
-    else if (enable == 1 && (fg >= 0 || bg >= 0)) {
-        int pair_pos = -1;
 
-        if (fg < 0)
-            fg = COLOR_WHITE;
-        if (bg < 0)
-            bg = COLOR_BLACK;
+    lines_write(&lines->store, lines->pos, buf, len);
 
-        for (int i = 0; i < NCOLOR_PAIRS; i++) {
-            if (lines->color_pairs[i].fg == fg && lines->color_pairs[i].bg == bg) {
-                pair_pos = i;
-                break;
-            }
+    for (int i = 0; i < len; i++) {
+        lines->attrs[lines->pos + i] = lines->ansi.attr;
+    }
+    lines->pos += len;
+}
+
+/* squash the attributes of the first len columns of the last line into
+ * lines->runs, returns the number of runs */
+static int
+line_runs(line_buffer_t *lines, int len)
+{
+    uint32_t attr = 0;
+    int n = 0;
+
+    for (int i = 0; i < len; i++) {
+        if (lines->attrs[i] == attr)
+            continue;
+
+        if (n == lines->runs_cap) {
+            lines->runs_cap = lines->runs_cap ? lines->runs_cap * 2 : 16;
+            lines->runs = realloc(lines->runs, sizeof(lines_run_t) * lines->runs_cap);
+        }
+
+        attr = lines->attrs[i];
+        lines->runs[n].col = i;
+        lines->runs[n].attr = attr;
+        n++;
+    }
+
+    return n;
+}
+
+static int
+newline(cheerios_port_t *port, int stamp)
+{
+    line_buffer_t *lines = &port->lines;
+    int n_lines = lines->store.n_lines;
+
+    /* the finished line keeps its runs next to its bytes */
+    if (n_lines > 0 && cheerios.config->colors) {
+        int n_runs = line_runs(lines, lines_len(&lines->store, n_lines - 1));
+
+        lines_finish(&lines->store, lines->runs, n_runs);
+    }
+
+    /* only gets tested here once the filter has caught up */
+    if (n_lines > 0)
+        filter_line(&port->filter, &lines->store, n_lines - 1);
+
+    lines_newline(&lines->store);
+    lines_set_time(&lines->store, cheerios.line_ns);
+    lines->pos = 0;
+
+    /* the prefix waits for the line's first byte to be logged */
+    if (stamp)
+        port->stamp_pending = 1;
+
+    return 0;
+}
+
+/* index of the wrapped row at the bottom of the window, must be synced */
+static long
+bottom_row(line_buffer_t *lines)
+{
+    if (lines->bot < 0)
+        return lines->wrap.total - 1;
+
+    return wrap_row_of(&lines->wrap, &lines->store, lines->bot) + lines->bot_sub;
+}
+
+/* lock the bottom of the window to the given wrapped row, must be synced */
+static void
+set_bottom_row(line_buffer_t *lines, long row)
+{
+    if (lines->store.n_lines == 0) {
+        lines->bot = -1;
+        return;
+    }
+
+    lines->bot = wrap_line_at(&lines->wrap, &lines->store, row, &lines->bot_sub);
+}
+
+/* add bytes to the chunk of a port headed to the logger */
+static void
+log_append(cheerios_port_t *port, const void *buf, size_t len)
+{
+    if (port->log_len + len > port->log_cap) {
+        size_t cap = port->log_cap ? port->log_cap : 4096;
+
+        while (cap < port->log_len + len) {
+            cap *= 2;
+        }
+
+        port->log_buf = realloc(port->log_buf, cap);
+        port->log_cap = cap;
+    }
+
+    memcpy(&port->log_buf[port->log_len], buf, len);
+    port->log_len += len;
+}
+
+/* add the prefix of a line to the chunk, its time_fmt stamp and the name of
+ * the port when several share the log */
+static void
+log_stamp(cheerios_port_t *port)
+{
+    if (cheerios.n_tsegs)
+        log_time(port);
+
+    if (cheerios.n_ports > 1) {
+        log_append(port, "[", 1);
+        log_append(port, port->tag, strlen(port->tag));
+        log_append(port, "] ", 2);
+    }
+}
+
+/* add the time_fmt prefix for the line that started at line_ns to the
+ * chunk. strftime only runs once a second, sub-second fields are filled in
+ * between its output. */
+static void
+log_time(cheerios_port_t *port)
+{
+    time_t sec = cheerios.line_ns / 1000000000ULL;
+    uint32_t ns = cheerios.line_ns % 1000000000ULL;
+    size_t start = 0;
+
+    if (sec != cheerios.tstr_sec || cheerios.tstr_len == 0) {
+        struct tm *tinfo = localtime(&sec);
+
+        cheerios.tstr_len = 0;
+        for (int i = 0; i < cheerios.n_tsegs; i++) {
+            cheerios_tseg_t *seg = &cheerios.tsegs[i];
+
+            cheerios.tstr_len += strftime(
+                &cheerios.tstr[cheerios.tstr_len],
+                sizeof(cheerios.tstr) - cheerios.tstr_len, seg->fmt, tinfo
+            );
+            seg->end = cheerios.tstr_len;
+        }
+        cheerios.tstr_sec = sec;
+    }
+
+    for (int i = 0; i < cheerios.n_tsegs; i++) {
+        const cheerios_tseg_t *seg = &cheerios.tsegs[i];
+        char digits[9];
+        uint32_t v = ns;
+
+        log_append(port, &cheerios.tstr[start], seg->end - start);
+        start = seg->end;
+
+        if (!seg->digits)
+            continue;
+
+        for (int d = seg->digits; d < 9; d++) {
+            v /= 10;
+        }
+        for (int d = seg->digits - 1; d >= 0; d--) {
+            digits[d] = '0' + v % 10;
+            v /= 10;
+        }
+        log_append(port, digits, seg->digits);
+    }
+}
+
+/* add received bytes to the chunk, after the line prefix if they start a
+ * line */
+static void
+log_text(cheerios_port_t *port, const void *buf, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (port->stamp_pending) {
+        port->stamp_pending = 0;
+        log_stamp(port);
+    }
+
+    log_append(port, buf, len);
+}
+
+/* split a time_fmt at %N (nanoseconds) and %<n>N (the first n digits of
+ * them) into the tsegs that log_time formats */
+static int
+split_time_fmt(const char *fmt)
+{
+    char *cur = strdup(fmt);
+    size_t len = 0;
+
+    if (!cur)
+        return -1;
+
+    for (size_t i = 0;; i++) {
+        cheerios_tseg_t *segs;
+        int digits = 0;
+
+        if (fmt[i] == '%' && fmt[i + 1] == 'N') {
+            digits = 9;
+            i++;
+        }
+        else if (
+            fmt[i] == '%' && fmt[i + 1] >= '1' && fmt[i + 1] <= '9' &&
+            fmt[i + 2] == 'N'
+        ) {
+            digits = fmt[i + 1] - '0';
+            i += 2;
+        }
+        else if (fmt[i] == '%' && fmt[i + 1]) {
+            /* keeps %% from being read as the start of a field */
+            cur[len++] = fmt[i++];
+            cur[len++] = fmt[i];
+            continue;
+        }
+        else if (fmt[i]) {
+            cur[len++] = fmt[i];
+            continue;
         }
 
-        if (pair_pos < 0) {
-            pair_pos = lines->color_pos;
-            init_pair(pair_pos + 1, fg, bg);
-            lines->color_pairs[pair_pos].fg = fg;
-            lines->color_pairs[pair_pos].bg = bg;
-            lines->color_pos = (lines->color_pos + 1) % NCOLOR_PAIRS;
+        /* a sub-second field or the end of fmt finishes the segment */
+        cur[len] = 0;
+        segs = realloc(
+            cheerios.tsegs, (cheerios.n_tsegs + 1) * sizeof(*segs)
+        );
+        if (!segs) {
+            free(cur);
+            return -1;
+        }
+        cheerios.tsegs = segs;
+        segs[cheerios.n_tsegs].fmt = strdup(cur);
+        segs[cheerios.n_tsegs].digits = digits;
+        segs[cheerios.n_tsegs].end = 0;
+        if (!segs[cheerios.n_tsegs++].fmt) {
+            free(cur);
+            return -1;
         }
+        len = 0;
 
-        lines->enabled_pairs[pair_pos] = 1;
-        wattron(cheerios.output, COLOR_PAIR(pair_pos + 1));
+        if (!fmt[i])
+            break;
     }
+    free(cur);
 
-    *pos = p;
     return 0;
 }
 
+static uint64_t
+wall_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* columns the gutter takes out of a window width wide, must hold
+ * cheerios.lock */
 static int
-newline(line_buffer_t *lines)
+gutter_width(int width)
 {
-    lines->n_lines++;
-    lines->lines = realloc(lines->lines, sizeof(uint8_t *) * lines->n_lines);
-    lines->lines[lines->n_lines - 1] = NULL;
-    lines->line_lens = realloc(lines->line_lens, sizeof(int) * lines->n_lines);
-    lines->line_lens[lines->n_lines - 1] = 0;
-    lines->pos = 0;
+    /* "HH:MM:SS.mmm " and "+SSSS.mmm ", 3 more for microseconds */
+    static const int widths[CHEERIOS_GUTTER_MODES] = { 0, 13, 10 };
+    int gw = widths[cheerios.gutter];
+
+    if (gw && cheerios.gutter_us)
+        gw += 3;
+
+    /* a narrow window is better off with just the output */
+    return width > gw * 2 ? gw : 0;
+}
+
+/* format the gutter of a line that came in at t into gw bytes of buf, prev
+ * being when the line before it came in. Lines without a time get a blank
+ * gutter. */
+static void
+put_gutter(char *buf, int gw, uint64_t t, uint64_t prev)
+{
+    char tmp[32];
+    int len = 0;
+
+    if (t && cheerios.gutter == CHEERIOS_GUTTER_ABS) {
+        time_t sec = t / 1000000000ULL;
+        uint32_t ns = t % 1000000000ULL;
+
+        if (sec != cheerios.gstr_sec || !cheerios.gstr[0]) {
+            struct tm *tinfo = localtime(&sec);
+
+            strftime(cheerios.gstr, sizeof(cheerios.gstr), "%H:%M:%S", tinfo);
+            cheerios.gstr_sec = sec;
+        }
 
-    if (cheerios.config->time_fmt && (cheerios.log || cheerios.backup)) {
-        char tstr[128];
-        time_t now;
-        struct tm *tinfo;
-        size_t tstr_len;
+        if (cheerios.gutter_us)
+            len = snprintf(tmp, sizeof(tmp), "%s.%06u", cheerios.gstr, ns / 1000);
+        else
+            len = snprintf(tmp, sizeof(tmp), "%s.%03u", cheerios.gstr, ns / 1000000);
+    }
+    else if (t && prev && t >= prev) {
+        uint64_t d = t - prev;
+        unsigned long long sec = d / 1000000000ULL;
+        uint32_t ns = d % 1000000000ULL;
+
+        if (sec > 9999) {
+            sec = 9999;
+            ns = 999999999;
+        }
+
+        if (cheerios.gutter_us)
+            len = snprintf(tmp, sizeof(tmp), "+%4llu.%06u", sec, ns / 1000);
+        else
+            len = snprintf(tmp, sizeof(tmp), "+%4llu.%03u", sec, ns / 1000000);
+    }
+
+    memset(buf, ' ', gw);
+    if (len > gw - 1)
+        len = gw - 1;
+    if (len > 0)
+        memcpy(buf, tmp, len);
+}
+
+/* put the output saved in an old log into the lines without logging it
+ * again, segment by segment if it was rotated */
+static void
+load_log(const char *path)
+{
+    logger_segment_t *segs;
+    int n = logger_read_index(path, &segs);
+
+    for (int i = 0; i < n - 1; i++) {
+        char *seg_path = logger_segment_path(path, segs[i].seg);
+
+        load_file(seg_path);
+        free(seg_path);
+    }
+    free(segs);
+
+    load_file(path);
+}
+
+/* the file is mapped rather than read so it is only paged in once */
+static int
+load_file(const char *path)
+{
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
 
-        time(&now);
-        tinfo = localtime(&now);
-        tstr_len = strftime(tstr, 128, cheerios.config->time_fmt, tinfo);
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
 
-        if (cheerios.log)
-            fwrite(tstr, 1, tstr_len, cheerios.log);
-        if (cheerios.backup)
-            fwrite(tstr, 1, tstr_len, cheerios.backup);
+#ifdef __MINGW32__
+    map = malloc(st.st_size);
+    if (read(fd, map, st.st_size) != st.st_size) {
+        free(map);
+        close(fd);
+        return -1;
+    }
+#else
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
     }
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+    close(fd);
+
+    cheerios.quiet = 1;
+    insert_buf(&cheerios.ports[0], map, st.st_size);
+    cheerios.quiet = 0;
+
+#ifdef __MINGW32__
+    free(map);
+#else
+    munmap(map, st.st_size);
+#endif
 
     return 0;
 }
@@ -10,67 +10,187 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "ansi.h"
 #include "bytenuts.h"
+#include "filter.h"
+#include "lines.h"
+#include "logger.h"
+#include "ring.h"
+#include "wrap.h"
+#include "wakeup.h"
 
 typedef struct line_buffer_struct {
-    uint8_t **lines;
-    int *line_lens;
-    int n_lines; /* how many lines do we have */
+    lines_t store; /* every line received so far */
     int pos; /* position of the cursor in the current line */
-    int bot; /* index of the bottom line shown */
-#define NCOLOR_PAIRS (8)
-    /* support 8 color pairs on screen at once.
-     * COLOR_PAIR(pair_pos + 2) will get you your color. */
-    struct { uint8_t fg; uint8_t bg; } color_pairs[NCOLOR_PAIRS];
-    uint8_t enabled_pairs[NCOLOR_PAIRS]; /* which pairs are enabled */
-    int color_pos;
+    int bot; /* index of the bottom line shown, -1 to follow the output */
+    int bot_sub; /* wrapped row of the bottom line shown at the bottom */
+    int fbot; /* filter match at the bottom while filtering, -1 to follow */
+    wrap_t wrap; /* rows per line at the current window width */
+    ansi_t ansi; /* escape sequences get stripped as they come in */
+    uint32_t *attrs; /* attribute of each column of the last line */
+    int attrs_cap;
+    lines_run_t *runs; /* runs of the last line, rebuilt from attrs */
+    int runs_cap;
 } line_buffer_t;
 
-enum cheerios_mode_enum {
-    CHEERIOS_MODE_NORMAL = 0,
-    CHEERIOS_MODE_PAUSED,
+/* copy of the wrapped rows visible in the output window, bottom row first.
+ * While tailing only the rows that changed get copied, and the window gets
+ * scrolled by scroll rows before they are drawn. */
+typedef struct frame_struct {
+    uint8_t **rows; /* rows point into buf */
+    int *row_lens;
+    int n_rows;
+    int cap; /* allocated rows */
+    uint8_t *buf;
+    size_t buf_sz;
+    int bot; /* line_buffer_t.bot (fbot when filtered) when the frame was taken */
+    int filtered; /* rows are of the filtered view */
+    int full; /* rows hold the whole window, repaint it */
+    int scroll; /* rows to scroll up by before drawing */
+    lines_run_t *runs; /* attribute runs of the rows, col is within the row */
+    int *row_runs; /* first run of each row */
+    int *row_n_runs;
+    int n_runs;
+    int runs_cap;
+    lines_run_t *hl_runs; /* runs of the line with the search hit */
+    int hl_cap;
+    char *gutter; /* gutter_w bytes of timestamp for each row */
+    int gutter_w; /* 0 when the gutter is off */
+    size_t gutter_sz;
+} frame_t;
+
+/* what the gutter left of the output shows for each line */
+enum cheerios_gutter_enum {
+    CHEERIOS_GUTTER_OFF = 0,
+    CHEERIOS_GUTTER_ABS, /* time of day the line came in */
+    CHEERIOS_GUTTER_DELTA, /* time since the line before it */
+    CHEERIOS_GUTTER_MODES,
 };
 
+/* a serial port and the pane showing what it sends */
+typedef struct cheerios_port_struct {
+    serial_t ser_fd;
+    char *name; /* path of the port, the title of its pane */
+    const char *tag; /* name without the directories, tags its log lines */
+    WINDOW *title; /* title row above the output, NULL with a single port */
+    WINDOW *output;
+    line_buffer_t lines;
+    ring_t txq; /* user input on its way to the device */
+    pthread_mutex_t tx_lock; /* the ring takes one producer at a time */
+    uint8_t *log_buf; /* bytes of the port headed to the logger */
+    size_t log_len;
+    size_t log_cap;
+    size_t log_done; /* log_buf up to here is whole lines */
+    int stamp_pending; /* the log needs a line prefix before more bytes */
+    volatile int paused; /* left alone by the reader and the writer, e.g. for xmodem */
+    volatile int tx_stopped; /* the writer saw paused and keeps off ser_fd */
+    int watched; /* in the reader's epoll set */
+    uint64_t park_ns; /* a hung up port is left alone until then */
+    volatile int dirty; /* lines changed since the last frame was taken */
+    frame_t frame; /* owned by the render thread */
+    int redraw; /* the next frame has to repaint the whole pane */
+    long frame_total; /* wrapped rows when the last frame was taken */
+    long frame_last; /* first row of the last line then */
+    int frame_height;
+    int frame_width;
+    char *search; /* last string searched for */
+    int search_len;
+    int hit_line; /* line of the highlighted search hit, -1 for none */
+    int hit_col;
+    filter_t filter; /* kept up to date even while the full view is shown */
+    int filtering; /* only show the lines matching filter */
+} cheerios_port_t;
+
+/* a piece of time_fmt for strftime and the sub-second digits after it */
+typedef struct cheerios_tseg_struct {
+    char *fmt;
+    int digits; /* first digits of the nanoseconds, 0 for none */
+    size_t end; /* where the strftime output of fmt ends in tstr */
+} cheerios_tseg_t;
+
 typedef struct cheerios_struct {
     pthread_mutex_t lock;
     volatile int running;
     pthread_t thr;
-    WINDOW *output;
+    WINDOW *output; /* area the panes get tiled in */
     pthread_mutex_t *term_lock;
-    serial_t ser_fd;
-    line_buffer_t lines;
-    FILE *log; /* log file which was opened with -l */
-    char *backup_filename; /* realpath to the backup outbuf.pid.log */
-    FILE *backup; /* backup log file object */
+    cheerios_port_t ports[BYTENUTS_MAX_PORTS];
+    int n_ports;
+    int sel; /* port that gets the input and the commands */
+    logger_handle logger; /* writes the -l log and the backup log */
+    char *backup_filename; /* path to the backup outbuf.pid.log if open */
+    char *scrollback_path; /* where the scrollback is saved for --resume */
+    int quiet; /* insert without logging, for output that is logged already */
+    uint64_t line_ns; /* wall clock of the chunk being inserted, 0 if unknown */
+    cheerios_tseg_t *tsegs; /* time_fmt split at its sub-second fields */
+    int n_tsegs;
+    time_t tstr_sec; /* second that tstr was formatted for */
+    char tstr[128]; /* cached strftime output of every tseg */
+    size_t tstr_len;
+    int gutter; /* CHEERIOS_GUTTER_* */
+    int gutter_us; /* microseconds rather than milliseconds */
+    time_t gstr_sec; /* second that gstr was formatted for */
+    char gstr[16]; /* cached time of day for the gutter */
     bytenuts_config_t *config;
-    volatile int mode;
-    pthread_cond_t cond;
+    wakeup_t wake; /* kicks the reader out of epoll on pause/resume/stop */
+    pthread_t render_thr;
+    wakeup_t render_wake; /* kicks the render thread when lines get dirty */
+    volatile int dirty; /* some port is dirty */
+    int frame_scrolling; /* scroll/filter state last sent to the status bar */
+    short *pairs; /* color pair for each fg/bg, 0 if not set up yet */
+    int next_pair;
+    pthread_t tx_thr;
+    wakeup_t tx_wake; /* kicks the writer when input gets queued */
+    volatile int stats_bar; /* keep live stats in the status bar */
 } cheerios_t;
 
 /* startup the output window thread */
 int cheerios_start(bytenuts_t *bytenuts);
 
-/* pause reading from the device */
-int cheerios_pause();
+/* pause reading from and writing to the device of port idx, once queued
+ * input has gone out and the writer is off the port. Input to the port is
+ * held back until cheerios_resume, which has to come from the same thread. */
+int cheerios_pause(int idx);
+
+/* resume reading from and writing to the device of port idx */
+int cheerios_resume(int idx);
 
-/* resume reading from the device */
-int cheerios_resume();
+/* Scrolling, search, and filtering all act on the pane of the selected port */
 
-/* go back in the log history, this also stops the buffer from scrolling down
- * if negative, jump to the back of the log */
-int cheerios_goback(int lines);
+/* go back rows wrapped rows in the log history, this also stops the buffer
+ * from scrolling down. If negative, jump to the back of the log */
+int cheerios_goback(int rows);
 
-/* go forward in the log history
+/* go forward rows wrapped rows in the log history
  * if a negative number is provided, go back to the start and resume scrolling */
-int cheerios_gofwd(int lines);
+int cheerios_gofwd(int rows);
+
+/* Find s in the scrollback, starting from the bottom of the window and
+ * looking toward older lines when dir < 0 and newer lines otherwise. With s
+ * NULL, look for the last string again starting next to the last hit. The
+ * window jumps to the hit and highlights it until it follows the output
+ * again. Returns -1 if there is no hit. */
+int cheerios_search(const char *s, int dir);
+
+/* Only show the lines matching pattern, a POSIX extended regex if regex is
+ * set. With pattern NULL, switch between the filtered and the full view of
+ * the last pattern, an empty pattern switches to the full view. Returns -1 if
+ * the regex is bad or there is no pattern to switch to. */
+int cheerios_filter(const char *pattern, int regex);
 
 /* stop the thread and release memory */
 int cheerios_stop();
 
-/* send over a line of user input to the output */
+/* queue user input to be written to the selected port, never waits on the
+ * output */
 int cheerios_input(const char *buf, size_t len);
 
-/* output a line only to the terminal for info/prompt purposes
+/* queue as much of buf to be written to the given port as fits right now,
+ * returns how much that was. For producers other than the input line. */
+size_t cheerios_input_some(int port, const char *buf, size_t len);
+
+/* output a line only to the terminal for info/prompt purposes, in the pane
+ * of the selected port
  * do not terminate with a newline! */
 int cheerios_info(const char *line);
 
@@ -81,17 +201,47 @@ int cheerios_print(const char *fmt, ...);
 /* directly insert a buffer to the output window */
 int cheerios_insert(const char *buf, size_t len);
 
-/* send the file at path over xmodem */
+/* send the file at path over xmodem to the selected port */
 int cheerios_xmodem(const char *path, int block_sz);
 
+/* send the files at paths in one ymodem batch to the selected port */
+int cheerios_ymodem(char **paths, int n_paths);
+
+/* send the files at paths in one zmodem session to the selected port, with
+ * resume the receiver can carry on partial copies it already has */
+int cheerios_zmodem(char **paths, int n_paths, int resume);
+
+/* receive a file over xmodem from the selected port and save it at path */
+int cheerios_xmodem_recv(const char *path);
+
 int cheerios_print_stats();
 
-/* getter for window height */
+/* turn the live stats in the status bar on or off */
+int cheerios_toggle_stats_bar();
+
+/* cycle the timestamp gutter through off, time of day, and time since the
+ * line before */
+int cheerios_toggle_gutter();
+
+/* switch the gutter between millisecond and microsecond precision */
+int cheerios_toggle_gutter_us();
+
+/* make the next port the selected one, returns its index */
+int cheerios_select_next();
+
+/* name of the selected port */
+const char *cheerios_port_name();
+
+/* getter for the selected pane's height */
 int cheerios_getmaxy();
-/* getter for window width */
+/* getter for the selected pane's width */
 int cheerios_getmaxx();
 
 /* deletes the old window and sets the output window to the new one */
 int cheerios_set_window(WINDOW *win);
 
+/* tile the panes over the output window again and repaint them with the
+ * next frame */
+int cheerios_redraw();
+
 #endif /* _CHEERIOS_H_ */
@@ -0,0 +1,68 @@
+#include <pthread.h>
+
+#include "crc16.h"
+
+#define POLY (0x1021)
+
+/* table[k][b] is the CRC of the byte b followed by k zero bytes */
+static uint16_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void make_table(void);
+
+uint16_t
+crc16_update(uint16_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    pthread_once(&table_once, make_table);
+
+    /* the CRC gets folded into the first two bytes of each 8, and each byte
+     * then looks up what it adds to the CRC from where it sits */
+    while (len >= 8) {
+        crc = table[7][p[0] ^ (crc >> 8)] ^
+            table[6][p[1] ^ (crc & 0xFF)] ^
+            table[5][p[2]] ^
+            table[4][p[3]] ^
+            table[3][p[4]] ^
+            table[2][p[5]] ^
+            table[1][p[6]] ^
+            table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = (crc << 8) ^ table[0][(crc >> 8) ^ *p++];
+    }
+
+    return crc;
+}
+
+uint16_t
+crc16(const void *buf, size_t len)
+{
+    return crc16_update(0, buf, len);
+}
+
+static void
+make_table()
+{
+    for (int b = 0; b < 256; b++) {
+        uint16_t crc = b << 8;
+
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ POLY : crc << 1;
+        }
+        table[0][b] = crc;
+    }
+
+    /* one more zero byte through each table */
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint16_t crc = table[k - 1][b];
+
+            table[k][b] = (crc << 8) ^ table[0][crc >> 8];
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-16/XMODEM (polynomial 0x1021, no reflection, starting at 0), the CRC
+ * of XModem, YModem and ZModem's 16-bit frames. Goes 8 bytes at a time
+ * through 8 lookup tables (slicing-by-8) rather than a bit at a time. */
+
+/* Carry on the CRC crc over len more bytes of buf, start with 0 */
+uint16_t crc16_update(uint16_t crc, const void *buf, size_t len);
+
+/* CRC of len bytes of buf */
+uint16_t crc16(const void *buf, size_t len);
+
+#endif /* _CRC16_H_ */
@@ -0,0 +1,71 @@
+#include <pthread.h>
+
+#include "crc32.h"
+
+#define POLY (0xEDB88320) /* 0x04C11DB7 reflected */
+
+/* table[k][b] is what the byte b adds to the CRC with k bytes after it */
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void make_table(void);
+
+uint32_t
+crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    pthread_once(&table_once, make_table);
+
+    crc = ~crc;
+
+    /* reflected, so the CRC folds into the first four bytes of each 8 */
+    while (len >= 8) {
+        uint32_t a = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+
+        crc = table[7][a & 0xFF] ^
+            table[6][(a >> 8) & 0xFF] ^
+            table[5][(a >> 16) & 0xFF] ^
+            table[4][a >> 24] ^
+            table[3][p[4]] ^
+            table[2][p[5]] ^
+            table[1][p[6]] ^
+            table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+uint32_t
+crc32(const void *buf, size_t len)
+{
+    return crc32_update(0, buf, len);
+}
+
+static void
+make_table()
+{
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = b;
+
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+        }
+        table[0][b] = crc;
+    }
+
+    /* one more zero byte through each table */
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint32_t crc = table[k - 1][b];
+
+            table[k][b] = (crc >> 8) ^ table[0][crc & 0xFF];
+        }
+    }
+}
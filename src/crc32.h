@@ -0,0 +1,16 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-32 (polynomial 0x04C11DB7 reflected, the one of zip and Ethernet), the
+ * CRC of ZModem's 32-bit frames. Goes 8 bytes at a time like crc16. */
+
+/* Carry on the CRC crc over len more bytes of buf, start with 0 */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+/* CRC of len bytes of buf */
+uint32_t crc32(const void *buf, size_t len);
+
+#endif /* _CRC32_H_ */
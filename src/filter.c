@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "scan.h"
+
+static int line_matches(filter_t *f, const uint8_t *line, int len);
+
+int
+filter_set(filter_t *f, const char *pattern, int regex)
+{
+#ifdef __MINGW32__
+    if (regex)
+        return -1;
+#else
+    regex_t re;
+
+    if (regex && regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB))
+        return -1;
+#endif
+
+    filter_free(f);
+
+    f->pattern = strdup(pattern);
+    f->regex = regex;
+#ifndef __MINGW32__
+    if (regex)
+        f->re = re;
+#endif
+
+    return 0;
+}
+
+void
+filter_line(filter_t *f, lines_t *lines, int idx)
+{
+    int len;
+    const uint8_t *line;
+
+    if (!f->pattern || idx != f->checked)
+        return;
+
+    line = lines_get(lines, idx, &len);
+    f->checked++;
+
+    if (!line_matches(f, line, len))
+        return;
+
+    if (f->n_matches == f->cap) {
+        f->cap = f->cap ? f->cap * 2 : 1024;
+        f->matches = realloc(f->matches, sizeof(int) * f->cap);
+    }
+
+    f->matches[f->n_matches] = idx;
+    f->n_matches++;
+}
+
+int
+filter_sync(filter_t *f, lines_t *lines, int end, int budget)
+{
+    if (!f->pattern)
+        return 0;
+
+    while (f->checked < end && budget > 0) {
+        filter_line(f, lines, f->checked);
+        budget--;
+    }
+
+    return f->checked < end;
+}
+
+void
+filter_free(filter_t *f)
+{
+#ifndef __MINGW32__
+    if (f->pattern && f->regex)
+        regfree(&f->re);
+#endif
+
+    free(f->pattern);
+    free(f->matches);
+    free(f->tmp);
+
+    memset(f, 0, sizeof(filter_t));
+}
+
+static int
+line_matches(filter_t *f, const uint8_t *line, int len)
+{
+    if (!f->regex) {
+        size_t p_len = strlen(f->pattern);
+
+        if (p_len > (size_t)len)
+            return 0;
+        return scan_find((const char *)line, len, f->pattern, p_len) < (size_t)len;
+    }
+
+#ifdef __MINGW32__
+    return 0;
+#else
+    if (len + 1 > f->tmp_cap) {
+        f->tmp_cap = (len + 1) * 2;
+        f->tmp = realloc(f->tmp, f->tmp_cap);
+    }
+
+    memcpy(f->tmp, line, len);
+    f->tmp[len] = '\0';
+
+    return !regexec(&f->re, f->tmp, 0, NULL, 0);
+#endif
+}
@@ -0,0 +1,43 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#ifndef __MINGW32__
+#  include <regex.h>
+#endif
+
+#include "lines.h"
+
+/* List of the lines that match a pattern, oldest first. Lines are tested
+ * once, as they get finished, so a view of only the matching lines never has
+ * to rescan the store. Lines that were already there when the pattern was set
+ * get tested in batches with filter_sync. */
+
+typedef struct filter_struct {
+    char *pattern; /* NULL when no filter is set */
+    int regex; /* pattern is a POSIX extended regex, not a plain string */
+#ifndef __MINGW32__
+    regex_t re;
+#endif
+    int *matches; /* indices of the matching lines */
+    int n_matches;
+    int cap;
+    int checked; /* lines before this one have been tested */
+    char *tmp; /* nul terminated copy of a line for regexec */
+    int tmp_cap;
+} filter_t;
+
+/* Start matching pattern, dropping the matches of the old one. Returns -1 if
+ * the regex does not compile, the old filter is kept then. */
+int filter_set(filter_t *f, const char *pattern, int regex);
+
+/* Test finished line idx, which has to be the next one, f->checked */
+void filter_line(filter_t *f, lines_t *lines, int idx);
+
+/* Test at most budget of the lines from f->checked up to end, returns 1 if
+ * there are still lines left */
+int filter_sync(filter_t *f, lines_t *lines, int end, int budget);
+
+/* Release the filter, leaving no filter set */
+void filter_free(filter_t *f);
+
+#endif /* _FILTER_H_ */
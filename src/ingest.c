@@ -24,11 +24,17 @@ static void *ingest_thread(void *arg);
 static ingest_t ingest;
 
 static int mode_normal(int ch);
-static int mode_xmodem(int block_sz);
+static int mode_xmodem(void);
 static int mode_hex(int ch);
+static int mode_prompt(void);
+static void search_status(int found);
 static int handle_functions(int ch);
 static int print_stats(void);
 static int auto_complete(void);
+static int batch_mode(void);
+static int split_paths(char *buf, char **paths, int max_paths);
+static char *last_path(const char *buf);
+static void shell_escape(const char *in, char *out, size_t size);
 static int read_cmd_page(const char *home_dir, int idx);
 static void update_cmd_pg_status(void);
 static void inter_command_wait(void);
@@ -45,6 +51,8 @@ ingest_start(bytenuts_t *bytenuts)
     ingest.config = &bytenuts->config;
     ingest.cmd_pg_cur = -1;
     ingest.xmodem_hist = bstr_history_create();
+    ingest.search_hist = bstr_history_create();
+    ingest.filter_hist = bstr_history_create();
 
     HOME = getenv("HOME");
     if (HOME) {
@@ -362,6 +370,11 @@ ingest_thread(void *arg)
                 bytenuts_set_status(STATUS_INGEST, "normal");
                 should_continue = 1;
                 break;
+            case 'I':
+                cheerios_toggle_stats_bar();
+                bytenuts_set_status(STATUS_INGEST, "normal");
+                should_continue = 1;
+                break;
             case 'q':
                 bytenuts_stop();
                 should_quit = 1;
@@ -374,6 +387,63 @@ ingest_thread(void *arg)
                 ingest.mode = INGEST_MODE_XMODEM1K;
                 bytenuts_set_status(STATUS_INGEST, "xmodem1k");
                 break;
+            case 'r':
+                ingest.mode = INGEST_MODE_XMODEM_RECV;
+                bytenuts_set_status(STATUS_INGEST, "xmodem receive");
+                break;
+            case 'y':
+                ingest.mode = INGEST_MODE_YMODEM;
+                bytenuts_set_status(STATUS_INGEST, "ymodem");
+                break;
+            case 'z':
+                ingest.mode = INGEST_MODE_ZMODEM;
+                bytenuts_set_status(STATUS_INGEST, "zmodem");
+                break;
+            case 'Z':
+                ingest.mode = INGEST_MODE_ZMODEM_RESUME;
+                bytenuts_set_status(STATUS_INGEST, "zmodem resume");
+                break;
+            case '/':
+                ingest.mode = INGEST_MODE_SEARCH;
+                bytenuts_set_status(STATUS_INGEST, "search");
+                break;
+            case 'n':
+                search_status(!cheerios_search(NULL, -1));
+                should_continue = 1;
+                break;
+            case 'N':
+                search_status(!cheerios_search(NULL, 1));
+                should_continue = 1;
+                break;
+            case 'f':
+                ingest.mode = INGEST_MODE_FILTER;
+                bytenuts_set_status(STATUS_INGEST, "filter");
+                break;
+            case 'F':
+                ingest.mode = INGEST_MODE_FILTER_RE;
+                bytenuts_set_status(STATUS_INGEST, "filter regex");
+                break;
+            case 't':
+                cheerios_toggle_gutter();
+                bytenuts_set_status(STATUS_INGEST, "normal");
+                should_continue = 1;
+                break;
+            case 'T':
+                cheerios_toggle_gutter_us();
+                bytenuts_set_status(STATUS_INGEST, "normal");
+                should_continue = 1;
+                break;
+            case 'o':
+                cheerios_select_next();
+                bytenuts_set_status(STATUS_BYTENUTS, "%s", cheerios_port_name());
+                bytenuts_set_status(STATUS_INGEST, "normal");
+                should_continue = 1;
+                break;
+            case 'v':
+                cheerios_filter(NULL, 0);
+                bytenuts_set_status(STATUS_INGEST, "normal");
+                should_continue = 1;
+                break;
             case 'H':
                 if (ingest.mode == INGEST_MODE_NORMAL) {
                     ingest.mode = INGEST_MODE_HEX;
@@ -391,8 +461,22 @@ ingest_thread(void *arg)
                     "  0-9: load the given quick command (0 is 10)\r\n"
                     "  p: select a different quick commands page\r\n"
                     "  i: view info/stats\r\n"
+                    "  I: show/hide live stats in the status bar\r\n"
                     "  x: start XModem upload with 128B payloads\r\n"
                     "  X: start XModem upload with 1024B payloads\r\n"
+                    "  r: start XModem download (128B or 1024B payloads)\r\n"
+                    "  y: start YModem batch upload of several files\r\n"
+                    "  z: start ZModem upload of one or more files\r\n"
+                    "  Z: start ZModem upload, resuming partial copies\r\n"
+                    "  /: search the output for a string\r\n"
+                    "  n: find the next older match\r\n"
+                    "  N: find the next newer match\r\n"
+                    "  f: only show lines with a string (empty for all lines)\r\n"
+                    "  F: only show lines matching a regex\r\n"
+                    "  v: switch between the filtered and full output\r\n"
+                    "  t: cycle line timestamps (off/time of day/delta)\r\n"
+                    "  T: switch timestamps between ms and us\r\n"
+                    "  o: send input to the next port\r\n"
                     "  H: enter/exit hex buffer mode\r\n"
                     "  h: view this help\r\n"
                     "  q: quit Bytenuts\r\n",
@@ -419,14 +503,21 @@ ingest_thread(void *arg)
             mode_normal(ch);
             break;
         case INGEST_MODE_XMODEM:
-            mode_xmodem(128);
-            break;
         case INGEST_MODE_XMODEM1K:
-            mode_xmodem(1024);
+        case INGEST_MODE_XMODEM_RECV:
+        case INGEST_MODE_YMODEM:
+        case INGEST_MODE_ZMODEM:
+        case INGEST_MODE_ZMODEM_RESUME:
+            mode_xmodem();
             break;
         case INGEST_MODE_HEX:
             mode_hex(ch);
             break;
+        case INGEST_MODE_SEARCH:
+        case INGEST_MODE_FILTER:
+        case INGEST_MODE_FILTER_RE:
+            mode_prompt();
+            break;
         default:
             break;
         }
@@ -461,6 +552,8 @@ ingest_thread(void *arg)
     }
 
     bstr_history_destroy(ingest.xmodem_hist);
+    bstr_history_destroy(ingest.search_hist);
+    bstr_history_destroy(ingest.filter_hist);
 
     pthread_exit(NULL);
     return NULL;
@@ -575,8 +668,9 @@ mode_normal(int ch)
     return 0;
 }
 
+/* prompt for the file(s) of the transfer picked by the mode */
 static int
-mode_xmodem(int block_sz)
+mode_xmodem()
 {
     int quit_flag = 0;
 
@@ -586,7 +680,12 @@ mode_xmodem(int block_sz)
     ingest.inpos = 0;
     if (ingest.prepend)
         free(ingest.prepend);
-    ingest.prepend = strdup("Give me a path (ctrl-c to stop): ");
+    if (ingest.mode == INGEST_MODE_XMODEM_RECV)
+        ingest.prepend = strdup("Save to path (ctrl-c to stop): ");
+    else if (batch_mode())
+        ingest.prepend = strdup("Give me paths (ctrl-c to stop): ");
+    else
+        ingest.prepend = strdup("Give me a path (ctrl-c to stop): ");
     ingest_refresh();
 
     while (ingest.running) {
@@ -608,12 +707,33 @@ mode_xmodem(int block_sz)
             pthread_mutex_lock(ingest.term_lock);
             werase(ingest.input);
             wmove(ingest.input, 0, 0);
-            wprintw(ingest.input, "Sending...");
+            wprintw(
+                ingest.input,
+                ingest.mode == INGEST_MODE_XMODEM_RECV ? "Receiving..." : "Sending..."
+            );
             wrefresh(ingest.input);
             pthread_mutex_unlock(ingest.term_lock);
 
             cheerios_gofwd(-1);
-            cheerios_xmodem(ingest.inbuf, block_sz);
+            if (ingest.mode == INGEST_MODE_XMODEM) {
+                cheerios_xmodem(ingest.inbuf, 128);
+            } else if (ingest.mode == INGEST_MODE_XMODEM1K) {
+                cheerios_xmodem(ingest.inbuf, 1024);
+            } else if (ingest.mode == INGEST_MODE_XMODEM_RECV) {
+                cheerios_xmodem_recv(ingest.inbuf);
+            } else {
+                char *paths[64];
+                int n_paths = split_paths(
+                    ingest.inbuf, paths, sizeof(paths) / sizeof(paths[0])
+                );
+
+                if (n_paths > 0 && ingest.mode == INGEST_MODE_YMODEM)
+                    cheerios_ymodem(paths, n_paths);
+                else if (n_paths > 0)
+                    cheerios_zmodem(
+                        paths, n_paths, ingest.mode == INGEST_MODE_ZMODEM_RESUME
+                    );
+            }
             quit_flag = 1;
             break;
         case CTRL('c'):
@@ -781,6 +901,134 @@ mode_hex(int ch)
     return 0;
 }
 
+/* read a search string or filter pattern, depending on the mode */
+static int
+mode_prompt()
+{
+    int quit_flag = 0;
+    const char *status = "normal";
+    int search = ingest.mode == INGEST_MODE_SEARCH;
+    bstr_history_handle hist = search ? ingest.search_hist : ingest.filter_hist;
+
+    strcpy(ingest.tmp_history, ingest.inbuf);
+    memset(ingest.inbuf, 0, sizeof(ingest.inbuf));
+    ingest.inlen = 0;
+    ingest.inpos = 0;
+    if (ingest.prepend)
+        free(ingest.prepend);
+    if (search)
+        ingest.prepend = strdup("Search for (ctrl-c to stop): ");
+    else if (ingest.mode == INGEST_MODE_FILTER)
+        ingest.prepend = strdup("Filter for (ctrl-c to stop): ");
+    else
+        ingest.prepend = strdup("Filter regex (ctrl-c to stop): ");
+    ingest_refresh();
+
+    while (ingest.running) {
+        int ch;
+
+        pthread_mutex_lock(ingest.term_lock);
+        ch = wgetch(ingest.input);
+        pthread_mutex_unlock(ingest.term_lock);
+
+        if (ch == ERR || handle_functions(ch)) {
+            nanosleep(&(struct timespec){ 0, 100000 }, NULL);
+            continue;
+        }
+
+        switch (ch) {
+        case '\n':
+            if (ingest.inlen > 0)
+                bstr_history_new_entry(hist, ingest.inbuf);
+
+            if (search && ingest.inlen > 0) {
+                if (cheerios_search(ingest.inbuf, -1))
+                    status = "not found";
+            }
+            else if (!search) {
+                int regex = ingest.mode == INGEST_MODE_FILTER_RE;
+
+                if (cheerios_filter(ingest.inbuf, regex))
+                    status = "bad regex";
+            }
+            quit_flag = 1;
+            break;
+        case CTRL('c'):
+            quit_flag = 1;
+            break;
+        case KEY_UP:
+        case KEY_DOWN:
+            {
+                const char *str;
+
+                if (ch == KEY_UP) {
+                    bstr_history_older(hist);
+                } else {
+                    bstr_history_newer(hist);
+                }
+
+                memset(ingest.inbuf, 0, sizeof(ingest.inbuf));
+                str = bstr_history_atpos(hist);
+                if (str)
+                    strncpy(ingest.inbuf, str, sizeof(ingest.inbuf) - 1);
+                ingest.inpos = strlen(ingest.inbuf);
+                ingest.inlen = ingest.inpos;
+                ingest_refresh();
+                break;
+            }
+        default:
+            {
+                char tmp[1024];
+                int tmp_len;
+
+                if (ingest.inpos == sizeof(ingest.inbuf) - 1)
+                    break;
+
+                tmp_len = ingest.inlen - ingest.inpos;
+                memcpy(tmp, &ingest.inbuf[ingest.inpos], tmp_len);
+                ingest.inbuf[ingest.inpos] = (char)ch;
+                ingest.inpos++;
+                ingest.inlen++;
+                memcpy(&ingest.inbuf[ingest.inpos], tmp, tmp_len);
+
+                if (ingest.inlen == sizeof(ingest.inbuf)) {
+                    ingest.inbuf[ingest.inlen - 1] = '\0';
+                    ingest.inlen--;
+                }
+
+                ingest_refresh();
+
+                break;
+            }
+        }
+
+        if (quit_flag)
+            break;
+    }
+
+    memset(ingest.inbuf, 0, sizeof(ingest.inbuf));
+    strcpy(ingest.inbuf, ingest.tmp_history);
+    ingest.inlen = strlen(ingest.inbuf);
+    ingest.inpos = ingest.inlen;
+    ingest.mode = INGEST_MODE_NORMAL;
+    free(ingest.prepend);
+    ingest.prepend = NULL;
+
+    bstr_history_unset_pos(hist);
+
+    bytenuts_set_status(STATUS_INGEST, "%s", status);
+    ingest_refresh();
+
+    return 0;
+}
+
+/* searches report a miss in the status bar */
+static void
+search_status(int found)
+{
+    bytenuts_set_status(STATUS_INGEST, found ? "normal" : "not found");
+}
+
 static int
 handle_functions(int ch)
 {
@@ -919,27 +1167,37 @@ auto_complete()
 {
     char cmd[1024];
     char line[1024];
+    char quoted[960];
     char **matches = NULL;
     int nmatches = 0;
     FILE *sh = NULL;
     char *inbuf_cpy = NULL;
     char *inbuf_basename = NULL;
     size_t inbuf_basename_len;
+    char *path = ingest.inbuf;
+    char *batch_path = NULL;
+
+    /* a batch completes the last of its paths */
+    if (batch_mode())
+        path = batch_path = last_path(ingest.inbuf);
+    if (!path)
+        return -1;
 
     /* retrieve directory listing with ls */
-    inbuf_cpy = strdup(ingest.inbuf);
+    inbuf_cpy = strdup(path);
+    shell_escape(path, quoted, sizeof(quoted));
     if (ingest.inlen > 0 && ingest.inbuf[ingest.inlen - 1] == '/') {
         snprintf(
             cmd, sizeof(cmd),
-            "cd %s 2> /dev/null && ls -1 2> /dev/null",
-            ingest.inbuf
+            "cd \"%s\" 2> /dev/null && ls -1 2> /dev/null",
+            quoted
         );
         inbuf_basename = "";
     } else {
         snprintf(
             cmd, sizeof(cmd),
-            "cd $(dirname \"%s\") 2> /dev/null && ls -1 2> /dev/null",
-            ingest.inbuf
+            "cd \"$(dirname \"%s\")\" 2> /dev/null && ls -1 2> /dev/null",
+            quoted
         );
         inbuf_basename = basename(inbuf_cpy);
     }
@@ -988,13 +1246,16 @@ auto_complete()
     }
 
     if (offset > inbuf_basename_len) {
-        size_t add_len = offset - inbuf_basename_len;
-
-        if (add_len + ingest.inlen >= sizeof(ingest.inbuf))
-            add_len = sizeof(ingest.inbuf) - ingest.inlen - 1;
+        for (int i = inbuf_basename_len; i < offset; i++) {
+            /* a batch has to escape what would split or quote the path */
+            int esc = batch_path && strchr(" \\\"", matches[0][i]);
 
-        memcpy(&ingest.inbuf[ingest.inlen], &matches[0][inbuf_basename_len], add_len);
-        ingest.inlen += add_len;
+            if (ingest.inlen + esc + 1 >= sizeof(ingest.inbuf))
+                break;
+            if (esc)
+                ingest.inbuf[ingest.inlen++] = '\\';
+            ingest.inbuf[ingest.inlen++] = matches[0][i];
+        }
         ingest.inpos = ingest.inlen;
     }
 
@@ -1002,7 +1263,11 @@ auto_complete()
     if (nmatches == 1) {
         struct stat st;
 
-        stat(ingest.inbuf, &st);
+        if (batch_path) {
+            free(batch_path);
+            path = batch_path = last_path(ingest.inbuf);
+        }
+        stat(path, &st);
         if (
             S_ISDIR(st.st_mode) &&
             ingest.inlen < sizeof(ingest.inbuf) - 1 &&
@@ -1024,10 +1289,105 @@ auto_complete_cleanup:
 
     if (inbuf_cpy)
         free(inbuf_cpy);
+    free(batch_path);
 
     return 0;
 }
 
+/* the transfer takes several paths */
+static int
+batch_mode()
+{
+    return ingest.mode == INGEST_MODE_YMODEM ||
+        ingest.mode == INGEST_MODE_ZMODEM ||
+        ingest.mode == INGEST_MODE_ZMODEM_RESUME;
+}
+
+/* split buf in place into the paths of a batch. They are separated by
+ * spaces, a backslash takes the next character as it is and double quotes
+ * keep spaces in, like a shell would. Returns the number of paths. */
+static int
+split_paths(char *buf, char **paths, int max_paths)
+{
+    char *out = buf;
+    int n_paths = 0;
+    int in_path = 0;
+    int quoted = 0;
+
+    for (char *p = buf; *p; p++) {
+        if (*p == ' ' && !quoted) {
+            if (in_path)
+                *out++ = '\0';
+            in_path = 0;
+            continue;
+        }
+
+        if (!in_path) {
+            if (n_paths == max_paths)
+                break;
+            paths[n_paths++] = out;
+            in_path = 1;
+        }
+
+        if (*p == '\\' && p[1])
+            *out++ = *++p;
+        else if (*p == '"')
+            quoted = !quoted;
+        else
+            *out++ = *p;
+    }
+    *out = '\0';
+
+    return n_paths;
+}
+
+/* copy of the last path of a batch the way split_paths reads it, empty when
+ * buf ends in a separator */
+static char *
+last_path(const char *buf)
+{
+    char *out = malloc(strlen(buf) + 1);
+    size_t len = 0;
+    int quoted = 0;
+
+    if (!out)
+        return NULL;
+
+    for (; *buf; buf++) {
+        if (*buf == '\\' && buf[1])
+            out[len++] = *++buf;
+        else if (*buf == '"')
+            quoted = !quoted;
+        else if (*buf == ' ' && !quoted)
+            len = 0;
+        else
+            out[len++] = *buf;
+    }
+    out[len] = '\0';
+
+    return out;
+}
+
+/* escape what the shell still expands inside double quotes, so a path
+ * goes into a popen command as it is. Stops short rather than splitting an
+ * escape when out fills up. */
+static void
+shell_escape(const char *in, char *out, size_t size)
+{
+    size_t len = 0;
+
+    for (; *in; in++) {
+        int esc = strchr("\"$`\\", *in) != NULL;
+
+        if (len + esc + 1 >= size)
+            break;
+        if (esc)
+            out[len++] = '\\';
+        out[len++] = *in;
+    }
+    out[len] = '\0';
+}
+
 static int
 read_cmd_page(const char *home_dir, int idx)
 {
@@ -17,7 +17,14 @@ enum ingest_mode_enum {
     INGEST_MODE_NORMAL = 0,
     INGEST_MODE_XMODEM,
     INGEST_MODE_XMODEM1K,
+    INGEST_MODE_XMODEM_RECV,
+    INGEST_MODE_YMODEM,
+    INGEST_MODE_ZMODEM,
+    INGEST_MODE_ZMODEM_RESUME,
     INGEST_MODE_HEX,
+    INGEST_MODE_SEARCH,
+    INGEST_MODE_FILTER,
+    INGEST_MODE_FILTER_RE,
 };
 
 typedef struct ingest_struct {
@@ -48,6 +55,8 @@ typedef struct ingest_struct {
     int cmd_pg_cur;
     struct timespec cmd_ts; /* last command sent timestamp */
     bstr_history_handle xmodem_hist; /* xmodem filename transfer history */
+    bstr_history_handle search_hist; /* strings searched for */
+    bstr_history_handle filter_hist; /* filter patterns */
 } ingest_t;
 
 /* startup the input window thread */
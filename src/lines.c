@@ -0,0 +1,856 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#include "lines.h"
+#include "scan.h"
+
+/* index record of a spilled line, as stored in the .idx file */
+typedef struct spill_rec_struct {
+    uint64_t off; /* offset of the line in the .dat file */
+    uint32_t len;
+    uint32_t n_runs;
+    uint64_t t_ns;
+} spill_rec_t;
+
+/* runs are stored after the line at the next 4 byte aligned offset of the
+ * slab, or of the .dat file once spilled */
+#define RUNS_OFF(end) (((end) + 3) & ~(size_t)3)
+
+/* bytes searched at a time when searching toward older lines */
+#define FIND_CHUNK (256 * 1024)
+
+static lines_slab_t *new_slab(lines_t *lines, size_t min_sz);
+static lines_slab_t *fit_last(lines_t *lines, size_t need);
+static lines_rec_t *hot_rec(lines_t *lines, int idx);
+static lines_slab_t *hot_slab(lines_t *lines, uint32_t slab);
+static int open_spill(lines_t *lines, const char *path, int flags);
+static void unlink_spill(const char *path);
+static int move_spill(const char *from, const char *to);
+static void spill_old(lines_t *lines);
+static int spill_slab(lines_t *lines);
+static const spill_rec_t *spilled_rec(lines_t *lines, int idx);
+static int map_file(int fd, size_t need, uint8_t **map, size_t *map_sz);
+static void line_loc(lines_t *lines, int idx, size_t *off, int *len);
+static int line_at(lines_t *lines, int first, int last, size_t at);
+static const uint8_t *segment(lines_t *lines, int idx, int *first, int *last);
+static int find_in(
+    lines_t *lines,
+    const uint8_t *base,
+    int first,
+    int last,
+    int dir,
+    const char *s,
+    int s_len,
+    int *col
+);
+
+int
+lines_newline(lines_t *lines)
+{
+    lines_slab_t *slab;
+    lines_rec_t *rec;
+    int n_hot = lines->n_lines - lines->line0;
+
+    if (lines->n_slabs == 0 && !new_slab(lines, 0))
+        return -1;
+
+    if (lines->recs_head + n_hot == lines->recs_cap) {
+        /* reclaim records that were spilled before growing */
+        if (lines->recs_head > 0 && lines->recs_head >= lines->recs_cap / 2) {
+            memmove(
+                lines->recs,
+                &lines->recs[lines->recs_head],
+                sizeof(lines_rec_t) * n_hot
+            );
+            lines->recs_head = 0;
+        } else {
+            int cap = lines->recs_cap ? lines->recs_cap * 2 : 1024;
+            lines_rec_t *recs = realloc(lines->recs, sizeof(lines_rec_t) * cap);
+
+            if (!recs)
+                return -1;
+
+            lines->recs = recs;
+            lines->recs_cap = cap;
+        }
+    }
+
+    slab = &lines->slabs[lines->slabs_head + lines->n_slabs - 1];
+    rec = &lines->recs[lines->recs_head + n_hot];
+    rec->slab = lines->slab0 + lines->n_slabs - 1;
+    rec->off = slab->used;
+    rec->len = 0;
+    rec->n_runs = 0;
+    rec->t_ns = 0;
+    lines->n_lines++;
+
+    spill_old(lines);
+
+    return 0;
+}
+
+int
+lines_write(lines_t *lines, int pos, const void *buf, int len)
+{
+    lines_rec_t *rec;
+    lines_slab_t *slab;
+    size_t end;
+
+    if (lines->n_lines == 0 && lines_newline(lines))
+        return -1;
+
+    rec = hot_rec(lines, lines->n_lines - 1);
+    slab = hot_slab(lines, rec->slab);
+
+    if (pos > rec->len)
+        pos = rec->len;
+    end = (size_t)pos + len;
+
+    if (end > (size_t)rec->len) {
+        slab = fit_last(lines, end);
+        if (!slab)
+            return -1;
+
+        rec->len = end;
+        slab->used = rec->off + end;
+    }
+
+    memcpy(&slab->buf[rec->off + pos], buf, len);
+
+    return 0;
+}
+
+int
+lines_finish(lines_t *lines, const lines_run_t *runs, int n_runs)
+{
+    lines_rec_t *rec;
+    lines_slab_t *slab;
+    size_t runs_off;
+
+    if (lines->n_lines == 0 || n_runs == 0)
+        return 0;
+
+    rec = hot_rec(lines, lines->n_lines - 1);
+
+    /* worst case padding, the line may move to a new slab */
+    slab = fit_last(lines, rec->len + 3 + sizeof(lines_run_t) * n_runs);
+    if (!slab)
+        return -1;
+
+    runs_off = RUNS_OFF(rec->off + rec->len);
+    memcpy(&slab->buf[runs_off], runs, sizeof(lines_run_t) * n_runs);
+    slab->used = runs_off + sizeof(lines_run_t) * n_runs;
+    rec->n_runs = n_runs;
+
+    return 0;
+}
+
+void
+lines_set_time(lines_t *lines, uint64_t t_ns)
+{
+    if (lines->n_lines > 0)
+        hot_rec(lines, lines->n_lines - 1)->t_ns = t_ns;
+}
+
+uint64_t
+lines_time(lines_t *lines, int idx)
+{
+    const spill_rec_t *srec;
+
+    if (idx >= lines->line0)
+        return hot_rec(lines, idx)->t_ns;
+
+    srec = spilled_rec(lines, idx);
+    return srec ? srec->t_ns : 0;
+}
+
+const uint8_t *
+lines_get(lines_t *lines, int idx, int *len)
+{
+    const lines_run_t *runs;
+    int n_runs;
+
+    return lines_get_runs(lines, idx, len, &runs, &n_runs);
+}
+
+const uint8_t *
+lines_get_runs(
+    lines_t *lines,
+    int idx,
+    int *len,
+    const lines_run_t **runs,
+    int *n_runs
+)
+{
+    const lines_rec_t *rec;
+    const spill_rec_t *srec;
+    const uint8_t *ret;
+
+    if (idx >= lines->line0) {
+        rec = hot_rec(lines, idx);
+        ret = &hot_slab(lines, rec->slab)->buf[rec->off];
+        *len = rec->len;
+        *runs = (const lines_run_t *)&hot_slab(lines, rec->slab)->buf[
+            RUNS_OFF(rec->off + rec->len)
+        ];
+        *n_runs = rec->n_runs;
+        return ret;
+    }
+
+    srec = spilled_rec(lines, idx);
+    if (
+        !srec ||
+        map_file(
+            lines->spill_dat,
+            RUNS_OFF(srec->off + srec->len) + sizeof(lines_run_t) * srec->n_runs,
+            &lines->map_dat, &lines->map_dat_sz
+        )
+    ) {
+        *len = 0;
+        *runs = NULL;
+        *n_runs = 0;
+        return (const uint8_t *)"";
+    }
+
+    ret = &lines->map_dat[srec->off];
+    *len = srec->len;
+    *runs = (const lines_run_t *)&lines->map_dat[RUNS_OFF(srec->off + srec->len)];
+    *n_runs = srec->n_runs;
+    return ret;
+}
+
+int
+lines_len(lines_t *lines, int idx)
+{
+    const spill_rec_t *srec;
+
+    if (idx >= lines->line0)
+        return hot_rec(lines, idx)->len;
+
+    srec = spilled_rec(lines, idx);
+    return srec ? srec->len : 0;
+}
+
+int
+lines_find(lines_t *lines, int idx, int dir, const char *s, int s_len, int *col)
+{
+    if (lines->n_lines == 0 || s_len <= 0)
+        return -1;
+
+    if (idx >= lines->n_lines)
+        idx = lines->n_lines - 1;
+    if (idx < 0)
+        idx = 0;
+
+    /* a segment is bytes that can be searched in one go, a slab or all of
+     * the spilled lines */
+    while (idx >= 0 && idx < lines->n_lines) {
+        int first, last, hit;
+        const uint8_t *base = segment(lines, idx, &first, &last);
+
+        if (!base)
+            return -1;
+
+        if (dir > 0) {
+            hit = find_in(lines, base, idx, last, dir, s, s_len, col);
+            idx = last + 1;
+        }
+        else {
+            hit = find_in(lines, base, first, idx, dir, s, s_len, col);
+            idx = first - 1;
+        }
+
+        if (hit >= 0)
+            return hit;
+    }
+
+    return -1;
+}
+
+int
+lines_spill(lines_t *lines, const char *path, int max_lines, size_t max_mem)
+{
+    if (open_spill(lines, path, O_TRUNC))
+        return -1;
+
+    lines->max_lines = max_lines;
+    lines->max_mem = max_mem;
+    spill_old(lines);
+
+    return 0;
+}
+
+int
+lines_load(
+    lines_t *lines,
+    const char *from,
+    const char *path,
+    int max_lines,
+    size_t max_mem
+)
+{
+#ifdef __MINGW32__
+    return -1;
+#else
+    struct stat dat_st, idx_st;
+    spill_rec_t last;
+    size_t n = 0;
+
+    if (lines->n_lines > 0 || move_spill(from, path) || open_spill(lines, path, 0))
+        return -1;
+
+    /* anything that does not add up gets thrown away */
+    if (
+        !fstat(lines->spill_dat, &dat_st) &&
+        !fstat(lines->spill_idx, &idx_st) &&
+        idx_st.st_size % sizeof(spill_rec_t) == 0
+    ) {
+        n = idx_st.st_size / sizeof(spill_rec_t);
+    }
+    if (n > 0 && (
+        pread(
+            lines->spill_idx, &last, sizeof(last),
+            (off_t)(n - 1) * sizeof(spill_rec_t)
+        ) != sizeof(last) ||
+        last.off + last.len > (uint64_t)dat_st.st_size ||
+        (
+            last.n_runs &&
+            RUNS_OFF(last.off + last.len) + sizeof(lines_run_t) * last.n_runs >
+                (uint64_t)dat_st.st_size
+        )
+    )) {
+        n = 0;
+    }
+
+    /* an empty last line would only be followed by another one */
+    if (n > 0 && last.len == 0)
+        n--;
+
+    if (n == 0) {
+        close(lines->spill_dat);
+        close(lines->spill_idx);
+        unlink_spill(path);
+        free(lines->spill_path);
+        lines->spill_path = NULL;
+        lines->spill = 0;
+        return -1;
+    }
+
+    lines->line0 = n;
+    lines->n_lines = n;
+    lines->spill_dat_sz = (dat_st.st_size + 7) & ~(uint64_t)7;
+
+    /* the saved lines are finished, new output starts a line of its own */
+    if (lines_newline(lines))
+        return -1;
+
+    lines->max_lines = max_lines;
+    lines->max_mem = max_mem;
+    spill_old(lines);
+
+    return 0;
+#endif
+}
+
+int
+lines_save(lines_t *lines, const char *path)
+{
+#ifdef __MINGW32__
+    return -1;
+#else
+    int ret;
+
+    if (!lines->spill || !lines->spill_path)
+        return -1;
+
+    while (lines->n_slabs > 0) {
+        if (spill_slab(lines))
+            return -1;
+    }
+
+    ret = move_spill(lines->spill_path, path);
+    free(lines->spill_path);
+    lines->spill_path = NULL;
+
+    return ret;
+#endif
+}
+
+void
+lines_free(lines_t *lines)
+{
+    for (int i = 0; i < lines->n_slabs; i++) {
+        free(lines->slabs[lines->slabs_head + i].buf);
+    }
+    free(lines->slabs);
+    free(lines->recs);
+
+#ifndef __MINGW32__
+    if (lines->map_dat)
+        munmap(lines->map_dat, lines->map_dat_sz);
+    if (lines->map_idx)
+        munmap(lines->map_idx, lines->map_idx_sz);
+    if (lines->spill) {
+        close(lines->spill_dat);
+        close(lines->spill_idx);
+    }
+    if (lines->spill_path) {
+        unlink_spill(lines->spill_path);
+        free(lines->spill_path);
+    }
+#endif
+
+    memset(lines, 0, sizeof(lines_t));
+}
+
+/* make room for need bytes from the start of the last line. The last line
+ * always sits at the end of the newest slab, it gets moved to a fresh slab
+ * once it outgrows this one. */
+static lines_slab_t *
+fit_last(lines_t *lines, size_t need)
+{
+    lines_rec_t *rec = hot_rec(lines, lines->n_lines - 1);
+    lines_slab_t *slab = hot_slab(lines, rec->slab);
+    lines_slab_t *old;
+
+    if (rec->off + need <= slab->size)
+        return slab;
+
+    if (!new_slab(lines, need * 2))
+        return NULL;
+
+    old = hot_slab(lines, rec->slab);
+    slab = &lines->slabs[lines->slabs_head + lines->n_slabs - 1];
+    memcpy(slab->buf, &old->buf[rec->off], rec->len);
+    old->used = rec->off;
+
+    rec->slab = lines->slab0 + lines->n_slabs - 1;
+    rec->off = 0;
+
+    return slab;
+}
+
+/* append a slab of at least min_sz bytes */
+static lines_slab_t *
+new_slab(lines_t *lines, size_t min_sz)
+{
+    lines_slab_t *slab;
+    size_t sz = LINES_SLAB_SZ;
+
+    while (sz < min_sz) {
+        sz *= 2;
+    }
+
+    if (lines->slabs_head + lines->n_slabs == lines->slabs_cap) {
+        if (lines->slabs_head > 0 && lines->slabs_head >= lines->slabs_cap / 2) {
+            memmove(
+                lines->slabs,
+                &lines->slabs[lines->slabs_head],
+                sizeof(lines_slab_t) * lines->n_slabs
+            );
+            lines->slabs_head = 0;
+        } else {
+            int cap = lines->slabs_cap ? lines->slabs_cap * 2 : 16;
+            lines_slab_t *slabs = realloc(lines->slabs, sizeof(lines_slab_t) * cap);
+
+            if (!slabs)
+                return NULL;
+
+            lines->slabs = slabs;
+            lines->slabs_cap = cap;
+        }
+    }
+
+    slab = &lines->slabs[lines->slabs_head + lines->n_slabs];
+    slab->buf = malloc(sz);
+    if (!slab->buf)
+        return NULL;
+    slab->size = sz;
+    slab->used = 0;
+    lines->n_slabs++;
+    lines->mem += sz;
+
+    return slab;
+}
+
+static lines_rec_t *
+hot_rec(lines_t *lines, int idx)
+{
+    return &lines->recs[lines->recs_head + (idx - lines->line0)];
+}
+
+static lines_slab_t *
+hot_slab(lines_t *lines, uint32_t slab)
+{
+    return &lines->slabs[lines->slabs_head + (slab - lines->slab0)];
+}
+
+/* open path.dat and path.idx to spill to, flags get added to the open flags */
+static int
+open_spill(lines_t *lines, const char *path, int flags)
+{
+#ifdef __MINGW32__
+    return -1;
+#else
+    size_t path_len = strlen(path);
+    char *fname = malloc(path_len + 5);
+
+    sprintf(fname, "%s.dat", path);
+    lines->spill_dat = open(fname, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0600);
+
+    sprintf(fname, "%s.idx", path);
+    lines->spill_idx = open(fname, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0600);
+
+    free(fname);
+
+    if (lines->spill_dat < 0 || lines->spill_idx < 0) {
+        if (lines->spill_dat >= 0)
+            close(lines->spill_dat);
+        if (lines->spill_idx >= 0)
+            close(lines->spill_idx);
+        unlink_spill(path);
+        return -1;
+    }
+
+    lines->spill = 1;
+    lines->spill_path = strdup(path);
+
+    return 0;
+#endif
+}
+
+static void
+unlink_spill(const char *path)
+{
+    char *fname = malloc(strlen(path) + 5);
+
+    sprintf(fname, "%s.dat", path);
+    unlink(fname);
+    sprintf(fname, "%s.idx", path);
+    unlink(fname);
+
+    free(fname);
+}
+
+/* rename the spill files at from to to */
+static int
+move_spill(const char *from, const char *to)
+{
+    char *src = malloc(strlen(from) + 5);
+    char *dst = malloc(strlen(to) + 5);
+    int ret = 0;
+
+    sprintf(src, "%s.dat", from);
+    sprintf(dst, "%s.dat", to);
+    ret |= rename(src, dst);
+    sprintf(src, "%s.idx", from);
+    sprintf(dst, "%s.idx", to);
+    ret |= rename(src, dst);
+
+    free(src);
+    free(dst);
+
+    return ret ? -1 : 0;
+}
+
+/* spill the oldest slabs until we are back under the limits, the newest slab
+ * holds the line being written so it always stays */
+static void
+spill_old(lines_t *lines)
+{
+    if (!lines->spill)
+        return;
+
+    while (
+        lines->n_slabs > 1 &&
+        (
+            (lines->max_mem && lines->mem > lines->max_mem) ||
+            (lines->max_lines && (lines->n_lines - lines->line0) > lines->max_lines)
+        )
+    ) {
+        if (spill_slab(lines)) {
+            /* disk trouble, just stop spilling and keep lines in memory */
+            lines->max_lines = 0;
+            lines->max_mem = 0;
+            break;
+        }
+    }
+}
+
+/* write out the oldest hot slab and the records of its lines */
+static int
+spill_slab(lines_t *lines)
+{
+#ifdef __MINGW32__
+    return -1;
+#else
+    lines_slab_t *slab = &lines->slabs[lines->slabs_head];
+    spill_rec_t *srecs;
+    int n = 0;
+    ssize_t ret;
+
+    /* records are ordered by slab, so this slab's lines come first */
+    while (
+        lines->line0 + n < lines->n_lines &&
+        hot_rec(lines, lines->line0 + n)->slab == lines->slab0
+    ) {
+        n++;
+    }
+
+    srecs = calloc(n ? n : 1, sizeof(spill_rec_t));
+    for (int i = 0; i < n; i++) {
+        lines_rec_t *rec = hot_rec(lines, lines->line0 + i);
+
+        srecs[i].off = lines->spill_dat_sz + rec->off;
+        srecs[i].len = rec->len;
+        srecs[i].n_runs = rec->n_runs;
+        srecs[i].t_ns = rec->t_ns;
+    }
+
+    ret = pwrite(lines->spill_dat, slab->buf, slab->used, lines->spill_dat_sz);
+    if (ret != (ssize_t)slab->used) {
+        free(srecs);
+        return -1;
+    }
+
+    ret = pwrite(
+        lines->spill_idx, srecs, sizeof(spill_rec_t) * n,
+        (off_t)lines->line0 * sizeof(spill_rec_t)
+    );
+    free(srecs);
+    if (ret != (ssize_t)(sizeof(spill_rec_t) * n))
+        return -1;
+
+    /* keep slabs 8 byte aligned in the file so mapped runs stay aligned */
+    lines->spill_dat_sz += (slab->used + 7) & ~(size_t)7;
+    lines->mem -= slab->size;
+    free(slab->buf);
+    lines->slabs_head++;
+    lines->n_slabs--;
+    lines->slab0++;
+
+    lines->line0 += n;
+    lines->recs_head += n;
+
+    return 0;
+#endif
+}
+
+static const spill_rec_t *
+spilled_rec(lines_t *lines, int idx)
+{
+    size_t end = ((size_t)idx + 1) * sizeof(spill_rec_t);
+
+    if (map_file(lines->spill_idx, end, &lines->map_idx, &lines->map_idx_sz))
+        return NULL;
+
+    return &((const spill_rec_t *)lines->map_idx)[idx];
+}
+
+/* make sure at least need bytes of fd are mapped at *map */
+static int
+map_file(int fd, size_t need, uint8_t **map, size_t *map_sz)
+{
+#ifdef __MINGW32__
+    return -1;
+#else
+    size_t sz;
+    void *ret;
+
+    if (need <= *map_sz)
+        return 0;
+
+    /* map ahead of the file size so we remap rarely */
+    sz = *map_sz ? *map_sz : (1 << 20);
+    while (sz < need) {
+        sz *= 2;
+    }
+
+    if (*map) {
+        munmap(*map, *map_sz);
+        *map = NULL;
+        *map_sz = 0;
+    }
+
+    ret = mmap(NULL, sz, PROT_READ, MAP_SHARED, fd, 0);
+    if (ret == MAP_FAILED)
+        return -1;
+
+    *map = ret;
+    *map_sz = sz;
+
+    return 0;
+#endif
+}
+
+/* offset of line idx within its segment and its length */
+static void
+line_loc(lines_t *lines, int idx, size_t *off, int *len)
+{
+    const spill_rec_t *srec;
+
+    if (idx >= lines->line0) {
+        *off = hot_rec(lines, idx)->off;
+        *len = hot_rec(lines, idx)->len;
+        return;
+    }
+
+    srec = spilled_rec(lines, idx);
+    *off = srec ? srec->off : 0;
+    *len = srec ? srec->len : 0;
+}
+
+/* the last line from first to last that starts at or before offset at */
+static int
+line_at(lines_t *lines, int first, int last, size_t at)
+{
+    while (first < last) {
+        int mid = first + (last - first + 1) / 2;
+        size_t off;
+        int len;
+
+        line_loc(lines, mid, &off, &len);
+        if (off <= at)
+            first = mid;
+        else
+            last = mid - 1;
+    }
+
+    return first;
+}
+
+/* get the bytes of the segment holding line idx and its first and last line */
+static const uint8_t *
+segment(lines_t *lines, int idx, int *first, int *last)
+{
+    uint32_t slab;
+    int lo, hi;
+
+    if (idx < lines->line0) {
+        size_t off;
+        int len;
+
+        line_loc(lines, lines->line0 - 1, &off, &len);
+        if (map_file(lines->spill_dat, off + len, &lines->map_dat, &lines->map_dat_sz))
+            return NULL;
+
+        *first = 0;
+        *last = lines->line0 - 1;
+        return lines->map_dat;
+    }
+
+    /* records are ordered by slab */
+    slab = hot_rec(lines, idx)->slab;
+
+    lo = lines->line0;
+    hi = idx;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (hot_rec(lines, mid)->slab < slab)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+
+    lo = idx;
+    hi = lines->n_lines - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+
+        if (hot_rec(lines, mid)->slab > slab)
+            hi = mid - 1;
+        else
+            lo = mid;
+    }
+    *last = lo;
+
+    return hot_slab(lines, slab)->buf;
+}
+
+/* find s in lines first to last of a segment, the one closest to first when
+ * dir > 0 and closest to last otherwise. Lines sit back to back in the
+ * segment so the whole range gets scanned at once, hits that are not within
+ * a single line are skipped. */
+static int
+find_in(
+    lines_t *lines,
+    const uint8_t *base,
+    int first,
+    int last,
+    int dir,
+    const char *s,
+    int s_len,
+    int *col
+)
+{
+    const char *buf = (const char *)base;
+    size_t lo, hi, end, off;
+    int len;
+
+    line_loc(lines, first, &lo, &len);
+    line_loc(lines, last, &off, &len);
+    hi = off + len;
+
+    if (dir > 0) {
+        while (lo + s_len <= hi) {
+            size_t at = lo + scan_find(&buf[lo], hi - lo, s, s_len);
+            int line;
+
+            if (at >= hi)
+                break;
+
+            line = line_at(lines, first, last, at);
+            line_loc(lines, line, &off, &len);
+            if (at + s_len <= off + len) {
+                *col = at - off;
+                return line;
+            }
+
+            lo = at + 1;
+        }
+
+        return -1;
+    }
+
+    /* toward older lines, take chunks from the back and keep the last hit of
+     * the first chunk that has one */
+    for (end = hi; end > lo;) {
+        size_t start = end - lo > FIND_CHUNK ? end - FIND_CHUNK : lo;
+        size_t stop = end + s_len - 1 < hi ? end + s_len - 1 : hi;
+        size_t p = start;
+        int found = -1;
+
+        while (p + s_len <= stop) {
+            size_t at = p + scan_find(&buf[p], stop - p, s, s_len);
+            int line;
+
+            if (at >= stop)
+                break;
+
+            line = line_at(lines, first, last, at);
+            line_loc(lines, line, &off, &len);
+            if (at + s_len <= off + len) {
+                found = line;
+                *col = at - off;
+            }
+
+            p = at + 1;
+        }
+
+        if (found >= 0)
+            return found;
+
+        end = start;
+    }
+
+    return -1;
+}
@@ -0,0 +1,131 @@
+#ifndef _LINES_H_
+#define _LINES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Append-only storage for lines of output. Line bytes are packed back to back
+ * into large slabs and a geometrically grown index records where each line
+ * lives, so appending never reallocs per byte or per line. Only the last line
+ * can be written to. When a line is finished it can be given a list of
+ * attribute runs, which are packed into the slab right after its bytes.
+ *
+ * With a spill file set up, only a hot window of the newest slabs is kept in
+ * memory. Older slabs and their index records get written out to disk and are
+ * memory mapped back in when they are read. The spill files can be saved when
+ * done and loaded again later, the saved lines are then mapped in as spilled
+ * lines without being read up front. */
+
+#define LINES_SLAB_SZ (64 * 1024)
+
+typedef struct lines_slab_struct {
+    uint8_t *buf;
+    size_t size; /* allocated bytes */
+    size_t used; /* bytes handed out to lines */
+} lines_slab_t;
+
+/* attr applies from column col up to the next run */
+typedef struct lines_run_struct {
+    uint32_t col;
+    uint32_t attr;
+} lines_run_t;
+
+typedef struct lines_rec_struct {
+    uint64_t t_ns; /* when the line started coming in, 0 if not known */
+    uint32_t slab; /* absolute slab number */
+    uint32_t off; /* offset of the line within the slab */
+    int len;
+    uint32_t n_runs;
+} lines_rec_t;
+
+typedef struct lines_struct {
+    lines_slab_t *slabs; /* hot slabs start at slabs[slabs_head] */
+    int slabs_head;
+    int n_slabs; /* hot slabs */
+    int slabs_cap;
+    uint32_t slab0; /* absolute number of the oldest hot slab */
+    lines_rec_t *recs; /* hot records start at recs[recs_head] */
+    int recs_head;
+    int recs_cap;
+    int line0; /* index of the oldest line still in memory */
+    int n_lines; /* total number of lines, in memory or not */
+    size_t mem; /* bytes of slabs in memory */
+    /* spilling, only used once lines_spill succeeded */
+    int spill;
+    int max_lines; /* lines to keep in memory, 0 for no limit */
+    size_t max_mem; /* slab bytes to keep in memory, 0 for no limit */
+    int spill_dat; /* line bytes of spilled slabs */
+    int spill_idx; /* records of spilled lines */
+    char *spill_path; /* the files are removed on free unless saved */
+    uint64_t spill_dat_sz;
+    uint8_t *map_dat;
+    size_t map_dat_sz;
+    uint8_t *map_idx;
+    size_t map_idx_sz;
+} lines_t;
+
+/* Start a new empty line at the end of the store */
+int lines_newline(lines_t *lines);
+
+/* Write len bytes into the last line at column pos, growing the line if the
+ * write goes past its end. pos must not be past the end of the line. */
+int lines_write(lines_t *lines, int pos, const void *buf, int len);
+
+/* Attach attribute runs to the last line. The line must not be written to
+ * afterwards, so this is called right before lines_newline. */
+int lines_finish(lines_t *lines, const lines_run_t *runs, int n_runs);
+
+/* Set the time the last line started coming in, in ns since the epoch */
+void lines_set_time(lines_t *lines, uint64_t t_ns);
+
+/* Time line idx started coming in, 0 if not known */
+uint64_t lines_time(lines_t *lines, int idx);
+
+/* Get the bytes of line idx and store its length in len. The pointer stays
+ * valid until the next call into the store. */
+const uint8_t *lines_get(lines_t *lines, int idx, int *len);
+
+/* Like lines_get, but also get the attribute runs of the line. The run
+ * pointer stays valid as long as the line pointer does. */
+const uint8_t *lines_get_runs(
+    lines_t *lines,
+    int idx,
+    int *len,
+    const lines_run_t **runs,
+    int *n_runs
+);
+
+/* Get the length of line idx */
+int lines_len(lines_t *lines, int idx);
+
+/* Find the nearest line holding the s_len bytes of s, looking from line idx
+ * toward the newest line when dir > 0 and toward the oldest otherwise, idx
+ * included. Stores the column of the match in col. Returns the line, or -1
+ * if no line has it. */
+int lines_find(lines_t *lines, int idx, int dir, const char *s, int s_len, int *col);
+
+/* Keep at most max_lines lines and max_mem bytes in memory (0 for no limit),
+ * older lines get spilled to files at path.dat and path.idx. The files get
+ * removed by lines_free unless lines_save moved them. */
+int lines_spill(lines_t *lines, const char *path, int max_lines, size_t max_mem);
+
+/* Like lines_spill, but the files saved at from by lines_save are moved to
+ * path and their lines become the first lines of the empty store. Only the
+ * last record is looked at, so this takes the same time for any number of
+ * lines. Returns -1 if there are no saved lines to load. */
+int lines_load(
+    lines_t *lines,
+    const char *from,
+    const char *path,
+    int max_lines,
+    size_t max_mem
+);
+
+/* Spill every line and move the spill files to path.dat and path.idx for
+ * lines_load. The store can only be freed afterwards. */
+int lines_save(lines_t *lines, const char *path);
+
+/* Release all memory and files held by the store */
+void lines_free(lines_t *lines);
+
+#endif /* _LINES_H_ */
@@ -0,0 +1,719 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bstr.h"
+#include "logger.h"
+
+/* the index starts with a header line, followed by fixed width records so
+ * the last one can be rewritten in place */
+#define INDEX_HEADER "# seg first_line last_line first_ts last_ts bytes\n"
+#define INDEX_HEADER_LEN (sizeof(INDEX_HEADER) - 1)
+#define INDEX_REC_FMT "%6d %12llu %12llu %14.3f %14.3f %14llu\n"
+#define INDEX_REC_LEN (78)
+
+typedef struct log_file_struct {
+    int fd;
+    /* rotation, idx_fd is -1 when the file is not rotated */
+    int idx_fd;
+    char *path;
+    logger_segment_t seg; /* the segment being written */
+    uint64_t lines; /* lines ended in all segments so far */
+    int line_start; /* the last byte written ended a line */
+} log_file_t;
+
+typedef struct logger_struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thr;
+    int running;
+    log_file_t files[LOGGER_MAX_FILES];
+    int n_files;
+    uint8_t *front; /* producers append here */
+    size_t front_len;
+    size_t front_cap;
+    double front_t0; /* wall clock of the first and last bytes in front */
+    double front_t1;
+    uint8_t *back; /* the writer thread writes this out */
+    size_t back_cap;
+    size_t flushing; /* bytes of back being written */
+    size_t dropped;
+    int mark_drops; /* the files are text, tell their readers about drops */
+    size_t unmarked; /* dropped since the last marker */
+    int line_start; /* the last byte queued ended a line */
+    /* rotation of files added from now on */
+    size_t max_bytes;
+    int max_secs;
+    int keep;
+} logger_t;
+
+static void *logger_thread(void *arg);
+static int add_fd(logger_t *lg, const char *path, int flags);
+static int open_index(logger_t *lg, log_file_t *f, int flags);
+static int continue_index(log_file_t *f);
+static void write_segmented(
+    logger_t *lg,
+    log_file_t *f,
+    const uint8_t *buf,
+    size_t len,
+    double t0,
+    double t1
+);
+static void next_segment(logger_t *lg, log_file_t *f);
+static void put_record(log_file_t *f);
+static void remove_segments(const char *path);
+static char *index_path(const char *path);
+static uint64_t count_lines(const uint8_t *buf, size_t len);
+static double wall_time(void);
+static void write_all(int fd, const uint8_t *buf, size_t len);
+
+logger_handle
+logger_create(void)
+{
+    logger_t *ret = calloc(1, sizeof(logger_t));
+
+    pthread_mutex_init(&ret->lock, NULL);
+    pthread_cond_init(&ret->cond, NULL);
+    ret->running = 1;
+    ret->line_start = 1;
+
+    if (pthread_create(&ret->thr, NULL, logger_thread, ret)) {
+        pthread_mutex_destroy(&ret->lock);
+        pthread_cond_destroy(&ret->cond);
+        free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+void
+logger_rotate(logger_handle lg, size_t max_bytes, int max_secs, int keep)
+{
+    lg->max_bytes = max_bytes;
+    lg->max_secs = max_secs;
+    lg->keep = keep;
+}
+
+int
+logger_add_file(logger_handle lg, const char *path)
+{
+    return add_fd(lg, path, O_TRUNC);
+}
+
+int
+logger_append_file(logger_handle lg, const char *path)
+{
+    return add_fd(lg, path, O_APPEND);
+}
+
+void
+logger_mark_drops(logger_handle lg)
+{
+    pthread_mutex_lock(&lg->lock);
+    lg->mark_drops = 1;
+    pthread_mutex_unlock(&lg->lock);
+}
+
+int
+logger_nfiles(logger_handle lg)
+{
+    return lg ? lg->n_files : 0;
+}
+
+void
+logger_write(logger_handle lg, const void *buf, size_t len)
+{
+    logger_write_rec(lg, NULL, 0, buf, len);
+}
+
+void
+logger_write_rec(
+    logger_handle lg,
+    const void *hdr,
+    size_t hdr_len,
+    const void *buf,
+    size_t len
+)
+{
+    double now = 0;
+    char mark[64];
+    size_t mark_len = 0;
+    uint8_t *dst;
+
+    len += hdr_len;
+    if (len == 0)
+        return;
+
+    /* only the segment index needs to know when bytes came in */
+    if (lg->max_bytes || lg->max_secs)
+        now = wall_time();
+
+    pthread_mutex_lock(&lg->lock);
+
+    /* a line in the file where bytes went missing, on its own */
+    if (lg->mark_drops && lg->unmarked) {
+        mark_len = snprintf(
+            mark, sizeof(mark), "%s[bytenuts: %zu bytes dropped]\n",
+            lg->line_start ? "" : "\n", lg->unmarked
+        );
+    }
+
+    if (lg->front_len + mark_len + len > lg->front_cap) {
+        size_t cap = lg->front_cap ? lg->front_cap : 64 * 1024;
+        uint8_t *front;
+
+        while (cap < lg->front_len + mark_len + len) {
+            cap *= 2;
+        }
+
+        if (lg->front_len + lg->flushing + mark_len + len > LOGGER_MAX_BACKLOG) {
+            lg->dropped += len;
+            lg->unmarked += len;
+            pthread_mutex_unlock(&lg->lock);
+            return;
+        }
+
+        front = realloc(lg->front, cap);
+        if (!front) {
+            lg->dropped += len;
+            lg->unmarked += len;
+            pthread_mutex_unlock(&lg->lock);
+            return;
+        }
+
+        lg->front = front;
+        lg->front_cap = cap;
+    }
+
+    dst = &lg->front[lg->front_len];
+    memcpy(dst, mark, mark_len);
+    if (hdr_len)
+        memcpy(&dst[mark_len], hdr, hdr_len);
+    memcpy(&dst[mark_len + hdr_len], buf, len - hdr_len);
+    if (lg->front_len == 0) {
+        lg->front_t0 = now;
+        pthread_cond_signal(&lg->cond);
+    }
+    lg->front_t1 = now;
+    lg->front_len += mark_len + len;
+    lg->unmarked = 0;
+    lg->line_start = dst[mark_len + len - 1] == '\n';
+
+    pthread_mutex_unlock(&lg->lock);
+}
+
+size_t
+logger_backlog(logger_handle lg)
+{
+    size_t ret;
+
+    pthread_mutex_lock(&lg->lock);
+    ret = lg->front_len + lg->flushing;
+    pthread_mutex_unlock(&lg->lock);
+
+    return ret;
+}
+
+size_t
+logger_dropped(logger_handle lg)
+{
+    size_t ret;
+
+    pthread_mutex_lock(&lg->lock);
+    ret = lg->dropped;
+    pthread_mutex_unlock(&lg->lock);
+
+    return ret;
+}
+
+void
+logger_destroy(logger_handle lg)
+{
+    if (!lg)
+        return;
+
+    pthread_mutex_lock(&lg->lock);
+    lg->running = 0;
+    pthread_cond_signal(&lg->cond);
+    pthread_mutex_unlock(&lg->lock);
+
+    pthread_join(lg->thr, NULL);
+
+    for (int i = 0; i < lg->n_files; i++) {
+        close(lg->files[i].fd);
+        if (lg->files[i].idx_fd >= 0)
+            close(lg->files[i].idx_fd);
+        free(lg->files[i].path);
+    }
+
+    pthread_mutex_destroy(&lg->lock);
+    pthread_cond_destroy(&lg->cond);
+    free(lg->front);
+    free(lg->back);
+    free(lg);
+}
+
+int
+logger_read_index(const char *path, logger_segment_t **segs)
+{
+    char *idx_path = index_path(path);
+    FILE *fd = fopen(idx_path, "r");
+    char line[128];
+    int n = 0, cap = 0;
+
+    free(idx_path);
+    *segs = NULL;
+
+    if (!fd)
+        return 0;
+
+    while (fgets(line, sizeof(line), fd)) {
+        logger_segment_t seg;
+        unsigned long long first_line, last_line, bytes;
+
+        if (
+            line[0] == '#' ||
+            sscanf(
+                line, "%d %llu %llu %lf %lf %llu",
+                &seg.seg, &first_line, &last_line,
+                &seg.first_ts, &seg.last_ts, &bytes
+            ) != 6
+        ) {
+            continue;
+        }
+
+        seg.first_line = first_line;
+        seg.last_line = last_line;
+        seg.bytes = bytes;
+
+        if (n == cap) {
+            logger_segment_t *tmp;
+
+            cap = cap ? cap * 2 : 16;
+            tmp = realloc(*segs, sizeof(logger_segment_t) * cap);
+            if (!tmp)
+                break;
+            *segs = tmp;
+        }
+        (*segs)[n++] = seg;
+    }
+
+    fclose(fd);
+
+    return n;
+}
+
+char *
+logger_segment_path(const char *path, int seg)
+{
+    return bstr_print(strdup(path), ".%d", seg);
+}
+
+int
+logger_move(const char *from, const char *to)
+{
+    logger_segment_t *segs;
+    char *from_idx, *to_idx;
+    int n;
+
+    if (access(from, F_OK))
+        return -1;
+
+    remove_segments(to);
+
+    if (rename(from, to))
+        return -1;
+
+    n = logger_read_index(from, &segs);
+    for (int i = 0; i < n - 1; i++) {
+        char *src = logger_segment_path(from, segs[i].seg);
+        char *dst = logger_segment_path(to, segs[i].seg);
+
+        rename(src, dst);
+        free(src);
+        free(dst);
+    }
+    free(segs);
+
+    from_idx = index_path(from);
+    to_idx = index_path(to);
+    rename(from_idx, to_idx);
+    free(from_idx);
+    free(to_idx);
+
+    return 0;
+}
+
+static void *
+logger_thread(void *arg)
+{
+    logger_t *lg = arg;
+
+    pthread_mutex_lock(&lg->lock);
+
+    while (1) {
+        uint8_t *tmp;
+        size_t tmp_cap;
+        double t0, t1;
+
+        while (lg->running && lg->front_len == 0) {
+            pthread_cond_wait(&lg->cond, &lg->lock);
+        }
+
+        /* keep going until everything queued before the stop is written */
+        if (lg->front_len == 0)
+            break;
+
+        tmp = lg->back;
+        tmp_cap = lg->back_cap;
+        lg->back = lg->front;
+        lg->back_cap = lg->front_cap;
+        lg->flushing = lg->front_len;
+        lg->front = tmp;
+        lg->front_cap = tmp_cap;
+        lg->front_len = 0;
+        t0 = lg->front_t0;
+        t1 = lg->front_t1;
+
+        pthread_mutex_unlock(&lg->lock);
+
+        for (int i = 0; i < lg->n_files; i++) {
+            if (lg->files[i].idx_fd >= 0)
+                write_segmented(lg, &lg->files[i], lg->back, lg->flushing, t0, t1);
+            else
+                write_all(lg->files[i].fd, lg->back, lg->flushing);
+        }
+
+        pthread_mutex_lock(&lg->lock);
+        lg->flushing = 0;
+    }
+
+    pthread_mutex_unlock(&lg->lock);
+
+    return NULL;
+}
+
+static int
+add_fd(logger_t *lg, const char *path, int flags)
+{
+    log_file_t f = { .idx_fd = -1 };
+
+    if (lg->n_files == LOGGER_MAX_FILES)
+        return -1;
+
+    if ((lg->max_bytes || lg->max_secs) && !(flags & O_APPEND))
+        remove_segments(path);
+
+    f.fd = open(path, O_WRONLY | O_CREAT | flags, 0644);
+    if (f.fd < 0)
+        return -1;
+
+    /* without an index the file is still written, just never rotated */
+    if (lg->max_bytes || lg->max_secs) {
+        f.path = strdup(path);
+        open_index(lg, &f, flags);
+    }
+
+    pthread_mutex_lock(&lg->lock);
+    lg->files[lg->n_files] = f;
+    lg->n_files++;
+    pthread_mutex_unlock(&lg->lock);
+
+    return 0;
+}
+
+/* set up the index for a new log, or pick up where the last record of an old
+ * one left off */
+static int
+open_index(logger_t *lg, log_file_t *f, int flags)
+{
+    char *idx_path = index_path(f->path);
+    int cont = (flags & O_APPEND) && !access(idx_path, F_OK);
+
+    f->idx_fd = open(idx_path, O_RDWR | O_CREAT | (cont ? 0 : O_TRUNC), 0644);
+    free(idx_path);
+    if (f->idx_fd < 0)
+        return -1;
+
+    f->seg.seg = 1;
+    f->line_start = 1;
+
+    if (cont && !continue_index(f))
+        return 0;
+
+    /* a new index, or an old log that was not rotated before */
+    if (
+        ftruncate(f->idx_fd, 0) ||
+        lseek(f->idx_fd, 0, SEEK_SET) != 0 ||
+        write(f->idx_fd, INDEX_HEADER, INDEX_HEADER_LEN) != INDEX_HEADER_LEN
+    ) {
+        close(f->idx_fd);
+        f->idx_fd = -1;
+        return -1;
+    }
+
+    f->seg.bytes = lseek(f->fd, 0, SEEK_END);
+    if (f->seg.bytes > 0) {
+        /* number the lines already in the log, this happens once */
+        int fd = open(f->path, O_RDONLY);
+        uint8_t buf[64 * 1024];
+        ssize_t ret;
+
+        while (fd >= 0 && (ret = read(fd, buf, sizeof(buf))) > 0) {
+            f->lines += count_lines(buf, ret);
+            f->line_start = buf[ret - 1] == '\n';
+        }
+        if (fd >= 0)
+            close(fd);
+
+        f->seg.first_ts = f->seg.last_ts = wall_time();
+        f->seg.last_line = f->line_start ? f->lines - 1 : f->lines;
+        put_record(f);
+    }
+
+    return 0;
+}
+
+/* read back the last record of the index and check it against the log */
+static int
+continue_index(log_file_t *f)
+{
+    off_t end = lseek(f->idx_fd, 0, SEEK_END);
+    char rec[INDEX_REC_LEN + 1];
+    unsigned long long first_line, last_line, bytes;
+    uint8_t buf[64 * 1024];
+    uint8_t last = '\n';
+    ssize_t ret;
+    int fd;
+
+    if (
+        end < (off_t)(INDEX_HEADER_LEN + INDEX_REC_LEN) ||
+        (end - INDEX_HEADER_LEN) % INDEX_REC_LEN ||
+        lseek(f->idx_fd, end - INDEX_REC_LEN, SEEK_SET) < 0 ||
+        read(f->idx_fd, rec, INDEX_REC_LEN) != INDEX_REC_LEN
+    ) {
+        return -1;
+    }
+    rec[INDEX_REC_LEN] = 0;
+
+    if (
+        sscanf(
+            rec, "%d %llu %llu %lf %lf %llu",
+            &f->seg.seg, &first_line, &last_line,
+            &f->seg.first_ts, &f->seg.last_ts, &bytes
+        ) != 6
+    ) {
+        return -1;
+    }
+
+    /* the log may have more in it than the record if we did not get to
+     * rewrite it, only the start of the segment is trusted */
+    f->seg.first_line = first_line;
+    f->seg.bytes = lseek(f->fd, 0, SEEK_END);
+
+    fd = open(f->path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    /* only the newest segment gets read to number its lines */
+    f->lines = first_line;
+    while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+        f->lines += count_lines(buf, ret);
+        last = buf[ret - 1];
+    }
+    close(fd);
+
+    f->line_start = last == '\n';
+    f->seg.last_line = f->line_start && f->lines > 0 ? f->lines - 1 : f->lines;
+
+    /* the record gets rewritten in place from now on */
+    lseek(f->idx_fd, end - INDEX_REC_LEN, SEEK_SET);
+
+    return 0;
+}
+
+/* write buf to the segment, moving to the next segment at the end of the line
+ * that fills it up or the first line after it got too old */
+static void
+write_segmented(
+    logger_t *lg,
+    log_file_t *f,
+    const uint8_t *buf,
+    size_t len,
+    double t0,
+    double t1
+)
+{
+    while (len > 0) {
+        size_t n = len;
+        int cut = 0;
+        const uint8_t *nl;
+
+        if (lg->max_secs && f->seg.bytes > 0 && t1 - f->seg.first_ts >= lg->max_secs) {
+            if (f->line_start) {
+                next_segment(lg, f);
+                continue;
+            }
+
+            nl = memchr(buf, '\n', n);
+            if (nl) {
+                n = nl - buf + 1;
+                cut = 1;
+            }
+        }
+
+        if (!cut && lg->max_bytes && f->seg.bytes + n >= lg->max_bytes) {
+            size_t room = f->seg.bytes < lg->max_bytes ?
+                lg->max_bytes - f->seg.bytes - 1 : 0;
+
+            nl = memchr(buf + room, '\n', n - room);
+            if (nl) {
+                n = nl - buf + 1;
+                cut = 1;
+            }
+        }
+
+        if (f->seg.bytes == 0)
+            f->seg.first_ts = t0;
+
+        write_all(f->fd, buf, n);
+
+        f->lines += count_lines(buf, n);
+        f->line_start = buf[n - 1] == '\n';
+        f->seg.bytes += n;
+        f->seg.last_ts = t1;
+        f->seg.last_line = f->line_start ? f->lines - 1 : f->lines;
+        put_record(f);
+
+        buf += n;
+        len -= n;
+
+        if (cut)
+            next_segment(lg, f);
+    }
+}
+
+/* move the full segment out of the way and start the next one at path */
+static void
+next_segment(logger_t *lg, log_file_t *f)
+{
+    char *seg_path = logger_segment_path(f->path, f->seg.seg);
+    int fd;
+
+    rename(f->path, seg_path);
+    free(seg_path);
+
+    if (lg->keep && f->seg.seg + 1 - lg->keep >= 1) {
+        seg_path = logger_segment_path(f->path, f->seg.seg + 1 - lg->keep);
+        unlink(seg_path);
+        free(seg_path);
+    }
+
+    /* if the new file can not be made, keep writing to the renamed one */
+    fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        close(f->fd);
+        f->fd = fd;
+    }
+
+    f->seg.seg++;
+    f->seg.first_line = f->lines;
+    f->seg.bytes = 0;
+
+    /* the old record is final, the next one goes after it */
+    lseek(f->idx_fd, 0, SEEK_END);
+}
+
+/* rewrite the record of the current segment, the index offset is kept at the
+ * start of it */
+static void
+put_record(log_file_t *f)
+{
+    char rec[INDEX_REC_LEN + 1];
+    off_t off = lseek(f->idx_fd, 0, SEEK_CUR);
+
+    snprintf(
+        rec, sizeof(rec), INDEX_REC_FMT,
+        f->seg.seg,
+        (unsigned long long)f->seg.first_line,
+        (unsigned long long)f->seg.last_line,
+        f->seg.first_ts, f->seg.last_ts,
+        (unsigned long long)f->seg.bytes
+    );
+
+    write_all(f->idx_fd, (const uint8_t *)rec, INDEX_REC_LEN);
+    lseek(f->idx_fd, off, SEEK_SET);
+}
+
+/* remove the old segments and index of the log at path, but not path itself */
+static void
+remove_segments(const char *path)
+{
+    logger_segment_t *segs;
+    char *idx_path;
+    int n = logger_read_index(path, &segs);
+
+    for (int i = 0; i < n - 1; i++) {
+        char *seg_path = logger_segment_path(path, segs[i].seg);
+
+        unlink(seg_path);
+        free(seg_path);
+    }
+    free(segs);
+
+    idx_path = index_path(path);
+    unlink(idx_path);
+    free(idx_path);
+}
+
+static char *
+index_path(const char *path)
+{
+    return bstr_print(strdup(path), ".idx");
+}
+
+static uint64_t
+count_lines(const uint8_t *buf, size_t len)
+{
+    const uint8_t *end = buf + len;
+    uint64_t ret = 0;
+
+    while ((buf = memchr(buf, '\n', end - buf))) {
+        ret++;
+        buf++;
+    }
+
+    return ret;
+}
+
+static double
+wall_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        buf += ret;
+        len -= ret;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Asynchronous log writer. Producers copy bytes into a front buffer and a
+ * dedicated thread swaps it with a back buffer and writes that out with one
+ * large write per file, so a slow disk never blocks the producers. The same
+ * bytes get written to every file added to the logger.
+ *
+ * Logs can be rotated by size and/or age. The file at path always holds the
+ * newest segment. When it is full it gets renamed to path.<n>, counting up
+ * from 1, and a new one is started. Segments only end at the end of a line.
+ * A text index at path.idx has one fixed width record per segment, oldest
+ * first, with the range of lines and the wall clock times in it, so a reader
+ * can go straight to the segment it needs. The last record is the segment
+ * at path and it is rewritten after every write. */
+
+#define LOGGER_MAX_FILES   (4)
+/* Once this many bytes are waiting for the disk, further bytes get dropped
+ * until the writer catches up, so a disk that stalls (e.g. a network share)
+ * costs at most this much memory rather than stalling the reader. Drops are
+ * counted by logger_dropped, and a text log gets a marker line where they
+ * happened (see logger_mark_drops). */
+#define LOGGER_MAX_BACKLOG (64 * 1024 * 1024)
+
+typedef struct logger_struct * logger_handle;
+
+/* a record of the segment index */
+typedef struct logger_segment_struct {
+    int seg; /* the segment is at path.<seg>, or at path if it is the last */
+    uint64_t first_line; /* line numbers across all segments, from 0 */
+    uint64_t last_line;
+    double first_ts; /* unix time of the first and last bytes */
+    double last_ts;
+    uint64_t bytes;
+} logger_segment_t;
+
+/* Create a logger and start its writer thread */
+logger_handle logger_create(void);
+
+/* Rotate files added from now on once a segment has max_bytes in it or is
+ * max_secs old, 0 for no limit. Only the newest keep segments are kept, 0 to
+ * keep them all. */
+void logger_rotate(logger_handle lg, size_t max_bytes, int max_secs, int keep);
+
+/* Open (truncate) the file at path and have the logger write to it. Segments
+ * of an old rotated log at path are removed. */
+int logger_add_file(logger_handle lg, const char *path);
+
+/* Like logger_add_file, but keep what is in the file and write after it. A
+ * rotated log carries on from the last record of its index. */
+int logger_append_file(logger_handle lg, const char *path);
+
+/* Write a "[bytenuts: N bytes dropped]" line into the files wherever bytes
+ * were dropped, for logs read as text rather than as records */
+void logger_mark_drops(logger_handle lg);
+
+/* Number of files the logger writes to */
+int logger_nfiles(logger_handle lg);
+
+/* Queue len bytes to be written to all files, never blocks on the disk */
+void logger_write(logger_handle lg, const void *buf, size_t len);
+
+/* Queue a header and its payload together, so records queued from several
+ * threads never get interleaved */
+void logger_write_rec(
+    logger_handle lg,
+    const void *hdr,
+    size_t hdr_len,
+    const void *buf,
+    size_t len
+);
+
+/* Bytes queued but not written yet */
+size_t logger_backlog(logger_handle lg);
+
+/* Bytes dropped because the backlog was full */
+size_t logger_dropped(logger_handle lg);
+
+/* Flush everything queued, stop the writer thread, and close the files */
+void logger_destroy(logger_handle lg);
+
+/* Read the segment index of the log at path into *segs, which has to be
+ * freed. Returns the number of segments, 0 if the log was not rotated. */
+int logger_read_index(const char *path, logger_segment_t **segs);
+
+/* Path of segment seg of the log at path, the last segment is at path */
+char *logger_segment_path(const char *path, int seg);
+
+/* Rename the log at from to to, along with its segments and index. Whatever
+ * log was at to is replaced. */
+int logger_move(const char *from, const char *to);
+
+#endif /* _LOGGER_H_ */
@@ -25,7 +25,7 @@ paths_append(char *base, const char *suffix)
 
     if (
         (baselen == 0) ||
-        ((base[baselen-1] != '/') && (base[baselen-1] == '\\'))
+        ((base[baselen-1] != '/') && (base[baselen-1] != '\\'))
     ) {
         /* no separator at end of path */
 #if __MINGW32__
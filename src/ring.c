@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+int
+ring_init(ring_t *ring, size_t cap)
+{
+    size_t sz = 1;
+
+    while (sz < cap) {
+        sz <<= 1;
+    }
+
+    ring->buf = malloc(sz);
+    if (!ring->buf)
+        return -1;
+
+    ring->cap = sz;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return 0;
+}
+
+size_t
+ring_push(ring_t *ring, const void *buf, size_t len)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring->cap - (head - tail);
+    size_t off = head & (ring->cap - 1);
+    size_t first;
+
+    if (len > space)
+        len = space;
+    if (len == 0)
+        return 0;
+
+    /* the free space may wrap around the end of buf */
+    first = ring->cap - off < len ? ring->cap - off : len;
+    memcpy(&ring->buf[off], buf, first);
+    memcpy(ring->buf, (const uint8_t *)buf + first, len - first);
+
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+    return len;
+}
+
+size_t
+ring_peek(ring_t *ring, const uint8_t **buf)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t off = tail & (ring->cap - 1);
+    size_t len = head - tail;
+
+    if (len > ring->cap - off)
+        len = ring->cap - off;
+
+    *buf = &ring->buf[off];
+    return len;
+}
+
+void
+ring_consume(ring_t *ring, size_t len)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
+
+size_t
+ring_used(ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+void
+ring_free(ring_t *ring)
+{
+    free(ring->buf);
+    ring->buf = NULL;
+    ring->cap = 0;
+}
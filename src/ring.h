@@ -0,0 +1,38 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lock-free byte queue for one producer thread and one consumer thread. The
+ * producer only moves head and the consumer only moves tail, so neither ever
+ * waits on the other. */
+
+typedef struct ring_struct {
+    uint8_t *buf;
+    size_t cap; /* power of two */
+    _Atomic size_t head; /* total bytes pushed */
+    _Atomic size_t tail; /* total bytes consumed */
+} ring_t;
+
+/* Allocate a ring holding cap bytes, cap gets rounded up to a power of two */
+int ring_init(ring_t *ring, size_t cap);
+
+/* Producer: queue as much of buf as fits, returns the bytes queued */
+size_t ring_push(ring_t *ring, const void *buf, size_t len);
+
+/* Consumer: point buf at the queued bytes that are contiguous in memory and
+ * return how many there are */
+size_t ring_peek(ring_t *ring, const uint8_t **buf);
+
+/* Consumer: drop len bytes from the front of the queue */
+void ring_consume(ring_t *ring, size_t len);
+
+/* Bytes queued */
+size_t ring_used(ring_t *ring);
+
+/* Release the ring */
+void ring_free(ring_t *ring);
+
+#endif /* _RING_H_ */
@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define SCAN_X86
+#  include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+typedef size_t (*scan_fn)(const char *buf, size_t len);
+typedef size_t (*find_fn)(const char *buf, size_t len, const char *s, size_t s_len);
+
+static size_t scan_scalar(const char *buf, size_t len);
+static size_t find_scalar(const char *buf, size_t len, const char *s, size_t s_len);
+#ifdef SCAN_X86
+static size_t scan_sse2(const char *buf, size_t len);
+static size_t scan_avx2(const char *buf, size_t len);
+static size_t find_sse2(const char *buf, size_t len, const char *s, size_t s_len);
+static size_t find_avx2(const char *buf, size_t len, const char *s, size_t s_len);
+#endif
+
+static struct {
+    const char *name;
+    scan_fn fn;
+    find_fn find;
+} scan = { "scalar", scan_scalar, find_scalar };
+
+void
+scan_init()
+{
+    if (scan_use("avx2"))
+        scan_use("sse2");
+}
+
+int
+scan_use(const char *name)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+#endif
+
+    if (!strcmp(name, "scalar")) {
+        scan.fn = scan_scalar;
+        scan.find = find_scalar;
+    }
+#ifdef SCAN_X86
+    else if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+        scan.fn = scan_sse2;
+        scan.find = find_sse2;
+    }
+    else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+        scan.fn = scan_avx2;
+        scan.find = find_avx2;
+    }
+#endif
+    else {
+        return -1;
+    }
+
+    scan.name = name;
+    return 0;
+}
+
+const char *
+scan_name()
+{
+    return scan.name;
+}
+
+size_t
+scan_ctrl(const char *buf, size_t len)
+{
+    return scan.fn(buf, len);
+}
+
+size_t
+scan_find(const char *buf, size_t len, const char *s, size_t s_len)
+{
+    if (s_len == 0)
+        return 0;
+    if (s_len > len)
+        return len;
+
+    return scan.find(buf, len, s, s_len);
+}
+
+static size_t
+scan_scalar(const char *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t i = 0;
+
+    while (i < len && p[i] >= 0x20) {
+        i++;
+    }
+
+    return i;
+}
+
+static size_t
+find_scalar(const char *buf, size_t len, const char *s, size_t s_len)
+{
+    const char *p = buf;
+    const char *end = buf + len - s_len + 1;
+
+    while ((p = memchr(p, s[0], end - p))) {
+        if (!memcmp(p + 1, s + 1, s_len - 1))
+            return p - buf;
+        p++;
+    }
+
+    return len;
+}
+
+#ifdef SCAN_X86
+/* a byte is a control byte if min(byte, 0x1F) == byte, unsigned compares
+ * are not available otherwise */
+__attribute__((target("sse2")))
+static size_t
+scan_sse2(const char *buf, size_t len)
+{
+    const __m128i c = _mm_set1_epi8(0x1F);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&buf[i]);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, c), v));
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_scalar(&buf[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_avx2(const char *buf, size_t len)
+{
+    const __m256i c = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(v, c), v)
+        );
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    /* the sse2 tail would pay for the dirty upper halves otherwise */
+    _mm256_zeroupper();
+    return i + scan_sse2(&buf[i], len - i);
+}
+/* candidates are the positions where both the first and the last byte of s
+ * match, only those get compared in full */
+__attribute__((target("sse2")))
+static size_t
+find_sse2(const char *buf, size_t len, const char *s, size_t s_len)
+{
+    const __m128i first = _mm_set1_epi8(s[0]);
+    const __m128i last = _mm_set1_epi8(s[s_len - 1]);
+    size_t end = len - s_len + 1; /* positions s can start at */
+    size_t i = 0;
+
+    for (; i + 16 <= end; i += 16) {
+        __m128i f = _mm_loadu_si128((const __m128i *)&buf[i]);
+        __m128i l = _mm_loadu_si128((const __m128i *)&buf[i + s_len - 1]);
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last))
+        );
+
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+
+            if (!memcmp(&buf[at + 1], s + 1, s_len - 1))
+                return at;
+            mask &= mask - 1;
+        }
+    }
+
+    return i + find_scalar(&buf[i], len - i, s, s_len);
+}
+
+__attribute__((target("avx2")))
+static size_t
+find_avx2(const char *buf, size_t len, const char *s, size_t s_len)
+{
+    const __m256i first = _mm256_set1_epi8(s[0]);
+    const __m256i last = _mm256_set1_epi8(s[s_len - 1]);
+    size_t end = len - s_len + 1;
+    size_t i = 0;
+
+    for (; i + 32 <= end; i += 32) {
+        __m256i f = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        __m256i l = _mm256_loadu_si256((const __m256i *)&buf[i + s_len - 1]);
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last))
+        );
+
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+
+            if (!memcmp(&buf[at + 1], s + 1, s_len - 1)) {
+                _mm256_zeroupper();
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    _mm256_zeroupper();
+    return i + find_scalar(&buf[i], len - i, s, s_len);
+}
+#endif /* SCAN_X86 */
@@ -0,0 +1,28 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stddef.h>
+
+/* Finds the control bytes (C0, 0x00-0x1F) in received data so the printable
+ * runs between them can be copied in one go, and finds strings when searching
+ * the scrollback. On x86 this uses SSE2 or AVX2, picked at runtime, and plain
+ * loops everywhere else. */
+
+/* Pick the fastest implementation the cpu supports. Call before any threads
+ * use scan_ctrl. */
+void scan_init(void);
+
+/* Force an implementation by name ("scalar", "sse2", "avx2"), returns -1 if
+ * the cpu or build does not have it */
+int scan_use(const char *name);
+
+/* Name of the implementation in use */
+const char *scan_name(void);
+
+/* Index of the first control byte in buf, or len if there is none */
+size_t scan_ctrl(const char *buf, size_t len);
+
+/* Index of the first occurrence of s in buf, or len if there is none */
+size_t scan_find(const char *buf, size_t len, const char *s, size_t s_len);
+
+#endif /* _SCAN_H_ */
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+typedef _Atomic uint64_t stat_t;
+
+typedef struct stats_sample_struct {
+    uint64_t t_ns;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t frames;
+} stats_sample_t;
+
+static struct {
+    uint64_t start_ns;
+    /* reader thread */
+    stat_t rx_bytes;
+    stat_t reads[STATS_READ_BUCKETS];
+    /* tx thread */
+    stat_t tx_bytes;
+    /* render thread */
+    stat_t frames;
+    stat_t frame_ns;
+    stat_t lock_ns[STATS_NLOCKS];
+    /* the last two ticks */
+    pthread_mutex_t tick_lock;
+    stats_sample_t prev;
+    stats_sample_t cur;
+} stats = {
+    .tick_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void stat_add(stat_t *stat, uint64_t n);
+static uint64_t stat_get(stat_t *stat);
+static void take_sample(stats_sample_t *sample);
+
+void
+stats_init()
+{
+    stats.start_ns = stats_now_ns();
+
+    pthread_mutex_lock(&stats.tick_lock);
+    take_sample(&stats.cur);
+    stats.prev = stats.cur;
+    pthread_mutex_unlock(&stats.tick_lock);
+}
+
+void
+stats_rx(size_t len)
+{
+    int bucket = 0;
+
+    while ((len >> (bucket + 1)) && bucket < STATS_READ_BUCKETS - 1) {
+        bucket++;
+    }
+
+    stat_add(&stats.rx_bytes, len);
+    stat_add(&stats.reads[bucket], 1);
+}
+
+void
+stats_tx(size_t len)
+{
+    stat_add(&stats.tx_bytes, len);
+}
+
+void
+stats_frame(uint64_t ns)
+{
+    stat_add(&stats.frames, 1);
+    stat_add(&stats.frame_ns, ns);
+}
+
+void
+stats_lock(pthread_mutex_t *m, int lock)
+{
+    uint64_t start;
+
+    /* only a contended lock costs the clock reads */
+    if (!pthread_mutex_trylock(m))
+        return;
+
+    start = stats_now_ns();
+    pthread_mutex_lock(m);
+    stat_add(&stats.lock_ns[lock], stats_now_ns() - start);
+}
+
+void
+stats_tick()
+{
+    pthread_mutex_lock(&stats.tick_lock);
+    stats.prev = stats.cur;
+    take_sample(&stats.cur);
+    pthread_mutex_unlock(&stats.tick_lock);
+}
+
+void
+stats_report(stats_report_t *report)
+{
+    stats_sample_t prev, cur;
+    double dt, total;
+    uint64_t frames;
+
+    pthread_mutex_lock(&stats.tick_lock);
+    prev = stats.prev;
+    cur = stats.cur;
+    pthread_mutex_unlock(&stats.tick_lock);
+
+    memset(report, 0, sizeof(stats_report_t));
+
+    report->rx_bytes = stat_get(&stats.rx_bytes);
+    report->tx_bytes = stat_get(&stats.tx_bytes);
+    report->frames = stat_get(&stats.frames);
+
+    total = (stats_now_ns() - stats.start_ns) / 1e9;
+    if (total > 0) {
+        report->rx_avg = report->rx_bytes / total;
+        report->tx_avg = report->tx_bytes / total;
+    }
+
+    dt = (cur.t_ns - prev.t_ns) / 1e9;
+    if (dt > 0) {
+        report->rx_now = (cur.rx_bytes - prev.rx_bytes) / dt;
+        report->tx_now = (cur.tx_bytes - prev.tx_bytes) / dt;
+        report->fps = (cur.frames - prev.frames) / dt;
+    }
+
+    frames = report->frames;
+    if (frames > 0)
+        report->frame_ms = stat_get(&stats.frame_ns) / 1e6 / frames;
+
+    for (int i = 0; i < STATS_READ_BUCKETS; i++) {
+        report->reads[i] = stat_get(&stats.reads[i]);
+    }
+    for (int i = 0; i < STATS_NLOCKS; i++) {
+        report->lock_ms[i] = stat_get(&stats.lock_ns[i]) / 1e6;
+    }
+}
+
+const char *
+stats_fmt_bytes(char *buf, size_t sz, double bytes)
+{
+    static const char units[] = "BKMGT";
+    int unit = 0;
+
+    while (bytes >= 1024 && units[unit + 1]) {
+        bytes /= 1024;
+        unit++;
+    }
+
+    if (unit == 0)
+        snprintf(buf, sz, "%.0fB", bytes);
+    else
+        snprintf(buf, sz, "%.1f%c", bytes, units[unit]);
+
+    return buf;
+}
+
+uint64_t
+stats_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* only the owning thread writes a counter, so no read-modify-write needed */
+static void
+stat_add(stat_t *stat, uint64_t n)
+{
+    atomic_store_explicit(
+        stat,
+        atomic_load_explicit(stat, memory_order_relaxed) + n,
+        memory_order_relaxed
+    );
+}
+
+static uint64_t
+stat_get(stat_t *stat)
+{
+    return atomic_load_explicit(stat, memory_order_relaxed);
+}
+
+static void
+take_sample(stats_sample_t *sample)
+{
+    sample->t_ns = stats_now_ns();
+    sample->rx_bytes = stat_get(&stats.rx_bytes);
+    sample->tx_bytes = stat_get(&stats.tx_bytes);
+    sample->frames = stat_get(&stats.frames);
+}
@@ -0,0 +1,66 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Performance counters. Every counter has a single thread writing it, so a
+ * bump is a relaxed load and store with no locked instructions, and readers
+ * just see a slightly stale value. stats_tick() takes a sample about once a
+ * second so instant rates can be reported next to the averages. */
+
+/* serial_read sizes 1, 2-3, 4-7, ..., 1024-2047, 2048 and up */
+#define STATS_READ_BUCKETS (12)
+
+enum stats_lock_enum {
+    STATS_LOCK_RX = 0, /* cheerios.lock in the reader */
+    STATS_LOCK_RENDER, /* cheerios.lock in the render thread */
+    STATS_LOCK_TERM, /* term_lock in the render thread */
+    STATS_NLOCKS,
+};
+
+typedef struct stats_report_struct {
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    double rx_now; /* bytes/s over the last tick */
+    double rx_avg; /* bytes/s since stats_init */
+    double tx_now;
+    double tx_avg;
+    uint64_t reads[STATS_READ_BUCKETS];
+    uint64_t frames;
+    double fps; /* over the last tick */
+    double frame_ms; /* average time to take and draw a frame */
+    double lock_ms[STATS_NLOCKS]; /* total time spent waiting */
+} stats_report_t;
+
+/* Start counting from now */
+void stats_init(void);
+
+/* Reader thread: len bytes were read in one go */
+void stats_rx(size_t len);
+
+/* TX thread: len bytes were written */
+void stats_tx(size_t len);
+
+/* Render thread: a frame took ns nanoseconds */
+void stats_frame(uint64_t ns);
+
+/* Lock m, counting the time spent waiting on it against lock */
+void stats_lock(pthread_mutex_t *m, int lock);
+
+/* Take a sample for the instant rates, call about once a second from one
+ * thread */
+void stats_tick(void);
+
+/* Fill report with the current numbers */
+void stats_report(stats_report_t *report);
+
+/* Format a byte count like 1.5M into buf */
+const char *stats_fmt_bytes(char *buf, size_t sz, double bytes);
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t stats_now_ns(void);
+
+#endif /* _STATS_H_ */
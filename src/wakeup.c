@@ -0,0 +1,94 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "wakeup.h"
+
+#ifdef __MINGW32__
+
+/* no pollable pipes on Windows, users fall back to polling */
+int
+wakeup_init(wakeup_t *wk)
+{
+    wk->fds[0] = -1;
+    wk->fds[1] = -1;
+    return 0;
+}
+
+int
+wakeup_fd(wakeup_t *wk)
+{
+    return -1;
+}
+
+void
+wakeup_signal(wakeup_t *wk)
+{
+}
+
+void
+wakeup_drain(wakeup_t *wk)
+{
+}
+
+void
+wakeup_destroy(wakeup_t *wk)
+{
+}
+
+#else
+
+int
+wakeup_init(wakeup_t *wk)
+{
+    if (pipe(wk->fds)) {
+        wk->fds[0] = -1;
+        wk->fds[1] = -1;
+        return -1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(wk->fds[i], F_SETFL, fcntl(wk->fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wk->fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 0;
+}
+
+int
+wakeup_fd(wakeup_t *wk)
+{
+    return wk->fds[0];
+}
+
+void
+wakeup_signal(wakeup_t *wk)
+{
+    uint8_t b = 1;
+
+    /* a full pipe already means a wakeup is pending */
+    while (write(wk->fds[1], &b, 1) < 0 && errno == EINTR);
+}
+
+void
+wakeup_drain(wakeup_t *wk)
+{
+    uint8_t buf[64];
+
+    while (read(wk->fds[0], buf, sizeof(buf)) > 0);
+}
+
+void
+wakeup_destroy(wakeup_t *wk)
+{
+    if (wk->fds[0] >= 0)
+        close(wk->fds[0]);
+    if (wk->fds[1] >= 0)
+        close(wk->fds[1]);
+
+    wk->fds[0] = -1;
+    wk->fds[1] = -1;
+}
+
+#endif /* __MINGW32__ */
@@ -0,0 +1,24 @@
+#ifndef _WAKEUP_H_
+#define _WAKEUP_H_
+
+/* A self-pipe that lets one thread kick another thread out of poll() */
+typedef struct wakeup_struct {
+    int fds[2]; /* read end, write end */
+} wakeup_t;
+
+/* Create the pipe, returns 0 on success */
+int wakeup_init(wakeup_t *wk);
+
+/* File descriptor to poll for POLLIN (-1 if unsupported on this platform) */
+int wakeup_fd(wakeup_t *wk);
+
+/* Wake up whoever is polling on wk, safe to call from any thread */
+void wakeup_signal(wakeup_t *wk);
+
+/* Consume all pending wakeups */
+void wakeup_drain(wakeup_t *wk);
+
+/* Close the pipe */
+void wakeup_destroy(wakeup_t *wk);
+
+#endif /* _WAKEUP_H_ */
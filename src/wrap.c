@@ -0,0 +1,172 @@
+#include <stdlib.h>
+
+#include "wrap.h"
+
+static void tree_add(wrap_t *wr, int blk, long delta);
+static long tree_prefix(wrap_t *wr, int n);
+static int tree_push(wrap_t *wr);
+
+int
+wrap_rows(int len, int width)
+{
+    if (len <= 0 || width <= 0)
+        return 1;
+
+    return (len - 1) / width + 1;
+}
+
+void
+wrap_sync(wrap_t *wr, lines_t *lines, int width)
+{
+    /* every line wraps differently now, start over */
+    if (width != wr->width) {
+        wr->width = width;
+        wr->n_blocks = 0;
+        wr->n_lines = 0;
+        wr->last_rows = 0;
+        wr->total = 0;
+    }
+
+    /* the last line we saw may have grown since */
+    if (wr->n_lines > 0) {
+        int idx = wr->n_lines - 1;
+        int rows = wrap_rows(lines_len(lines, idx), width);
+
+        if (rows != wr->last_rows) {
+            tree_add(wr, idx / WRAP_BLOCK, rows - wr->last_rows);
+            wr->total += rows - wr->last_rows;
+            wr->last_rows = rows;
+        }
+    }
+
+    while (wr->n_lines < lines->n_lines) {
+        int idx = wr->n_lines;
+        int rows = wrap_rows(lines_len(lines, idx), width);
+
+        if ((idx % WRAP_BLOCK) == 0 && tree_push(wr))
+            return;
+
+        tree_add(wr, idx / WRAP_BLOCK, rows);
+        wr->total += rows;
+        wr->last_rows = rows;
+        wr->n_lines++;
+    }
+}
+
+long
+wrap_row_of(wrap_t *wr, lines_t *lines, int idx)
+{
+    int blk = idx / WRAP_BLOCK;
+    long ret = tree_prefix(wr, blk);
+
+    for (int i = blk * WRAP_BLOCK; i < idx; i++) {
+        ret += wrap_rows(lines_len(lines, i), wr->width);
+    }
+
+    return ret;
+}
+
+int
+wrap_line_at(wrap_t *wr, lines_t *lines, long row, int *sub)
+{
+    int pos = 0;
+    int step = 1;
+
+    if (wr->n_lines == 0) {
+        *sub = 0;
+        return 0;
+    }
+
+    if (row >= wr->total) {
+        *sub = wr->last_rows - 1;
+        return wr->n_lines - 1;
+    }
+
+    if (row < 0)
+        row = 0;
+
+    /* find the block holding the row */
+    while ((step << 1) <= wr->n_blocks) {
+        step <<= 1;
+    }
+    for (; step > 0; step >>= 1) {
+        if (pos + step <= wr->n_blocks && wr->tree[pos + step] <= row) {
+            pos += step;
+            row -= wr->tree[pos];
+        }
+    }
+
+    /* then the line within the block */
+    for (int i = pos * WRAP_BLOCK; i < wr->n_lines; i++) {
+        int rows = wrap_rows(lines_len(lines, i), wr->width);
+
+        if (row < rows) {
+            *sub = row;
+            return i;
+        }
+
+        row -= rows;
+    }
+
+    *sub = wr->last_rows - 1;
+    return wr->n_lines - 1;
+}
+
+void
+wrap_free(wrap_t *wr)
+{
+    free(wr->tree);
+    wr->tree = NULL;
+    wr->cap = 0;
+    wr->n_blocks = 0;
+    wr->n_lines = 0;
+    wr->total = 0;
+}
+
+/* add delta to block blk (0-indexed) */
+static void
+tree_add(wrap_t *wr, int blk, long delta)
+{
+    for (int i = blk + 1; i <= wr->n_blocks; i += i & -i) {
+        wr->tree[i] += delta;
+    }
+}
+
+/* sum of the first n blocks */
+static long
+tree_prefix(wrap_t *wr, int n)
+{
+    long ret = 0;
+
+    for (int i = n; i > 0; i -= i & -i) {
+        ret += wr->tree[i];
+    }
+
+    return ret;
+}
+
+/* append an empty block */
+static int
+tree_push(wrap_t *wr)
+{
+    int i;
+
+    if (wr->n_blocks + 1 >= wr->cap) {
+        int cap = wr->cap ? wr->cap * 2 : 1024;
+        uint32_t *tree = realloc(wr->tree, sizeof(uint32_t) * cap);
+
+        if (!tree)
+            return -1;
+
+        wr->tree = tree;
+        wr->cap = cap;
+    }
+
+    wr->n_blocks++;
+    i = wr->n_blocks;
+
+    /* node i covers the blocks (i - lowbit(i), i] */
+    wr->tree[i] = tree_prefix(wr, i - 1) - tree_prefix(wr, i - (i & -i));
+
+    return 0;
+}
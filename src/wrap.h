@@ -0,0 +1,39 @@
+#ifndef _WRAP_H_
+#define _WRAP_H_
+
+#include "lines.h"
+
+/* Index of how many window rows each line wraps to at a given width. Rows are
+ * summed per block of WRAP_BLOCK lines in a Fenwick tree, so finding the row
+ * of a line or the line at a row is O(log n + WRAP_BLOCK). The index is
+ * updated incrementally as lines arrive and rebuilt when the width changes. */
+
+#define WRAP_BLOCK (64)
+
+typedef struct wrap_struct {
+    int width; /* width the index was built for */
+    uint32_t *tree; /* 1-indexed Fenwick tree of rows per block */
+    int n_blocks;
+    int cap;
+    int n_lines; /* lines accounted for */
+    int last_rows; /* rows the last accounted line was counted with */
+    long total; /* total rows */
+} wrap_t;
+
+/* Rows a line of len bytes takes up in a window of the given width */
+int wrap_rows(int len, int width);
+
+/* Bring the index up to date with lines at the given width */
+void wrap_sync(wrap_t *wr, lines_t *lines, int width);
+
+/* Index of the first row of line idx */
+long wrap_row_of(wrap_t *wr, lines_t *lines, int idx);
+
+/* Find the line holding the given row and store the row's offset within that
+ * line in sub. Rows past the end give the last line. */
+int wrap_line_at(wrap_t *wr, lines_t *lines, long row, int *sub);
+
+/* Release the index */
+void wrap_free(wrap_t *wr);
+
+#endif /* _WRAP_H_ */
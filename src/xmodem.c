@@ -3,13 +3,36 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "crc16.h"
 #include "xmodem.h"
 
+#define XMODEM_START_TO      (3000) /* between asking the sender to start */
+#define XMODEM_BYTE_TO       (1000) /* the most a block may pause for */
+#define XMODEM_WBUF_SZ       (64 * 1024)
+
+int _xmodem_start(serial_t fd, uint8_t *start_byte);
+int _xmodem_send_data(
+    serial_t fd,
+    int in_fd,
+    size_t sz,
+    int block_sz,
+    uint8_t start_byte,
+    int shrink,
+    void (*status_cb)(size_t sent, size_t total, int ack_fails)
+);
+size_t _xmodem_frame(uint8_t *buf, uint8_t packet_num, int block_sz, int use_crc);
+int _xmodem_send_packet(serial_t fd, const uint8_t *buf, size_t buf_sz, int *ack_fails);
+int _xmodem_stream_packet(serial_t fd, const uint8_t *buf, size_t buf_sz);
+int _xmodem_write_all(serial_t fd, const uint8_t *buf, size_t len);
+int _xmodem_eot(serial_t fd);
 int _xmodem_wait(serial_t fd, uint8_t *ret, int timeout_ms);
+int _xmodem_read_all(serial_t fd, uint8_t *buf, size_t len, int timeout_ms);
+void _xmodem_purge(serial_t fd);
+void _xmodem_cancel(serial_t fd);
 
-uint16_t _xmodem_crc(const uint8_t *buf, size_t len);
 uint8_t _xmodem_csum(const uint8_t *buf, size_t len);
 void _xmodem_status_print(size_t sent, size_t total);
 
@@ -23,62 +46,163 @@ xmodem_send(
 )
 {
     uint8_t start_byte;
-    size_t sent;
-    uint8_t *buf;
-    size_t buf_sz;
-    uint8_t packet_num;
-    int retries;
-    int ret = 0;
-    int ack_fails = 0;
+    int eot_ret;
+    int ret;
 
     if (block_sz != 128 && block_sz != 1024) {
         return -1;
     }
 
-    /* wait for start byte, 'C' for CRC, NAK for CSUM */
-    for (int i = 0; i < 11; i++) {
-        if (i == 10) {
-            return XMODEM_ERR_TIMEOUT;
-        }
+    if (_xmodem_start(dest_fd, &start_byte)) {
+        return XMODEM_ERR_TIMEOUT;
+    }
+
+    ret = _xmodem_send_data(dest_fd, in_fd, sz, block_sz, start_byte, 0, status_cb);
+    if (ret && ret != XMODEM_ERR_TIMEOUT) {
+        return ret;
+    }
+
+    eot_ret = _xmodem_eot(dest_fd);
+    if (eot_ret) {
+        return eot_ret;
+    }
+
+    return ret;
+}
+
+int
+ymodem_send(
+    serial_t dest_fd,
+    int in_fd,
+    const char *name,
+    size_t sz,
+    time_t mtime,
+    void (*status_cb)(size_t sent, size_t total, int ack_fails)
+)
+{
+    uint8_t buf[3 + 1024 + 2];
+    uint8_t start_byte;
+    size_t info_len;
+    size_t pkt_len;
+    int block_sz;
+    int ack_fails = 0;
+    int ret;
+
+    /* block 0 is the file name and then its size and mtime */
+    memset(buf, 0, sizeof(buf));
+    info_len = snprintf(
+        (char *)&buf[3], 1024, "%s%c%zu %lo",
+        name, 0, sz, (unsigned long)mtime
+    ) + 1;
+    if (info_len > 1024) {
+        return -1;
+    }
+    block_sz = info_len > 128 ? 1024 : 128;
+
+    if (_xmodem_start(dest_fd, &start_byte)) {
+        return XMODEM_ERR_TIMEOUT;
+    }
+
+    pkt_len = _xmodem_frame(buf, 0, block_sz, start_byte != XMODEM_NAK);
+    if (start_byte == XMODEM_G) {
+        ret = _xmodem_stream_packet(dest_fd, buf, pkt_len);
+    } else {
+        ret = _xmodem_send_packet(dest_fd, buf, pkt_len, &ack_fails);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    /* the receiver asks for the data like it would for XModem */
+    if (_xmodem_start(dest_fd, &start_byte)) {
+        return XMODEM_ERR_TIMEOUT;
+    }
+
+    ret = _xmodem_send_data(dest_fd, in_fd, sz, 1024, start_byte, 1, status_cb);
+    if (ret) {
+        return ret;
+    }
+
+    return _xmodem_eot(dest_fd);
+}
+
+int
+ymodem_finish(serial_t dest_fd)
+{
+    uint8_t buf[3 + 128 + 2];
+    uint8_t start_byte;
+    size_t pkt_len;
+    int ack_fails = 0;
+
+    if (_xmodem_start(dest_fd, &start_byte)) {
+        return XMODEM_ERR_TIMEOUT;
+    }
+
+    /* a block 0 without a name ends the batch */
+    memset(buf, 0, sizeof(buf));
+    pkt_len = _xmodem_frame(buf, 0, 128, start_byte != XMODEM_NAK);
+
+    if (start_byte == XMODEM_G) {
+        return _xmodem_stream_packet(dest_fd, buf, pkt_len);
+    }
+
+    return _xmodem_send_packet(dest_fd, buf, pkt_len, &ack_fails);
+}
 
+/* wait for start byte, 'C' for CRC, NAK for CSUM, 'G' for CRC and no ACKs */
+int
+_xmodem_start(serial_t fd, uint8_t *start_byte)
+{
+    for (int i = 0; i < 10; i++) {
         if (
-            !_xmodem_wait(dest_fd, &start_byte, XMODEM_TIMEOUT) &&
-            (start_byte == XMODEM_CRC || start_byte == XMODEM_NAK)
+            !_xmodem_wait(fd, start_byte, XMODEM_TIMEOUT) &&
+            (*start_byte == XMODEM_CRC || *start_byte == XMODEM_NAK ||
+                *start_byte == XMODEM_G)
         ) {
-            break;
+            return 0;
         }
     }
 
-    /* start sendin' bytes */
-    buf_sz = 3 + block_sz; /* SOH/STX | idx | ~idx | payload */
-    if (start_byte == XMODEM_NAK) {
-        buf_sz += 1;
-    } else {
-        buf_sz += 2;
-    }
-    buf = malloc(buf_sz);
-    sent = 0;
-    packet_num = 1; /* yes, this starts at 1 */
+    return -1;
+}
+
+/* send sz bytes of in_fd as blocks numbered from 1, the way start_byte asked
+ * for. With shrink, a tail that fits goes in a 128B block rather than a mostly
+ * padded 1024B one. */
+int
+_xmodem_send_data(
+    serial_t fd,
+    int in_fd,
+    size_t sz,
+    int block_sz,
+    uint8_t start_byte,
+    int shrink,
+    void (*status_cb)(size_t sent, size_t total, int ack_fails)
+)
+{
+    uint8_t buf[3 + 1024 + 2]; /* SOH/STX | idx | ~idx | payload | CRC/CSUM */
+    size_t sent = 0;
+    uint8_t packet_num = 1; /* yes, this starts at 1 */
+    int use_crc = start_byte != XMODEM_NAK;
+    int ack_fails = 0;
 
     while (sent < sz) {
         size_t read_len;
+        size_t pkt_len;
+        int cur_sz = block_sz;
+        int ret;
 
-        if (block_sz == 128) {
-            buf[0] = XMODEM_SOH;
-        } else {
-            buf[0] = XMODEM_STX;
+        if (shrink && sz - sent <= 128) {
+            cur_sz = 128;
         }
 
-        buf[1] = packet_num;
-        buf[2] = ~packet_num;
-
-        if ((sz - sent) >= block_sz) {
-            read_len = block_sz;
+        if ((sz - sent) >= cur_sz) {
+            read_len = cur_sz;
         } else {
             /* back fill payload with pad */
             read_len = sz - sent;
-            for (int i = read_len; i < block_sz; i++) {
-                buf[i] = XMODEM_PAD;
+            for (int i = read_len; i < cur_sz; i++) {
+                buf[3 + i] = XMODEM_PAD;
             }
         }
 
@@ -86,68 +210,312 @@ xmodem_send(
             return XMODEM_ERR_FILEIO;
         }
 
-        if (start_byte == XMODEM_CRC) {
-            /* write CRC big endian */
-            uint16_t crc = _xmodem_crc(&buf[3], block_sz);
-            buf[buf_sz-2] = (uint8_t)((0xFF00 & crc) >> 8);
-            buf[buf_sz-1] = (uint8_t)(0x00FF & crc);
+        pkt_len = _xmodem_frame(buf, packet_num, cur_sz, use_crc);
+        if (start_byte == XMODEM_G) {
+            ret = _xmodem_stream_packet(fd, buf, pkt_len);
         } else {
-            buf[buf_sz-1] = _xmodem_csum(&buf[3], block_sz);
+            ret = _xmodem_send_packet(fd, buf, pkt_len, &ack_fails);
+        }
+        if (ret) {
+            return ret;
         }
 
-        /* try to send this packet until we get an ACK */
-        retries = 0;
-        while (1) {
-            uint8_t recv_char;
+        sent += read_len;
+        packet_num++; /* expect overflow */
+        status_cb(sent, sz, ack_fails);
+    }
 
-            if (retries == 10) {
-                ret = XMODEM_ERR_TIMEOUT;
-                goto end_of_transmission;
-            }
+    return 0;
+}
 
-            if (serial_write(dest_fd, buf, buf_sz) != buf_sz){
-                return XMODEM_ERR_WRITE;
+/* fill in the header and trailer around the block_sz payload at &buf[3],
+ * returns the length of the packet */
+size_t
+_xmodem_frame(uint8_t *buf, uint8_t packet_num, int block_sz, int use_crc)
+{
+    buf[0] = block_sz == 128 ? XMODEM_SOH : XMODEM_STX;
+    buf[1] = packet_num;
+    buf[2] = ~packet_num;
+
+    if (use_crc) {
+        /* write CRC big endian */
+        uint16_t crc = crc16(&buf[3], block_sz);
+        buf[3 + block_sz] = (uint8_t)((0xFF00 & crc) >> 8);
+        buf[4 + block_sz] = (uint8_t)(0x00FF & crc);
+        return 5 + block_sz;
+    }
+
+    buf[3 + block_sz] = _xmodem_csum(&buf[3], block_sz);
+    return 4 + block_sz;
+}
+
+/* try to send this packet until we get an ACK */
+int
+_xmodem_send_packet(serial_t fd, const uint8_t *buf, size_t buf_sz, int *ack_fails)
+{
+    for (int retries = 0; retries < 10; retries++) {
+        uint8_t recv_char;
+
+        if (_xmodem_write_all(fd, buf, buf_sz)) {
+            return XMODEM_ERR_WRITE;
+        }
+
+        if (_xmodem_wait(fd, &recv_char, XMODEM_TIMEOUT)) {
+            return XMODEM_ERR_READ;
+        }
+
+        if (recv_char == XMODEM_ACK) {
+            return 0;
+        } else if (recv_char == XMODEM_CAN) {
+            return XMODEM_ERR_CANCEL;
+        }
+
+        (*ack_fails)++;
+    }
+
+    return XMODEM_ERR_TIMEOUT;
+}
+
+/* send this packet right after the last one, the receiver only says
+ * something to cancel */
+int
+_xmodem_stream_packet(serial_t fd, const uint8_t *buf, size_t buf_sz)
+{
+    uint8_t recv_char;
+
+    if (_xmodem_write_all(fd, buf, buf_sz)) {
+        return XMODEM_ERR_WRITE;
+    }
+
+    while (serial_read(fd, &recv_char, 1) == 1) {
+        /* a lone CAN could be line noise */
+        if (
+            recv_char == XMODEM_CAN &&
+            !_xmodem_wait(fd, &recv_char, XMODEM_BYTE_TO) &&
+            recv_char == XMODEM_CAN
+        ) {
+            return XMODEM_ERR_CANCEL;
+        }
+    }
+
+    return 0;
+}
+
+/* write all of buf, waiting on a port that has no room for it yet */
+int
+_xmodem_write_all(serial_t fd, const uint8_t *buf, size_t len)
+{
+    size_t off = 0;
+    int waited_ms = 0;
+
+    while (off < len) {
+        ssize_t ret = serial_write(fd, &buf[off], len - off);
+
+        if (ret > 0) {
+            off += ret;
+            waited_ms = 0;
+            continue;
+        }
+
+        if (++waited_ms > XMODEM_TIMEOUT) {
+            return -1;
+        }
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+
+    return 0;
+}
+
+/* end the file, YModem receivers NAK the first EOT. A streaming receiver
+ * may only just have cancelled over a block that went out before it. */
+int
+_xmodem_eot(serial_t fd)
+{
+    for (int retries = 0; retries < 10; retries++) {
+        uint8_t ack_char;
+
+        serial_write(fd, &(uint8_t){XMODEM_EOT}, 1);
+
+        if (_xmodem_wait(fd, &ack_char, XMODEM_TIMEOUT)) {
+            continue;
+        }
+
+        if (ack_char == XMODEM_ACK) {
+            return 0;
+        } else if (
+            ack_char == XMODEM_CAN &&
+            !_xmodem_wait(fd, &ack_char, XMODEM_BYTE_TO) &&
+            ack_char == XMODEM_CAN
+        ) {
+            return XMODEM_ERR_CANCEL;
+        }
+    }
+
+    return XMODEM_ERR_TIMEOUT;
+}
+
+int
+xmodem_recv(
+    serial_t src_fd,
+    int out_fd,
+    int stream,
+    void (*status_cb)(size_t received, int nak_fails)
+)
+{
+    uint8_t buf[2 + 1024 + 2]; /* idx | ~idx | payload | CRC/CSUM */
+    uint8_t *wbuf;
+    size_t wlen = 0;
+    size_t received = 0;
+    uint8_t packet_num = 1;
+    int use_crc = 1;
+    int started = 0;
+    int errors = 0;
+    int nak_fails = 0;
+    int ret = 0;
+
+    wbuf = malloc(XMODEM_WBUF_SZ);
+    if (!wbuf) {
+        return -1;
+    }
+
+    while (1) {
+        uint8_t start_byte;
+        int block_sz;
+        int trailer;
+        int valid;
+
+        /* a streaming sender does not go back for anything */
+        if (stream && started && errors) {
+            _xmodem_cancel(src_fd);
+            ret = XMODEM_ERR_DAMAGED;
+            break;
+        }
+
+        if (errors == 10) {
+            _xmodem_cancel(src_fd);
+            ret = XMODEM_ERR_TIMEOUT;
+            break;
+        }
+
+        /* ask for streaming, then CRC, a few times each before falling back */
+        if (!started) {
+            if (errors == 3 && stream) {
+                stream = 0;
+                errors = 0;
+            } else if (errors == 3) {
+                use_crc = 0;
             }
+            serial_write(
+                src_fd,
+                &(uint8_t){
+                    stream ? XMODEM_G : use_crc ? XMODEM_CRC : XMODEM_NAK
+                },
+                1
+            );
+        }
 
-            if (_xmodem_wait(dest_fd, &recv_char, XMODEM_TIMEOUT)) {
-                return XMODEM_ERR_READ;
+        if (_xmodem_wait(
+                src_fd, &start_byte, started ? XMODEM_TIMEOUT : XMODEM_START_TO
+        )) {
+            if (started) {
+                serial_write(src_fd, &(uint8_t){XMODEM_NAK}, 1);
             }
+            errors++;
+            continue;
+        }
 
-            if (recv_char == XMODEM_ACK) {
+        if (start_byte == XMODEM_EOT) {
+            serial_write(src_fd, &(uint8_t){XMODEM_ACK}, 1);
+            break;
+        } else if (start_byte == XMODEM_CAN) {
+            /* a lone CAN could be line noise */
+            if (
+                !_xmodem_wait(src_fd, &start_byte, XMODEM_BYTE_TO) &&
+                start_byte == XMODEM_CAN
+            ) {
+                ret = XMODEM_ERR_CANCEL;
                 break;
-            } else if (recv_char == XMODEM_CAN) {
-                return XMODEM_ERR_CANCEL;
             }
-
-            retries++;
-            ack_fails++;
+            continue;
+        } else if (start_byte == XMODEM_SOH) {
+            block_sz = 128;
+        } else if (start_byte == XMODEM_STX) {
+            block_sz = 1024;
+        } else {
+            _xmodem_purge(src_fd);
+            if (started) {
+                serial_write(src_fd, &(uint8_t){XMODEM_NAK}, 1);
+            }
+            errors++;
+            continue;
         }
 
-        sent += read_len;
-        packet_num++; /* expect overflow */
-        status_cb(sent, sz, ack_fails);
-    }
+        trailer = use_crc ? 2 : 1;
+        if (_xmodem_read_all(
+                src_fd, buf, 2 + block_sz + trailer, XMODEM_BYTE_TO
+        )) {
+            valid = 0;
+        } else if (use_crc) {
+            uint16_t crc = crc16(&buf[2], block_sz);
 
-end_of_transmission:
-    retries = 0;
-    while (1) {
-        uint8_t ack_char;
+            valid = buf[2 + block_sz] == (uint8_t)(crc >> 8) &&
+                buf[3 + block_sz] == (uint8_t)crc;
+        } else {
+            valid = buf[2 + block_sz] == _xmodem_csum(&buf[2], block_sz);
+        }
 
-        if (retries == 10) {
-            return XMODEM_ERR_TIMEOUT;
+        if ((!valid || buf[0] != (uint8_t)~buf[1]) && stream) {
+            _xmodem_cancel(src_fd);
+            ret = XMODEM_ERR_DAMAGED;
+            break;
+        } else if (!valid || buf[0] != (uint8_t)~buf[1]) {
+            _xmodem_purge(src_fd);
+            serial_write(src_fd, &(uint8_t){XMODEM_NAK}, 1);
+            errors++;
+            nak_fails++;
+            continue;
         }
 
-        serial_write(dest_fd, &(uint8_t){XMODEM_EOT}, 1);
+        started = 1;
+        errors = 0;
 
-        if (
-            !_xmodem_wait(dest_fd, &ack_char, XMODEM_TIMEOUT) &&
-            ack_char == XMODEM_ACK
-        ) {
+        /* our ACK got lost and the sender went again, it is already written */
+        if (buf[0] == (uint8_t)(packet_num - 1)) {
+            serial_write(src_fd, &(uint8_t){XMODEM_ACK}, 1);
+            continue;
+        }
+
+        /* anything else means a block went missing, no recovering from that */
+        if (buf[0] != packet_num) {
+            _xmodem_cancel(src_fd);
+            ret = XMODEM_ERR_SYNC;
             break;
         }
 
-        retries++;
+        if (wlen + block_sz > XMODEM_WBUF_SZ) {
+            if (write(out_fd, wbuf, wlen) != wlen) {
+                _xmodem_cancel(src_fd);
+                ret = XMODEM_ERR_FILEIO;
+                break;
+            }
+            wlen = 0;
+        }
+        memcpy(&wbuf[wlen], &buf[2], block_sz);
+        wlen += block_sz;
+
+        if (!stream) {
+            serial_write(src_fd, &(uint8_t){XMODEM_ACK}, 1);
+        }
+
+        received += block_sz;
+        packet_num++; /* expect overflow */
+        status_cb(received, nak_fails);
+    }
+
+    if (wlen > 0 && write(out_fd, wbuf, wlen) != wlen && !ret) {
+        ret = XMODEM_ERR_FILEIO;
     }
+    free(wbuf);
 
     return ret;
 }
@@ -162,35 +530,47 @@ _xmodem_wait(serial_t fd, uint8_t *ret, int timeout_ms)
     return 0;
 }
 
-uint8_t
-_xmodem_csum(const uint8_t *data, size_t sz)
+/* read exactly len bytes, giving up once nothing comes for timeout_ms */
+int
+_xmodem_read_all(serial_t fd, uint8_t *buf, size_t len, int timeout_ms)
 {
-    uint16_t sum = 0;
-    int i;
-    for (i = 0; i < sz; i++) {
-        sum += data[i];
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t ret = serial_read_to(fd, &buf[got], len - got, timeout_ms);
+
+        if (ret <= 0) {
+            return -1;
+        }
+
+        got += ret;
     }
-    return (uint8_t)(sum & 0xff);
+
+    return 0;
 }
 
-uint16_t
-_xmodem_crc(const uint8_t *data, size_t len)
+/* throw away whatever is left of a bad block, until the line goes quiet */
+void
+_xmodem_purge(serial_t fd)
 {
-    uint16_t crc = 0;
+    uint8_t buf[1024];
 
-    while ((len--) > 0) {
-        uint8_t i = 8;
+    while (serial_read_to(fd, buf, sizeof(buf), XMODEM_BYTE_TO) > 0);
+}
 
-        crc = crc ^ (uint16_t) *data++ << 8;
+void
+_xmodem_cancel(serial_t fd)
+{
+    serial_write(fd, (uint8_t []){XMODEM_CAN, XMODEM_CAN}, 2);
+}
 
-        do {
-            if (crc & 0x8000) {
-                crc = crc << 1 ^ 0x1021;
-            } else {
-                crc = crc << 1;
-            }
-        } while (--i);
+uint8_t
+_xmodem_csum(const uint8_t *data, size_t sz)
+{
+    uint16_t sum = 0;
+    int i;
+    for (i = 0; i < sz; i++) {
+        sum += data[i];
     }
-
-    return (crc);
+    return (uint8_t)(sum & 0xff);
 }
@@ -2,6 +2,7 @@
 #define _XMODEM_H_
 
 #include <stdio.h>
+#include <time.h>
 
 #include "serial.h"
 
@@ -13,6 +14,7 @@
 #define XMODEM_ETB           (0x17)
 #define XMODEM_CAN           (0x18)
 #define XMODEM_CRC           (0x43) /* 'C' */
+#define XMODEM_G             (0x47) /* 'G' */
 #define XMODEM_PAD           (0x1A)
 
 #define XMODEM_TIMEOUT       (10000) /* in ms */
@@ -23,11 +25,15 @@
 #define XMODEM_ERR_READ      (4) /* Failed to read from the serial connection */
 #define XMODEM_ERR_CANCEL    (5) /* Sender cancelled the transmission */
 #define XMODEM_ERR_DONE      (6) /* Sender finished the transmission */
+#define XMODEM_ERR_SYNC      (7) /* A block came out of sequence */
+#define XMODEM_ERR_DAMAGED   (8) /* A streamed block arrived damaged */
 
 /*
  * Following this setup: https://pythonhosted.org/xmodem/xmodem.html
  * Choose to send `sz` bytes from `in_fd` to `dest_fd` via XModem with a payload
- * length of `block_sz`.
+ * length of `block_sz`. A receiver that starts with 'G' (XModem-1K-G or
+ * YModem-G) gets the blocks back to back without waiting for ACKs, and the
+ * transfer stops if it cancels.
  */
 int xmodem_send(
     serial_t dest_fd,
@@ -37,12 +43,37 @@ int xmodem_send(
     void (*status_cb)(size_t sent, size_t total, int ack_fails)
 );
 
-#if 0
-/* Receive an xmodem message
- *
- * If sz is non-negative, then only that many bytes will actually be written
- * to fd. But the entire xmodem transfer will be completed */
-int xmodem_recv(int in_fd, int dest_fd, ssize_t sz);
-#endif
+/*
+ * Send one file of a YModem batch: block 0 with `name`, `sz` and `mtime`, then
+ * `sz` bytes of `in_fd` in 1024 byte blocks with a 128 byte block for a short
+ * tail. The receiver cuts the file to `sz`, so the padding never lands in it.
+ * Call once per file and then `ymodem_finish`.
+ */
+int ymodem_send(
+    serial_t dest_fd,
+    int in_fd,
+    const char *name,
+    size_t sz,
+    time_t mtime,
+    void (*status_cb)(size_t sent, size_t total, int ack_fails)
+);
+
+/* End a YModem batch with an empty block 0 */
+int ymodem_finish(serial_t dest_fd);
+
+/*
+ * Receive a file from `src_fd` over XModem into `out_fd`, taking 128 and 1024
+ * byte blocks with a CRC, or checksums if the sender does not answer 'C'.
+ * Blocks go through a write buffer, so the file is never held in memory. The
+ * padding of the last block is kept since XModem has no file size. With
+ * `stream`, ask for 'G' first, blocks are then not ACKed and the first damaged
+ * one cancels the transfer.
+ */
+int xmodem_recv(
+    serial_t src_fd,
+    int out_fd,
+    int stream,
+    void (*status_cb)(size_t received, int nak_fails)
+);
 
 #endif /* _XMODEM_H_ */
@@ -0,0 +1,802 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc16.h"
+#include "crc32.h"
+#include "zmodem.h"
+
+#define ZPAD        '*'
+#define ZDLE        (0x18) /* also CAN */
+#define ZBIN        'A' /* binary header with CRC-16 */
+#define ZHEX        'B' /* hex header */
+#define ZBIN32      'C' /* binary header with CRC-32 */
+
+/* how a data subpacket ends */
+#define ZCRCE       'h' /* the frame ends, a header follows */
+#define ZCRCG       'i' /* the frame goes on */
+#define ZCRCQ       'j' /* the frame goes on, ZACK expected */
+#define ZCRCW       'k' /* the frame ends, ZACK expected */
+#define ZRUB0       'l' /* escaped 0x7F */
+#define ZRUB1       'm' /* escaped 0xFF */
+
+/* ZRINIT flags, in ZF0 */
+#define CANFDX      (0x01) /* can send and receive at the same time */
+#define CANOVIO     (0x02) /* can receive while writing to disk */
+#define CANFC32     (0x20) /* can do CRC-32 */
+#define ESCCTL      (0x40) /* wants all control characters escaped */
+
+/* ZFILE conversion options, in ZF0 */
+#define ZCBIN       (1)
+#define ZCRESUM     (3)
+
+#define XON         (0x11)
+#define XOFF        (0x13)
+
+#define ZM_TIMEOUT  (10000) /* in ms */
+#define ZM_BYTE_TO  (1000) /* the most a header may pause for */
+#define ZM_RETRIES  (10)
+#define ZM_SUBPKT   (1024)
+#define ZM_GARBAGE  (1200) /* bytes to look through for a header */
+
+/* what get_header returns besides frame types */
+#define ZM_NONE     (-1)
+#define ZM_GOTCAN   (-2)
+
+enum zm_frame_enum {
+    ZRQINIT = 0,
+    ZRINIT,
+    ZSINIT,
+    ZACK,
+    ZFILE,
+    ZSKIP,
+    ZNAK,
+    ZABORT,
+    ZFIN,
+    ZRPOS,
+    ZDATA,
+    ZEOF,
+    ZFERR,
+    ZCRC,
+    ZCHALLENGE,
+    ZCOMPL,
+    ZCAN,
+};
+
+static struct {
+    serial_t fd;
+    /* what the receiver can do, from its ZRINIT */
+    int use_crc32;
+    int esc_ctl;
+    int can_overlap;
+    size_t buflen; /* 0 for no limit */
+    /* received bytes not looked at yet */
+    uint8_t rx[256];
+    size_t rx_len;
+    size_t rx_pos;
+    /* a subpacket at its worst, every byte escaped */
+    uint8_t tx[2 * ZM_SUBPKT + 64];
+    size_t tx_len;
+    uint8_t last; /* last byte on the wire, for the @ CR rule */
+} zm;
+
+static int send_file(
+    int in_fd,
+    const char *name,
+    size_t sz,
+    time_t mtime,
+    int resume,
+    void (*status_cb)(size_t sent, size_t total, int resends)
+);
+static int send_data(
+    int in_fd,
+    size_t sz,
+    size_t pos,
+    void (*status_cb)(size_t sent, size_t total, int resends)
+);
+static void put_raw(uint8_t c);
+static void put_esc(uint8_t c);
+static int flush_tx(void);
+static int send_hex_header(int type, const uint8_t hdr[4]);
+static int send_bin_header(int type, const uint8_t hdr[4]);
+static int send_subpacket(const uint8_t *buf, size_t len, int end);
+static void send_cancel(void);
+static int get_byte(int to_ms);
+static int get_zdle(int to_ms);
+static int get_hex(int to_ms);
+static int get_header(int to_ms, uint8_t hdr[4]);
+static int poll_header(uint8_t hdr[4]);
+static void pos_hdr(uint8_t hdr[4], size_t pos);
+static size_t hdr_pos(const uint8_t hdr[4]);
+
+int
+zmodem_begin(serial_t dest_fd)
+{
+    static const uint8_t zeros[4] = { 0 };
+
+    memset(&zm, 0, sizeof(zm));
+    zm.fd = dest_fd;
+
+    /* a shell on the other end runs rz for us */
+    for (const char *p = "rz\r"; *p; p++) {
+        put_raw(*p);
+    }
+
+    for (int tries = 0; tries < ZM_RETRIES; tries++) {
+        uint8_t hdr[4];
+
+        if (send_hex_header(ZRQINIT, zeros)) {
+            return ZMODEM_ERR_WRITE;
+        }
+
+        switch (get_header(ZM_TIMEOUT, hdr)) {
+        case ZRINIT:
+            zm.use_crc32 = !!(hdr[3] & CANFC32);
+            zm.esc_ctl = !!(hdr[3] & ESCCTL);
+            zm.can_overlap = (hdr[3] & (CANFDX | CANOVIO)) == (CANFDX | CANOVIO);
+            zm.buflen = hdr[0] | hdr[1] << 8;
+            return 0;
+        case ZCHALLENGE:
+            send_hex_header(ZACK, hdr);
+            break;
+        case ZM_GOTCAN:
+        case ZCAN:
+        case ZABORT:
+            return ZMODEM_ERR_CANCEL;
+        default:
+            break;
+        }
+    }
+
+    return ZMODEM_ERR_TIMEOUT;
+}
+
+int
+zmodem_send(
+    int in_fd,
+    const char *name,
+    size_t sz,
+    time_t mtime,
+    int resume,
+    void (*status_cb)(size_t sent, size_t total, int resends)
+)
+{
+    int ret = send_file(in_fd, name, sz, mtime, resume, status_cb);
+
+    /* the receiver is still waiting on us, tell it to give up */
+    if (ret && ret != ZMODEM_ERR_CANCEL && ret != ZMODEM_ERR_SKIPPED) {
+        send_cancel();
+    }
+
+    return ret;
+}
+
+int
+zmodem_end()
+{
+    static const uint8_t zeros[4] = { 0 };
+
+    for (int tries = 0; tries < ZM_RETRIES; tries++) {
+        uint8_t hdr[4];
+
+        if (send_hex_header(ZFIN, zeros)) {
+            return ZMODEM_ERR_WRITE;
+        }
+
+        switch (get_header(ZM_TIMEOUT, hdr)) {
+        case ZFIN:
+            /* over and out */
+            put_raw('O');
+            put_raw('O');
+            return flush_tx() ? ZMODEM_ERR_WRITE : 0;
+        case ZM_GOTCAN:
+        case ZCAN:
+        case ZABORT:
+            return ZMODEM_ERR_CANCEL;
+        default:
+            break;
+        }
+    }
+
+    return ZMODEM_ERR_TIMEOUT;
+}
+
+/* offer the file with ZFILE and send it from wherever the receiver asks */
+static int
+send_file(
+    int in_fd,
+    const char *name,
+    size_t sz,
+    time_t mtime,
+    int resume,
+    void (*status_cb)(size_t sent, size_t total, int resends)
+)
+{
+    uint8_t info[ZM_SUBPKT];
+    size_t info_len;
+
+    /* the name and then its size and mtime, like YModem's block 0 */
+    info_len = snprintf(
+        (char *)info, sizeof(info), "%s%c%zu %lo",
+        name, 0, sz, (unsigned long)mtime
+    ) + 1;
+    if (info_len > sizeof(info)) {
+        return ZMODEM_ERR_FILEIO;
+    }
+
+    for (int tries = 0; tries < ZM_RETRIES; tries++) {
+        uint8_t hdr[4] = { 0, 0, 0, resume ? ZCRESUM : ZCBIN };
+        int type;
+
+        if (
+            send_bin_header(ZFILE, hdr) ||
+            send_subpacket(info, info_len, ZCRCW)
+        ) {
+            return ZMODEM_ERR_WRITE;
+        }
+
+        /* a ZACK can still be on its way from the last file */
+        do {
+            type = get_header(ZM_TIMEOUT, hdr);
+        } while (type == ZACK);
+
+        switch (type) {
+        case ZRPOS:
+            return send_data(in_fd, sz, hdr_pos(hdr), status_cb);
+        case ZSKIP:
+            return ZMODEM_ERR_SKIPPED;
+        case ZM_GOTCAN:
+        case ZCAN:
+        case ZABORT:
+        case ZFERR:
+            return ZMODEM_ERR_CANCEL;
+        default:
+            /* e.g. ZRINIT or ZNAK, it did not get the ZFILE */
+            break;
+        }
+    }
+
+    return ZMODEM_ERR_TIMEOUT;
+}
+
+/*
+ * Stream the file from pos on as ZCRCG subpackets, without waiting on the
+ * receiver. Every quarter window a ZCRCQ asks for a ZACK, and the sender
+ * stops to wait for one once a whole window is unacknowledged. A ZRPOS from
+ * the receiver starts a new frame from where it says. A receiver that cannot
+ * take data while writing it out, or only takes a buffer full, gets ZCRCW
+ * frames it has to ZACK before the next one.
+ */
+static int
+send_data(
+    int in_fd,
+    size_t sz,
+    size_t pos,
+    void (*status_cb)(size_t sent, size_t total, int resends)
+)
+{
+    uint8_t buf[ZM_SUBPKT];
+    uint8_t hdr[4];
+    size_t acked;
+    size_t last_q;
+    size_t frame_len;
+    size_t restart_pos = (size_t)-1;
+    int stuck = 0;
+    int resends = 0;
+
+restart:
+    if (pos > sz) {
+        pos = sz;
+    }
+
+    /* the receiver keeps asking for the same spot, it is not getting better */
+    if (restart_pos != (size_t)-1 && pos <= restart_pos) {
+        if (++stuck > ZM_RETRIES) {
+            return ZMODEM_ERR_TIMEOUT;
+        }
+    } else {
+        stuck = 0;
+    }
+    restart_pos = pos;
+
+    if (lseek(in_fd, pos, SEEK_SET) != (off_t)pos) {
+        return ZMODEM_ERR_FILEIO;
+    }
+
+    acked = pos;
+    last_q = pos;
+    frame_len = 0;
+
+    while (pos < sz) {
+        size_t n = sz - pos < ZM_SUBPKT ? sz - pos : ZM_SUBPKT;
+        int end;
+        int type;
+
+        if (frame_len == 0) {
+            pos_hdr(hdr, pos);
+            if (send_bin_header(ZDATA, hdr)) {
+                return ZMODEM_ERR_WRITE;
+            }
+        }
+
+        if (read(in_fd, buf, n) != n) {
+            return ZMODEM_ERR_FILEIO;
+        }
+
+        if (pos + n == sz) {
+            end = ZCRCE;
+        } else if (!zm.can_overlap || (zm.buflen && frame_len + n >= zm.buflen)) {
+            end = ZCRCW;
+        } else if (pos + n - last_q >= ZMODEM_WINDOW / 4) {
+            end = ZCRCQ;
+            last_q = pos + n;
+        } else {
+            end = ZCRCG;
+        }
+
+        if (send_subpacket(buf, n, end)) {
+            return ZMODEM_ERR_WRITE;
+        }
+
+        pos += n;
+        frame_len += n;
+        status_cb(pos, sz, resends);
+
+        if (end == ZCRCE) {
+            break;
+        }
+
+        /* the frame ended, wait for the receiver to take it */
+        if (end == ZCRCW) {
+            type = get_header(ZM_TIMEOUT, hdr);
+            if (type == ZACK) {
+                acked = pos;
+                frame_len = 0;
+                continue;
+            }
+        } else {
+            type = poll_header(hdr);
+            if (type == ZACK) {
+                acked = hdr_pos(hdr) > acked ? hdr_pos(hdr) : acked;
+            }
+
+            /* a window out, wait for a ZACK to move it on */
+            while ((type == ZM_NONE || type == ZACK) && pos - acked >= ZMODEM_WINDOW) {
+                type = get_header(ZM_TIMEOUT, hdr);
+                if (type == ZACK) {
+                    acked = hdr_pos(hdr) > acked ? hdr_pos(hdr) : acked;
+                } else if (type == ZM_NONE) {
+                    break;
+                }
+            }
+
+            if (type == ZACK || (type == ZM_NONE && pos - acked < ZMODEM_WINDOW)) {
+                continue;
+            }
+        }
+
+        switch (type) {
+        case ZRPOS:
+            pos = hdr_pos(hdr);
+            resends++;
+            goto restart;
+        case ZSKIP:
+            return ZMODEM_ERR_SKIPPED;
+        case ZM_GOTCAN:
+        case ZCAN:
+        case ZABORT:
+        case ZFERR:
+            return ZMODEM_ERR_CANCEL;
+        default:
+            /* nothing heard back, go again from what it has */
+            pos = acked;
+            resends++;
+            goto restart;
+        }
+    }
+
+    /* tell the receiver where the file ends, it answers with ZRINIT once it
+     * has all of it */
+    for (int tries = 0; tries < ZM_RETRIES; tries++) {
+        int type;
+
+        pos_hdr(hdr, sz);
+        if (send_hex_header(ZEOF, hdr)) {
+            return ZMODEM_ERR_WRITE;
+        }
+
+        do {
+            type = get_header(ZM_TIMEOUT, hdr);
+        } while (type == ZACK);
+
+        switch (type) {
+        case ZRINIT:
+            return 0;
+        case ZRPOS:
+            pos = hdr_pos(hdr);
+            resends++;
+            goto restart;
+        case ZSKIP:
+            return ZMODEM_ERR_SKIPPED;
+        case ZM_GOTCAN:
+        case ZCAN:
+        case ZABORT:
+        case ZFERR:
+            return ZMODEM_ERR_CANCEL;
+        default:
+            break;
+        }
+    }
+
+    return ZMODEM_ERR_TIMEOUT;
+}
+
+static void
+put_raw(uint8_t c)
+{
+    /* only headers go out in pieces, a subpacket always fits */
+    if (zm.tx_len == sizeof(zm.tx)) {
+        flush_tx();
+    }
+
+    zm.tx[zm.tx_len++] = c;
+    zm.last = c;
+}
+
+/* ZDLE, the flow control characters and CR after @ (telnet's escape) always
+ * get escaped, the other control characters only if the receiver asks */
+static void
+put_esc(uint8_t c)
+{
+    uint8_t lo = c & 0x7F;
+
+    if (
+        lo == ZDLE || lo == 0x10 || lo == XON || lo == XOFF ||
+        (lo == '\r' && (zm.last & 0x7F) == '@') ||
+        (zm.esc_ctl && (c & 0x60) == 0)
+    ) {
+        put_raw(ZDLE);
+        c ^= 0x40;
+    }
+
+    put_raw(c);
+}
+
+static int
+flush_tx()
+{
+    size_t off = 0;
+    int waited_ms = 0;
+
+    while (off < zm.tx_len) {
+        ssize_t ret = serial_write(zm.fd, &zm.tx[off], zm.tx_len - off);
+
+        if (ret > 0) {
+            off += ret;
+            waited_ms = 0;
+            continue;
+        }
+
+        /* the device is not keeping up */
+        if (++waited_ms > ZM_TIMEOUT) {
+            zm.tx_len = 0;
+            return -1;
+        }
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+
+    zm.tx_len = 0;
+
+    return 0;
+}
+
+static int
+send_hex_header(int type, const uint8_t hdr[4])
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t raw[5] = { type, hdr[0], hdr[1], hdr[2], hdr[3] };
+    uint16_t crc = crc16(raw, sizeof(raw));
+    uint8_t all[7] = { raw[0], raw[1], raw[2], raw[3], raw[4], crc >> 8, crc & 0xFF };
+
+    put_raw(ZPAD);
+    put_raw(ZPAD);
+    put_raw(ZDLE);
+    put_raw(ZHEX);
+    for (int i = 0; i < sizeof(all); i++) {
+        put_raw(hex[all[i] >> 4]);
+        put_raw(hex[all[i] & 0xF]);
+    }
+    put_raw('\r');
+    put_raw('\n' | 0x80);
+
+    /* undo an XOFF the header may have been mistaken for */
+    if (type != ZFIN && type != ZACK) {
+        put_raw(XON);
+    }
+
+    return flush_tx();
+}
+
+static int
+send_bin_header(int type, const uint8_t hdr[4])
+{
+    uint8_t raw[5] = { type, hdr[0], hdr[1], hdr[2], hdr[3] };
+
+    put_raw(ZPAD);
+    put_raw(ZDLE);
+    put_raw(zm.use_crc32 ? ZBIN32 : ZBIN);
+    for (int i = 0; i < sizeof(raw); i++) {
+        put_esc(raw[i]);
+    }
+
+    if (zm.use_crc32) {
+        uint32_t crc = crc32(raw, sizeof(raw));
+
+        for (int i = 0; i < 4; i++) {
+            put_esc(crc >> (8 * i));
+        }
+    } else {
+        uint16_t crc = crc16(raw, sizeof(raw));
+
+        put_esc(crc >> 8);
+        put_esc(crc & 0xFF);
+    }
+
+    return flush_tx();
+}
+
+/* the CRC covers the data and the byte that ends it */
+static int
+send_subpacket(const uint8_t *buf, size_t len, int end)
+{
+    uint8_t end_byte = end;
+
+    for (size_t i = 0; i < len; i++) {
+        put_esc(buf[i]);
+    }
+    put_raw(ZDLE);
+    put_raw(end);
+
+    if (zm.use_crc32) {
+        uint32_t crc = crc32_update(crc32(buf, len), &end_byte, 1);
+
+        for (int i = 0; i < 4; i++) {
+            put_esc(crc >> (8 * i));
+        }
+    } else {
+        uint16_t crc = crc16_update(crc16(buf, len), &end_byte, 1);
+
+        put_esc(crc >> 8);
+        put_esc(crc & 0xFF);
+    }
+
+    if (end == ZCRCW) {
+        put_raw(XON);
+    }
+
+    return flush_tx();
+}
+
+/* 8 CANs abort the receiver, the backspaces clean up if it was a shell */
+static void
+send_cancel()
+{
+    zm.tx_len = 0;
+    for (int i = 0; i < 8; i++) {
+        put_raw(ZDLE);
+    }
+    for (int i = 0; i < 8; i++) {
+        put_raw('\b');
+    }
+    flush_tx();
+}
+
+static int
+get_byte(int to_ms)
+{
+    if (zm.rx_pos == zm.rx_len) {
+        ssize_t n = serial_read_to(zm.fd, zm.rx, sizeof(zm.rx), to_ms);
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        zm.rx_len = n;
+        zm.rx_pos = 0;
+    }
+
+    return zm.rx[zm.rx_pos++];
+}
+
+/* a byte of a binary header with the escaping undone, -1 on a timeout or a
+ * bad escape and ZM_GOTCAN on 5 CANs in a row */
+static int
+get_zdle(int to_ms)
+{
+    int c;
+    int cans = 1;
+
+    do {
+        c = get_byte(to_ms);
+    } while (c == XON || c == XOFF || c == (XON | 0x80) || c == (XOFF | 0x80));
+
+    if (c != ZDLE) {
+        return c;
+    }
+
+    while (1) {
+        c = get_byte(to_ms);
+
+        if (c == ZDLE) {
+            if (++cans == 5) {
+                return ZM_GOTCAN;
+            }
+        } else if (c == ZRUB0) {
+            return 0x7F;
+        } else if (c == ZRUB1) {
+            return 0xFF;
+        } else if (c >= 0 && (c & 0x60) == 0x40) {
+            return c ^ 0x40;
+        } else {
+            return -1;
+        }
+    }
+}
+
+static int
+get_hex(int to_ms)
+{
+    int ret = 0;
+
+    for (int i = 0; i < 2; i++) {
+        int c = get_byte(to_ms);
+
+        if (c >= '0' && c <= '9') {
+            ret = ret << 4 | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            ret = ret << 4 | (c - 'a' + 10);
+        } else {
+            return -1;
+        }
+    }
+
+    return ret;
+}
+
+/* the type of the next good header, with its 4 bytes in hdr. Returns ZM_NONE
+ * if there is none within to_ms or in the next ZM_GARBAGE bytes. */
+static int
+get_header(int to_ms, uint8_t hdr[4])
+{
+    int garbage = 0;
+    int cans = 0;
+
+    while (garbage < ZM_GARBAGE) {
+        uint8_t raw[9];
+        int len;
+        int c = get_byte(to_ms);
+
+        if (c < 0) {
+            return ZM_NONE;
+        }
+
+        /* a receiver giving up sends CANs */
+        if (c == ZDLE) {
+            if (++cans == 5) {
+                return ZM_GOTCAN;
+            }
+            continue;
+        }
+        cans = 0;
+
+        if (c != ZPAD) {
+            garbage++;
+            continue;
+        }
+
+        do {
+            c = get_byte(ZM_BYTE_TO);
+        } while (c == ZPAD);
+
+        if (c != ZDLE) {
+            garbage++;
+            continue;
+        }
+
+        c = get_byte(ZM_BYTE_TO);
+        if (c == ZHEX) {
+            for (len = 0; len < 7; len++) {
+                int b = get_hex(ZM_BYTE_TO);
+
+                if (b < 0) {
+                    break;
+                }
+                raw[len] = b;
+            }
+
+            if (len == 7 && crc16(raw, 5) == (raw[5] << 8 | raw[6])) {
+                memcpy(hdr, &raw[1], 4);
+                return raw[0];
+            }
+        } else if (c == ZBIN || c == ZBIN32) {
+            int n = c == ZBIN32 ? 9 : 7;
+
+            for (len = 0; len < n; len++) {
+                int b = get_zdle(ZM_BYTE_TO);
+
+                if (b == ZM_GOTCAN) {
+                    return ZM_GOTCAN;
+                } else if (b < 0) {
+                    break;
+                }
+                raw[len] = b;
+            }
+
+            if (len == n) {
+                int good;
+
+                if (n == 9) {
+                    uint32_t crc = crc32(raw, 5);
+
+                    good = raw[5] == (crc & 0xFF) && raw[6] == ((crc >> 8) & 0xFF) &&
+                        raw[7] == ((crc >> 16) & 0xFF) && raw[8] == crc >> 24;
+                } else {
+                    good = crc16(raw, 5) == (raw[5] << 8 | raw[6]);
+                }
+
+                if (good) {
+                    memcpy(hdr, &raw[1], 4);
+                    return raw[0];
+                }
+            }
+        }
+
+        garbage++;
+    }
+
+    return ZM_NONE;
+}
+
+/* a header the receiver sent while we were streaming, without waiting if
+ * there is none */
+static int
+poll_header(uint8_t hdr[4])
+{
+    while (1) {
+        if (zm.rx_pos == zm.rx_len) {
+            ssize_t n = serial_read(zm.fd, zm.rx, sizeof(zm.rx));
+
+            if (n <= 0) {
+                return ZM_NONE;
+            }
+
+            zm.rx_len = n;
+            zm.rx_pos = 0;
+        }
+
+        /* the line endings and XONs after hex headers */
+        if (zm.rx[zm.rx_pos] != ZPAD && zm.rx[zm.rx_pos] != ZDLE) {
+            zm.rx_pos++;
+            continue;
+        }
+
+        return get_header(ZM_BYTE_TO, hdr);
+    }
+}
+
+/* positions go least significant byte first */
+static void
+pos_hdr(uint8_t hdr[4], size_t pos)
+{
+    for (int i = 0; i < 4; i++) {
+        hdr[i] = pos >> (8 * i);
+    }
+}
+
+static size_t
+hdr_pos(const uint8_t hdr[4])
+{
+    return hdr[0] | hdr[1] << 8 | hdr[2] << 16 | (size_t)hdr[3] << 24;
+}
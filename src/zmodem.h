@@ -0,0 +1,44 @@
+#ifndef _ZMODEM_H_
+#define _ZMODEM_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#include "serial.h"
+
+/* ZModem sender. Data goes out as a stream of subpackets with CRC-32 (or
+ * CRC-16 if the receiver cannot do 32), and the receiver only answers to say
+ * where to carry on from after an error (ZRPOS) or to keep the sender within
+ * its window (ZACK). A session is zmodem_begin, zmodem_send for every file
+ * and then zmodem_end. */
+
+#define ZMODEM_ERR_TIMEOUT   (1) /* the receiver stopped answering */
+#define ZMODEM_ERR_WRITE     (2) /* failed to write to the serial connection */
+#define ZMODEM_ERR_FILEIO    (3) /* failed to read the file */
+#define ZMODEM_ERR_CANCEL    (4) /* the receiver cancelled the transfer */
+#define ZMODEM_ERR_SKIPPED   (5) /* the receiver did not want the file */
+
+#define ZMODEM_WINDOW        (32 * 1024) /* most bytes sent but not ZACKed */
+
+/* Get the receiver at dest_fd ready, starting rz on the other end if there is
+ * a shell there */
+int zmodem_begin(serial_t dest_fd);
+
+/*
+ * Send `sz` bytes of `in_fd` as `name`. With `resume`, the receiver may ask
+ * to carry on from the end of a partial copy it already has, the rest of the
+ * file is then sent from there.
+ */
+int zmodem_send(
+    int in_fd,
+    const char *name,
+    size_t sz,
+    time_t mtime,
+    int resume,
+    void (*status_cb)(size_t sent, size_t total, int resends)
+);
+
+/* End the session */
+int zmodem_end(void);
+
+#endif /* _ZMODEM_H_ */